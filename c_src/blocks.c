@@ -15,6 +15,7 @@
 #include "parser.h"
 #include "cmark.h"
 #include "node.h"
+#include "iterator.h"
 #include "references.h"
 #include "utf8.h"
 #include "scanners.h"
@@ -23,6 +24,32 @@
 #include "buffer.h"
 #include "chunk.h"
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+
+static int S_pthread_create(void **thread, void *(*start)(void *),
+                            void *arg) {
+  pthread_t *handle = (pthread_t *)malloc(sizeof(pthread_t));
+
+  if (handle == NULL)
+    return -1;
+  if (pthread_create(handle, NULL, start, arg) != 0) {
+    free(handle);
+    return -1;
+  }
+  *thread = handle;
+  return 0;
+}
+
+static void S_pthread_join(void *thread) {
+  pthread_join(*(pthread_t *)thread, NULL);
+  free(thread);
+}
+
+static const cmark_thread_functions S_pthread_functions = {S_pthread_create,
+                                                           S_pthread_join};
+#endif
+
 #define CODE_INDENT 4
 #define TAB_STOP 4
 
@@ -69,12 +96,12 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
 static void S_process_line(cmark_parser *parser, const unsigned char *buffer,
                            bufsize_t bytes);
 
-static cmark_node *make_block(cmark_mem *mem, cmark_node_type tag,
-                              int start_line, int start_column) {
+static cmark_node *make_block(cmark_mem *mem, cmark_node *document,
+                              cmark_node_type tag, int start_line,
+                              int start_column) {
   cmark_node *e;
 
-  e = (cmark_node *)mem->calloc(1, sizeof(*e));
-  e->mem = mem;
+  e = cmark_node_alloc(mem, document);
   e->type = (uint16_t)tag;
   e->flags = CMARK_NODE__OPEN;
   e->start_line = start_line;
@@ -86,7 +113,7 @@ static cmark_node *make_block(cmark_mem *mem, cmark_node_type tag,
 
 // Create a root document node.
 static cmark_node *make_document(cmark_mem *mem) {
-  cmark_node *e = make_block(mem, CMARK_NODE_DOCUMENT, 1, 1);
+  cmark_node *e = make_block(mem, NULL, CMARK_NODE_DOCUMENT, 1, 1);
   return e;
 }
 
@@ -99,6 +126,7 @@ cmark_parser *cmark_parser_new_with_mem(int options, cmark_mem *mem) {
   cmark_strbuf_init(mem, &parser->curline, 256);
   cmark_strbuf_init(mem, &parser->linebuf, 0);
   cmark_strbuf_init(mem, &parser->content, 0);
+  cmark_strbuf_init(mem, &parser->source, 0);
 
   parser->refmap = cmark_reference_map_new(mem);
   parser->root = document;
@@ -114,6 +142,10 @@ cmark_parser *cmark_parser_new_with_mem(int options, cmark_mem *mem) {
   parser->partially_consumed_tab = false;
   parser->last_line_length = 0;
   parser->options = options;
+  parser->threads = 1;
+#ifdef HAVE_PTHREAD_H
+  parser->thread_functions = &S_pthread_functions;
+#endif
   parser->last_buffer_ended_with_cr = false;
 
   return parser;
@@ -127,7 +159,9 @@ cmark_parser *cmark_parser_new(int options) {
 void cmark_parser_free(cmark_parser *parser) {
   cmark_mem *mem = parser->mem;
   cmark_strbuf_free(&parser->curline);
+  cmark_strbuf_free(&parser->content);
   cmark_strbuf_free(&parser->linebuf);
+  cmark_strbuf_free(&parser->source);
   cmark_reference_map_free(parser->refmap);
   mem->free(parser);
 }
@@ -135,9 +169,11 @@ void cmark_parser_free(cmark_parser *parser) {
 static cmark_node *finalize(cmark_parser *parser, cmark_node *b);
 
 // Returns true if line has only space characters, else false.
-static bool is_blank(cmark_strbuf *s, bufsize_t offset) {
-  while (offset < s->size) {
-    switch (s->ptr[offset]) {
+static bool is_blank(const unsigned char *s, bufsize_t len) {
+  bufsize_t offset = 0;
+
+  while (offset < len) {
+    switch (s[offset]) {
     case '\r':
     case '\n':
       return true;
@@ -174,17 +210,76 @@ static CMARK_INLINE bool contains_inlines(cmark_node_type block_type) {
           block_type == CMARK_NODE_HEADING);
 }
 
+// Copy the block content collected as a span of the source so far into
+// parser->content, so that lines which differ from the source can be
+// appended.
+static void materialize_content(cmark_parser *parser) {
+  cmark_chunk *span = &parser->content_span;
+
+  if (span->data != NULL) {
+    cmark_strbuf_put(&parser->content, span->data, span->len);
+    span->data = NULL;
+    span->len = 0;
+  }
+}
+
+// Try to add 'len' bytes of the source at 'src' to the block content
+// without copying them.  Returns false if the content can't stay a span.
+static bool extend_content_span(cmark_parser *parser, const unsigned char *src,
+                                bufsize_t len) {
+  cmark_chunk *span = &parser->content_span;
+
+  if (span->data != NULL && span->data + span->len == src) {
+    span->len += len;
+    return true;
+  } else if (span->data == NULL && parser->content.size == 0) {
+    span->data = src;
+    span->len = len;
+    return true;
+  }
+
+  return false;
+}
+
+// Hand the content of the block being finalized over to 'b'.  Content
+// that is still a span of the source is borrowed instead of copied;
+// this is only used for blocks whose content is discarded once inlines
+// are parsed.
+static void take_content(cmark_parser *parser, cmark_node *b) {
+  cmark_chunk *span = &parser->content_span;
+
+  if (span->data != NULL) {
+    b->data = (unsigned char *)span->data;
+    b->len = span->len;
+    b->flags |= CMARK_NODE__BORROWED_DATA;
+    span->data = NULL;
+    span->len = 0;
+  } else {
+    b->len = parser->content.size;
+    b->data = cmark_strbuf_detach(&parser->content);
+  }
+}
+
 static void add_line(cmark_chunk *ch, cmark_parser *parser) {
   int chars_to_tab;
   int i;
   if (parser->partially_consumed_tab) {
+    materialize_content(parser);
     parser->offset += 1; // skip over tab
     // add space characters:
     chars_to_tab = TAB_STOP - (parser->column % TAB_STOP);
     for (i = 0; i < chars_to_tab; i++) {
       cmark_strbuf_putc(&parser->content, ' ');
     }
+  } else if (ch->len <= parser->offset) {
+    return;
+  } else if (parser->curline_source != NULL &&
+             extend_content_span(parser,
+                                 parser->curline_source + parser->offset,
+                                 ch->len - parser->offset)) {
+    return;
   }
+  materialize_content(parser);
   cmark_strbuf_put(&parser->content, ch->data + parser->offset,
                    ch->len - parser->offset);
 }
@@ -235,7 +330,10 @@ static bool S_ends_with_blank_line(cmark_node *node) {
 static bool resolve_reference_link_definitions(cmark_parser *parser) {
   bufsize_t pos;
   cmark_strbuf *node_content = &parser->content;
+  cmark_chunk *span = &parser->content_span;
   cmark_chunk chunk = {node_content->ptr, node_content->size};
+  if (span->data != NULL)
+    chunk = *span;
   while (chunk.len && chunk.data[0] == '[' &&
          (pos = cmark_parse_reference_inline(parser->mem, &chunk,
 					     parser->refmap))) {
@@ -243,8 +341,22 @@ static bool resolve_reference_link_definitions(cmark_parser *parser) {
     chunk.data += pos;
     chunk.len -= pos;
   }
+  if (span->data != NULL) {
+    *span = chunk;
+    return !is_blank(span->data, span->len);
+  }
   cmark_strbuf_drop(node_content, (node_content->size - chunk.len));
-  return !is_blank(node_content, 0);
+  return !is_blank(node_content->ptr, node_content->size);
+}
+
+// End 'b' with the line being processed, which closes it.
+static void S_end_on_current_line(cmark_parser *parser, cmark_node *b) {
+  b->end_line = parser->line_number;
+  b->end_column = parser->curline.size;
+  if (b->end_column && parser->curline.ptr[b->end_column - 1] == '\n')
+    b->end_column -= 1;
+  if (b->end_column && parser->curline.ptr[b->end_column - 1] == '\r')
+    b->end_column -= 1;
 }
 
 static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
@@ -264,14 +376,8 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
     b->end_line = parser->line_number;
     b->end_column = parser->last_line_length;
   } else if (S_type(b) == CMARK_NODE_DOCUMENT ||
-             (S_type(b) == CMARK_NODE_CODE_BLOCK && b->as.code.fenced) ||
-             (S_type(b) == CMARK_NODE_HEADING && b->as.heading.setext)) {
-    b->end_line = parser->line_number;
-    b->end_column = parser->curline.size;
-    if (b->end_column && parser->curline.ptr[b->end_column - 1] == '\n')
-      b->end_column -= 1;
-    if (b->end_column && parser->curline.ptr[b->end_column - 1] == '\r')
-      b->end_column -= 1;
+             (S_type(b) == CMARK_NODE_CODE_BLOCK && b->as.code.fenced)) {
+    S_end_on_current_line(parser, b);
   } else {
     b->end_line = parser->line_number - 1;
     b->end_column = parser->last_line_length;
@@ -286,14 +392,16 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
     if (!has_content) {
       // remove blank node (former reference def)
       cmark_node_free(b);
+      parser->content_span.data = NULL;
+      parser->content_span.len = 0;
     } else {
-      b->len = node_content->size;
-      b->data = cmark_strbuf_detach(node_content);
+      take_content(parser, b);
     }
     break;
   }
 
   case CMARK_NODE_CODE_BLOCK:
+    materialize_content(parser);
     if (!b->as.code.fenced) { // indented code
       remove_trailing_blank_lines(node_content);
       cmark_strbuf_putc(node_content, '\n');
@@ -326,7 +434,11 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
     break;
 
   case CMARK_NODE_HEADING:
+    take_content(parser, b);
+    break;
+
   case CMARK_NODE_HTML_BLOCK:
+    materialize_content(parser);
     b->len = node_content->size;
     b->data = cmark_strbuf_detach(node_content);
     break;
@@ -379,7 +491,8 @@ static cmark_node *add_child(cmark_parser *parser, cmark_node *parent,
   }
 
   cmark_node *child =
-      make_block(parser->mem, block_type, parser->line_number, start_column);
+      make_block(parser->mem, parser->root, block_type, parser->line_number,
+                 start_column);
   child->parent = parent;
 
   if (parent->last_child) {
@@ -393,27 +506,227 @@ static cmark_node *add_child(cmark_parser *parser, cmark_node *parent,
   return child;
 }
 
+// Hand the content of a block whose inlines have been parsed over to the
+// document, since text literals may point into it.
+static void release_inline_content(cmark_node *root, cmark_node *block) {
+  if (!(block->flags & CMARK_NODE__BORROWED_DATA))
+    cmark_document_adopt_buffer(root, block->data);
+  block->flags &= ~CMARK_NODE__BORROWED_DATA;
+  block->data = NULL;
+  block->len = 0;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+// Documents with less inline content than this are parsed on one thread.
+#define PARALLEL_INLINES_MIN_SIZE (64 * 1024)
+// Blocks a worker takes at a time.
+#define PARALLEL_INLINES_BATCH 64
+
+// Inline-bearing blocks of a document, in document order, shared by the
+// workers parsing them.
+typedef struct {
+  cmark_mem *mem;
+  cmark_reference_map *refmap;
+  int options;
+  cmark_node **blocks;
+  // reference expansion used by each block on its own
+  unsigned int *ref_size;
+  bufsize_t nblocks;
+  bufsize_t next;
+  pthread_mutex_t lock;
+} inline_jobs;
+
+typedef struct {
+  inline_jobs *jobs;
+  // private slabs for the nodes this worker creates
+  cmark_node *arena;
+  void *thread;
+  bool started;
+} inline_worker;
+
+static void *parse_inlines_worker(void *data) {
+  inline_worker *worker = (inline_worker *)data;
+  inline_jobs *jobs = worker->jobs;
+  // A view of the reference map with a scratch buffer and expansion count
+  // of its own; the table itself is only read.  Each block starts with the
+  // whole expansion budget, the total is checked after the fact.
+  cmark_reference_map refmap = *jobs->refmap;
+  bufsize_t i, end;
+
+  cmark_strbuf_init(jobs->mem, &refmap.scratch, 0);
+  for (;;) {
+    pthread_mutex_lock(&jobs->lock);
+    i = jobs->next;
+    end = MIN(i + PARALLEL_INLINES_BATCH, jobs->nblocks);
+    jobs->next = end;
+    pthread_mutex_unlock(&jobs->lock);
+    if (i == end)
+      break;
+
+    for (; i < end; i++) {
+      refmap.ref_size = 0;
+      cmark_parse_inlines(jobs->mem, worker->arena, jobs->blocks[i], &refmap,
+                          jobs->options);
+      jobs->ref_size[i] = refmap.ref_size;
+    }
+  }
+  cmark_strbuf_free(&refmap.scratch);
+  return NULL;
+}
+
+// Parse the inlines of the document on up to 'parser->threads' threads.
+// Returns false, leaving the document alone, if it is too small for that.
+static bool process_inlines_parallel(cmark_parser *parser) {
+  cmark_mem *mem = parser->mem;
+  cmark_node *root = parser->root;
+  cmark_reference_map *refmap = parser->refmap;
+  inline_jobs jobs;
+  inline_worker *workers;
+  cmark_iter iter;
+  cmark_node *cur;
+  cmark_event_type ev_type;
+  bufsize_t capacity = 0, i;
+  size_t total = 0;
+  unsigned int ref_size;
+  int nworkers = parser->threads, w;
+
+  jobs.mem = mem;
+  jobs.refmap = refmap;
+  jobs.options = parser->options;
+  jobs.blocks = NULL;
+  jobs.nblocks = 0;
+  jobs.next = 0;
+
+  cmark_iter_init(&iter, root);
+  while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+    cur = iter.cur.node;
+    if (ev_type == CMARK_EVENT_ENTER && contains_inlines(S_type(cur))) {
+      if (jobs.nblocks == capacity) {
+        capacity = capacity ? capacity * 2 : 256;
+        jobs.blocks = (cmark_node **)mem->realloc(
+            jobs.blocks, capacity * sizeof(*jobs.blocks));
+      }
+      jobs.blocks[jobs.nblocks++] = cur;
+      total += cur->len;
+      cmark_iter_reset(&iter, cur, CMARK_EVENT_EXIT);
+    }
+  }
+
+  if (total < PARALLEL_INLINES_MIN_SIZE || jobs.nblocks < 2) {
+    mem->free(jobs.blocks);
+    return false;
+  }
+
+  jobs.ref_size =
+      (unsigned int *)mem->calloc(jobs.nblocks, sizeof(*jobs.ref_size));
+  pthread_mutex_init(&jobs.lock, NULL);
+  if (nworkers > jobs.nblocks)
+    nworkers = (int)jobs.nblocks;
+  workers = (inline_worker *)mem->calloc(nworkers, sizeof(*workers));
+  for (w = 0; w < nworkers; w++) {
+    workers[w].jobs = &jobs;
+    workers[w].arena = cmark_document_new_arena(root);
+  }
+  // The calling thread is worker 0; the others pick up its slack if
+  // some of them fail to start.
+  for (w = 1; w < nworkers; w++) {
+    workers[w].started =
+        parser->thread_functions->create(&workers[w].thread,
+                                         parse_inlines_worker, &workers[w]) == 0;
+  }
+  parse_inlines_worker(&workers[0]);
+  for (w = 0; w < nworkers; w++) {
+    if (workers[w].started)
+      parser->thread_functions->join(workers[w].thread);
+    cmark_document_merge(root, root->last_child, workers[w].arena);
+  }
+  pthread_mutex_destroy(&jobs.lock);
+  mem->free(workers);
+
+  // A block parsed the same as it would have been serially unless the
+  // expansion budget ran out by the time it was reached.  From the first
+  // block where that happened on, parse again with the shared budget.
+  for (i = 0; i < jobs.nblocks; i++) {
+    ref_size = jobs.ref_size[i];
+    if (refmap->max_ref_size &&
+        ref_size > refmap->max_ref_size - refmap->ref_size)
+      break;
+    refmap->ref_size += ref_size;
+  }
+  for (; i < jobs.nblocks; i++) {
+    cur = jobs.blocks[i];
+    while (cur->first_child)
+      cmark_node_free(cur->first_child);
+    cmark_parse_inlines(mem, root, cur, refmap, parser->options);
+  }
+
+  for (i = 0; i < jobs.nblocks; i++)
+    release_inline_content(root, jobs.blocks[i]);
+  mem->free(jobs.ref_size);
+  mem->free(jobs.blocks);
+  return true;
+}
+
+#endif
+
 // Walk through node and all children, recursively, parsing
 // string content into inline content where appropriate.
-static void process_inlines(cmark_mem *mem, cmark_node *root,
-                            cmark_reference_map *refmap, int options) {
-  cmark_iter *iter = cmark_iter_new(root);
+static void process_inlines(cmark_parser *parser) {
+#ifdef HAVE_PTHREAD_H
+  if (parser->threads > 1 && process_inlines_parallel(parser))
+    return;
+#endif
+
+  cmark_parser_parse_block_inlines(parser, parser->root);
+}
+
+void cmark_parser_parse_block_inlines(cmark_parser *parser,
+                                      cmark_node *block) {
+  cmark_node *root = parser->root;
+  cmark_iter iter;
   cmark_node *cur;
   cmark_event_type ev_type;
 
-  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
-    cur = cmark_iter_get_node(iter);
+  cmark_iter_init(&iter, block);
+  while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+    cur = iter.cur.node;
     if (ev_type == CMARK_EVENT_ENTER) {
       if (contains_inlines(S_type(cur))) {
-        cmark_parse_inlines(mem, cur, refmap, options);
-        mem->free(cur->data);
-        cur->data = NULL;
-        cur->len = 0;
+        cmark_parse_inlines(parser->mem, root, cur, parser->refmap,
+                            parser->options);
+        release_inline_content(root, cur);
+        // no blocks below, so skip the inlines just parsed
+        cmark_iter_reset(&iter, cur, CMARK_EVENT_EXIT);
       }
     }
   }
+}
 
-  cmark_iter_free(iter);
+void cmark_node_parse_pending_inlines(cmark_node *node) {
+  cmark_node *owner = cmark_node_owner(node);
+  cmark_document *doc;
+  cmark_iter iter;
+  cmark_node *cur;
+  cmark_event_type ev_type;
+
+  if (owner == NULL || owner->as.document == NULL ||
+      owner->as.document->refmap == NULL) {
+    return;
+  }
+  doc = owner->as.document;
+
+  cmark_iter_init(&iter, node);
+  while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+    cur = iter.cur.node;
+    if (ev_type == CMARK_EVENT_ENTER && contains_inlines(S_type(cur))) {
+      if (cur->data != NULL) {
+        cmark_parse_inlines(node->mem, owner, cur, doc->refmap, doc->options);
+        release_inline_content(owner, cur);
+      }
+      cmark_iter_reset(&iter, cur, CMARK_EVENT_EXIT);
+    }
+  }
 }
 
 // Attempts to parse a list item marker (bullet or enumerated).
@@ -520,16 +833,23 @@ static cmark_node *finalize_document(cmark_parser *parser) {
 
   finalize(parser, parser->root);
 
-  // Limit total size of extra content created from reference links to
-  // document size to avoid superlinear growth. Always allow 100KB.
-  if (parser->total_size > 100000)
-    parser->refmap->max_ref_size = parser->total_size;
-  else
-    parser->refmap->max_ref_size = 100000;
+  parser->refmap->max_ref_size = cmark_reference_limit(parser->total_size);
 
-  process_inlines(parser->mem, parser->root, parser->refmap, parser->options);
+  if (parser->defer_inlines) {
+    // the caller parses the inlines it needs
+  } else if (parser->options & CMARK_OPT_LAZY_INLINES) {
+    cmark_document_defer_inlines(parser->root, parser->refmap,
+                                 parser->options);
+    parser->refmap = NULL;
+  } else {
+    process_inlines(parser);
+  }
 
   cmark_strbuf_free(&parser->content);
+  if (parser->source.size > 0) {
+    cmark_document_adopt_buffer(parser->root,
+                                cmark_strbuf_detach(&parser->source));
+  }
 
   return parser->root;
 }
@@ -557,11 +877,295 @@ cmark_node *cmark_parse_document(const char *buffer, size_t len, int options) {
   cmark_parser *parser = cmark_parser_new(options);
   cmark_node *document;
 
+  document = cmark_parser_parse_document(parser, buffer, len);
+  cmark_parser_free(parser);
+  return document;
+}
+
+bool cmark_parser_can_split_before(unsigned char c) {
+  return cmark_isalpha(c) ||
+         (cmark_ispunct(c) && c != '-' && c != '+' && c != '*');
+}
+
+bool cmark_parser_open_blocks_close_at_split(cmark_parser *parser) {
+  cmark_node *b;
+
+  for (b = parser->current; b != parser->root; b = b->parent) {
+    switch (S_type(b)) {
+    case CMARK_NODE_LIST:
+    case CMARK_NODE_ITEM:
+      break;
+    case CMARK_NODE_CODE_BLOCK:
+      if (b->as.code.fenced)
+        return false;
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+// Inputs smaller than this are block-parsed on one thread, and no segment
+// is made smaller than PARALLEL_BLOCKS_MIN_SEGMENT.
+#define PARALLEL_BLOCKS_MIN_SIZE (1024 * 1024)
+#define PARALLEL_BLOCKS_MIN_SEGMENT (256 * 1024)
+
+// A run of whole lines of the input that is block-parsed on its own.
+typedef struct {
+  cmark_parser *parser;
+  const unsigned char *data;
+  bufsize_t len;
+  // lines before the segment
+  int line_number;
+  // the blocks open at the end of the segment are ones the first line of
+  // the next segment closes
+  bool closed_by_next;
+  void *thread;
+  bool started;
+} block_segment;
+
+// If 'line' starts with a code fence after up to three spaces of
+// indentation, returns the length of the fence and sets 'fence_char' and
+// 'end' (the offset after the fence).  Otherwise returns 0.
+static bufsize_t S_scan_fence(const unsigned char *line, bufsize_t len,
+                              unsigned char *fence_char, bufsize_t *end) {
+  bufsize_t i = 0, start;
+
+  while (i < len && i < 3 && line[i] == ' ')
+    i++;
+  if (i == len || (line[i] != '`' && line[i] != '~'))
+    return 0;
+  *fence_char = line[i];
+  start = i;
+  while (i < len && line[i] == *fence_char)
+    i++;
+  *end = i;
+  return i - start >= 3 ? i - start : 0;
+}
+
+// Pick up to 'nsegments' - 1 split points near equal fractions of the
+// input, each at the start of a line that follows a blank line and lies
+// outside fenced code.  Fences are recognized by their look alone, so
+// whether a split is actually safe is only known once the segment before
+// it has been parsed.  Returns the number of segments.
+static int find_segments(const unsigned char *data, bufsize_t len,
+                         block_segment *segments, int nsegments) {
+  const unsigned char *line, *eol, *cr;
+  bufsize_t pos = 0, line_len, run, end = 0;
+  unsigned char c = 0, fence_char = 0;
+  bufsize_t fence_len = 0;
+  bool prev_blank = false;
+  int line_number = 0, found = 1, i;
+
+  segments[0].data = data;
+  segments[0].line_number = 0;
+  while (pos < len && found < nsegments) {
+    line = data + pos;
+    eol = (const unsigned char *)memchr(line, '\n', len - pos);
+    line_len = eol ? (bufsize_t)(eol - line) + 1 : len - pos;
+
+    if (prev_blank && fence_len == 0 &&
+        cmark_parser_can_split_before(*line) &&
+        pos >= (bufsize_t)((int64_t)len * found / nsegments)) {
+      segments[found].data = line;
+      segments[found].line_number = line_number;
+      found++;
+    }
+
+    run = S_scan_fence(line, line_len, &c, &end);
+    if (fence_len == 0) {
+      if (run > 0) {
+        fence_char = c;
+        fence_len = run;
+      }
+    } else if (run >= fence_len && c == fence_char &&
+               is_blank(line + end, line_len - end)) {
+      fence_len = 0;
+    }
+    prev_blank = is_blank(line, line_len);
+
+    // lines end at LF, CR LF or a lone CR
+    line_number++;
+    for (cr = line; (cr = (const unsigned char *)memchr(
+                         cr, '\r', line + line_len - cr)) != NULL;
+         cr++) {
+      if (cr + 1 < line + line_len && cr[1] != '\n')
+        line_number++;
+    }
+    pos += line_len;
+  }
+
+  for (i = 0; i < found; i++) {
+    segments[i].len = (bufsize_t)((i + 1 < found ? segments[i + 1].data
+                                                 : data + len) -
+                                  segments[i].data);
+  }
+  return found;
+}
+
+// Feed 'len' bytes at 'data', which end at a split or at the end of the
+// input, to the parser of a segment.
+static void S_feed_segment(cmark_parser *parser, const unsigned char *data,
+                           bufsize_t len) {
+  S_parser_feed(parser, data, len, true);
+  if (parser->linebuf.size) {
+    S_process_line(parser, parser->linebuf.ptr, parser->linebuf.size);
+    cmark_strbuf_clear(&parser->linebuf);
+  }
+}
+
+// Parse the blocks of a segment with a parser of its own, leaving them
+// open so that the parser can go on into the next segment.
+static void *parse_segment(void *data) {
+  block_segment *seg = (block_segment *)data;
+  cmark_parser *parser = seg->parser;
+
+  parser->line_number = seg->line_number;
+  cmark_strbuf_set(&parser->source, seg->data, seg->len);
+  S_feed_segment(parser, parser->source.ptr, parser->source.size);
+  seg->closed_by_next = cmark_parser_open_blocks_close_at_split(parser);
+  return NULL;
+}
+
+// Split the input into segments, parse their blocks on separate threads
+// and stitch the documents together, leaving 'parser' as if it had been
+// fed the whole input.  Returns false, leaving the parser alone, if the
+// input can't be split.
+static bool parse_blocks_parallel(cmark_parser *parser,
+                                  const unsigned char *data, bufsize_t len) {
+  cmark_mem *mem = parser->mem;
+  block_segment *segments, *seg;
+  int nsegments = MIN(parser->threads, len / PARALLEL_BLOCKS_MIN_SEGMENT);
+  int i, next;
+
+  if (nsegments < 2)
+    return false;
+  segments = (block_segment *)mem->calloc(nsegments, sizeof(*segments));
+  nsegments = find_segments(data, len, segments, nsegments);
+  if (nsegments < 2) {
+    mem->free(segments);
+    return false;
+  }
+
+  for (i = 0; i < nsegments; i++) {
+    segments[i].parser = cmark_parser_new_with_mem(parser->options, mem);
+  }
+  // the calling thread takes the first segment and those that could not
+  // be given a thread
+  for (i = 1; i < nsegments; i++) {
+    segments[i].started =
+        parser->thread_functions->create(&segments[i].thread, parse_segment,
+                                         &segments[i]) == 0;
+  }
+  parse_segment(&segments[0]);
+  for (i = 1; i < nsegments; i++) {
+    if (segments[i].started)
+      parser->thread_functions->join(segments[i].thread);
+    else
+      parse_segment(&segments[i]);
+  }
+
+  parser->segments = 0;
+  for (i = 0; i < nsegments; i = next) {
+    seg = &segments[i];
+    // A split that the blocks open before it don't close at is no split
+    // after all: the parser of the segment before it goes on through the
+    // next segment (whose own parse is dropped) up to the next split.
+    for (next = i + 1; next < nsegments && !seg->closed_by_next; next++) {
+      S_feed_segment(seg->parser, segments[next].data, segments[next].len);
+      seg->closed_by_next = cmark_parser_open_blocks_close_at_split(seg->parser);
+      cmark_node_free(segments[next].parser->root);
+      cmark_parser_free(segments[next].parser);
+    }
+    while (seg->parser->current != seg->parser->root) {
+      seg->parser->current = finalize(seg->parser, seg->parser->current);
+    }
+    cmark_strbuf_free(&seg->parser->content);
+
+    cmark_reference_map_merge(parser->refmap, seg->parser->refmap);
+    cmark_document_merge(parser->root, parser->root->last_child,
+                         seg->parser->root);
+    if (seg->parser->source.size > 0) {
+      cmark_document_adopt_buffer(parser->root,
+                                  cmark_strbuf_detach(&seg->parser->source));
+    }
+    if (seg->parser->total_size > SIZE_MAX - parser->total_size)
+      parser->total_size = SIZE_MAX;
+    else
+      parser->total_size += seg->parser->total_size;
+    parser->line_number = seg->parser->line_number;
+    parser->last_line_length = seg->parser->last_line_length;
+    cmark_parser_free(seg->parser);
+    parser->segments++;
+  }
+  mem->free(segments);
+  return true;
+}
+
+#endif
+
+cmark_node *cmark_parser_parse_document(cmark_parser *parser,
+                                        const char *buffer, size_t len) {
+  // With a private copy of the whole input, paragraphs and headings can
+  // refer to spans of it until their inlines are parsed instead of
+  // collecting their lines.  (The copy is needed because the scanners
+  // temporarily terminate the text they scan in place.)
+  if (len <= (size_t)(BUFSIZE_MAX / 2)) {
+#ifdef HAVE_PTHREAD_H
+    // Large inputs can be split into runs of blocks parsed side by side.
+    if (parser->threads > 1 && len >= PARALLEL_BLOCKS_MIN_SIZE &&
+        parse_blocks_parallel(parser, (const unsigned char *)buffer,
+                              (bufsize_t)len))
+      return cmark_parser_finish(parser);
+#endif
+    cmark_strbuf_set(&parser->source, (const unsigned char *)buffer,
+                     (bufsize_t)len);
+    S_parser_feed(parser, parser->source.ptr, parser->source.size, true);
+  } else {
+    S_parser_feed(parser, (const unsigned char *)buffer, len, true);
+  }
+
+  return cmark_parser_finish(parser);
+}
+
+cmark_reference_map *cmark_reference_map_parse(const char *buffer, size_t len,
+                                               int options) {
+  // the definitions are taken from the parser, not from the tree
+  cmark_parser *parser = cmark_parser_new(options & ~CMARK_OPT_LAZY_INLINES);
+  cmark_reference_map *map;
+
   S_parser_feed(parser, (const unsigned char *)buffer, len, true);
+  cmark_node_free(cmark_parser_finish(parser));
 
-  document = cmark_parser_finish(parser);
+  // keep the definitions, drop everything else
+  map = parser->refmap;
+  parser->refmap = NULL;
   cmark_parser_free(parser);
-  return document;
+
+  map->ref_size = 0;
+  map->max_ref_size = 0;
+  return map;
+}
+
+void cmark_parser_set_threads(cmark_parser *parser, int threads) {
+  parser->threads = threads > 1 ? threads : 1;
+}
+
+void cmark_parser_set_thread_functions(
+    cmark_parser *parser, const cmark_thread_functions *functions) {
+#ifdef HAVE_PTHREAD_H
+  parser->thread_functions = functions ? functions : &S_pthread_functions;
+#else
+  parser->thread_functions = functions;
+#endif
+}
+
+void cmark_parser_set_reference_dictionary(cmark_parser *parser,
+                                           const cmark_reference_map *dictionary) {
+  parser->refmap->fallback = dictionary;
 }
 
 void cmark_parser_feed(cmark_parser *parser, const char *buffer, size_t len) {
@@ -572,9 +1176,11 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
                           size_t len, bool eof) {
   const unsigned char *end = buffer + len;
   static const uint8_t repl[] = {239, 191, 189};
+  bool in_source = len > 0 && buffer >= parser->source.ptr &&
+                   end <= parser->source.ptr + parser->source.size;
 
-  if (len > UINT_MAX - parser->total_size)
-    parser->total_size = UINT_MAX;
+  if (len > SIZE_MAX - parser->total_size)
+    parser->total_size = SIZE_MAX;
   else
     parser->total_size += len;
 
@@ -613,6 +1219,9 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
         S_process_line(parser, parser->linebuf.ptr, parser->linebuf.size);
         cmark_strbuf_clear(&parser->linebuf);
       } else {
+        // lines ending in a plain LF are kept verbatim in curline
+        if (in_source && eol < end && *eol == '\n')
+          parser->curline_source = buffer;
         S_process_line(parser, buffer, chunk_len);
       }
     } else {
@@ -668,12 +1277,12 @@ static void chop_trailing_hashtags(cmark_chunk *ch) {
 // "...three or more hyphens, asterisks,
 // or underscores on a line by themselves. If you wish, you may use
 // spaces between the hyphens or asterisks."
-static int S_scan_thematic_break(cmark_parser *parser, cmark_chunk *input,
-                                 bufsize_t offset) {
+static bufsize_t S_scan_thematic_break(cmark_parser *parser,
+                                       cmark_chunk *input, bufsize_t offset) {
   bufsize_t i;
   char c;
   char nextc = '\0';
-  int count;
+  bufsize_t count;
   i = offset;
   c = peek_at(input, i);
   if (!(c == '*' || c == '_' || c == '-')) {
@@ -952,8 +1561,8 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
   int lev = 0;
   bool save_partially_consumed_tab;
   bool has_content;
-  int save_offset;
-  int save_column;
+  bufsize_t save_offset;
+  bufsize_t save_column;
 
   while (cont_type != CMARK_NODE_CODE_BLOCK &&
          cont_type != CMARK_NODE_HTML_BLOCK) {
@@ -1178,7 +1787,7 @@ static void add_text_to_container(cmark_parser *parser, cmark_node *container,
     } else if (S_type(container) == CMARK_NODE_HTML_BLOCK) {
       add_line(input, parser);
 
-      int matches_end_condition;
+      bufsize_t matches_end_condition;
       switch (container->as.html_block_type) {
       case 1:
         // </script>, </style>, </textarea>, </pre>
@@ -1211,7 +1820,10 @@ static void add_text_to_container(cmark_parser *parser, cmark_node *container,
       }
 
       if (matches_end_condition) {
+        // the line that ends the block is its last
+        cmark_node *html = container;
         container = finalize(parser, container);
+        S_end_on_current_line(parser, html);
         assert(parser->current != NULL);
       }
     } else if (parser->blank) {
@@ -1245,10 +1857,12 @@ static void S_process_line(cmark_parser *parser, const unsigned char *buffer,
   cmark_node *container;
   cmark_chunk input;
 
-  if (parser->options & CMARK_OPT_VALIDATE_UTF8)
+  if (parser->options & CMARK_OPT_VALIDATE_UTF8) {
     cmark_utf8proc_check(&parser->curline, buffer, bytes);
-  else
+    parser->curline_source = NULL;
+  } else {
     cmark_strbuf_put(&parser->curline, buffer, bytes);
+  }
 
   bytes = parser->curline.size;
 
@@ -1291,6 +1905,7 @@ finished:
     parser->last_line_length -= 1;
 
   cmark_strbuf_clear(&parser->curline);
+  parser->curline_source = NULL;
 }
 
 cmark_node *cmark_parser_finish(cmark_parser *parser) {
@@ -1301,8 +1916,6 @@ cmark_node *cmark_parser_finish(cmark_parser *parser) {
 
   finalize_document(parser);
 
-  cmark_consolidate_text_nodes(parser->root);
-
   cmark_strbuf_free(&parser->curline);
 
 #if CMARK_DEBUG_NODES
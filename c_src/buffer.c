@@ -41,10 +41,10 @@ void cmark_strbuf_grow(cmark_strbuf *buf, bufsize_t target_size) {
   if (target_size < buf->asize)
     return;
 
-  if (target_size > (bufsize_t)(INT32_MAX / 2)) {
+  if (target_size > BUFSIZE_MAX / 2) {
     fprintf(stderr,
-      "[cmark] cmark_strbuf_grow requests buffer with size > %d, aborting\n",
-         (INT32_MAX / 2));
+      "[cmark] cmark_strbuf_grow requests buffer with size > %lld, aborting\n",
+         (long long)(BUFSIZE_MAX / 2));
     abort();
   }
 
@@ -214,6 +214,18 @@ void cmark_strbuf_drop(cmark_strbuf *buf, bufsize_t n) {
   }
 }
 
+int cmark_strbuf_drain(cmark_strbuf *buf, bufsize_t n, cmark_sink *sink) {
+  if (n > buf->size)
+    n = buf->size;
+  if (n <= 0)
+    return 1;
+
+  if (!sink->write(sink->opaque, (const char *)buf->ptr, (size_t)n))
+    return 0;
+  cmark_strbuf_drop(buf, n);
+  return 1;
+}
+
 void cmark_strbuf_rtrim(cmark_strbuf *buf) {
   if (!buf->size)
     return;
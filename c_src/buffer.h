@@ -13,7 +13,16 @@
 extern "C" {
 #endif
 
+// Sizes of and offsets into buffers, and so into the input.  They are 32
+// bits unless CMARK_LARGE_BUFFERS is defined, which lifts the limit of
+// about 1 GB on documents at the cost of larger nodes.
+#ifdef CMARK_LARGE_BUFFERS
+typedef int64_t bufsize_t;
+#define BUFSIZE_MAX INT64_MAX
+#else
 typedef int32_t bufsize_t;
+#define BUFSIZE_MAX INT32_MAX
+#endif
 
 typedef struct {
   cmark_mem *mem;
@@ -72,6 +81,9 @@ bufsize_t cmark_strbuf_strchr(const cmark_strbuf *buf, int c, bufsize_t pos);
 bufsize_t cmark_strbuf_strrchr(const cmark_strbuf *buf, int c, bufsize_t pos);
 void cmark_strbuf_drop(cmark_strbuf *buf, bufsize_t n);
 void cmark_strbuf_truncate(cmark_strbuf *buf, bufsize_t len);
+// Pass the first 'n' bytes of 'buf' on to 'sink' and drop them.  Returns
+// 0 if the sink failed.
+int cmark_strbuf_drain(cmark_strbuf *buf, bufsize_t n, cmark_sink *sink);
 void cmark_strbuf_rtrim(cmark_strbuf *buf);
 void cmark_strbuf_trim(cmark_strbuf *buf);
 void cmark_strbuf_normalize_whitespace(cmark_strbuf *s);
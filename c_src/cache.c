@@ -0,0 +1,530 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "cmark.h"
+#include "node.h"
+#include "parser.h"
+#include "references.h"
+#include "url_map.h"
+#include "buffer.h"
+
+// The cache is shared by concurrent renders, so it always has a lock:
+// a critical section on Windows, where config.h leaves out pthreads.
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef CRITICAL_SECTION cache_lock;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t cache_lock;
+#endif
+
+// Entries per bucket at which the table grows.
+#define CACHE_MAX_LOAD 1
+
+typedef struct cache_entry {
+  // chain of the bucket
+  struct cache_entry *chain;
+  // recency list, most recently used first
+  struct cache_entry *prev;
+  struct cache_entry *next;
+  uint64_t hash;
+  uint64_t refs_hash;
+  int options;
+  int start_line;
+  // reference expansion the block used
+  unsigned int ref_size;
+  size_t source_len;
+  size_t html_len;
+  // the source of the block, followed by its HTML
+  unsigned char data[1];
+} cache_entry;
+
+struct cmark_block_cache {
+  cmark_mem *mem;
+  cache_entry **buckets;
+  size_t nbuckets;
+  size_t count;
+  cache_entry *head;
+  cache_entry *tail;
+  size_t size;
+  size_t max_size;
+  size_t hits;
+  size_t misses;
+  cache_lock lock;
+};
+
+static void S_lock_init(cmark_block_cache *cache) {
+#ifdef _WIN32
+  InitializeCriticalSection(&cache->lock);
+#else
+  pthread_mutex_init(&cache->lock, NULL);
+#endif
+}
+
+static void S_lock_destroy(cmark_block_cache *cache) {
+#ifdef _WIN32
+  DeleteCriticalSection(&cache->lock);
+#else
+  pthread_mutex_destroy(&cache->lock);
+#endif
+}
+
+static void S_lock(cmark_block_cache *cache) {
+#ifdef _WIN32
+  EnterCriticalSection(&cache->lock);
+#else
+  pthread_mutex_lock(&cache->lock);
+#endif
+}
+
+static void S_unlock(cmark_block_cache *cache) {
+#ifdef _WIN32
+  LeaveCriticalSection(&cache->lock);
+#else
+  pthread_mutex_unlock(&cache->lock);
+#endif
+}
+
+// 64-bit FNV-1a, continuing from 'hash'.
+static uint64_t S_hash(uint64_t hash, const unsigned char *data, size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+#define S_HASH_INIT 14695981039346656037ULL
+
+static uint64_t S_hash_cstr(uint64_t hash, const unsigned char *s) {
+  // distinguish NULL from empty strings, and keep strings apart
+  static const unsigned char sep[2] = {0, 1};
+
+  if (s == NULL) {
+    return S_hash(hash, sep + 1, 1);
+  }
+  return S_hash(S_hash(hash, s, strlen((const char *)s)), sep, 1);
+}
+
+// Hash of the definitions in 'map' and in its fallback, which doesn't
+// depend on their order in the tables; also finds the size of the largest
+// definition.
+static uint64_t S_hash_references(const cmark_reference_map *map,
+                                  unsigned int *max_size) {
+  uint64_t total = 0, sum, hash;
+  unsigned int i;
+  cmark_reference *ref;
+
+  *max_size = 0;
+  for (; map != NULL; map = map->fallback) {
+    sum = 0;
+    for (i = 0; i < map->capacity; i++) {
+      ref = map->table[i];
+      if (ref == NULL) {
+        continue;
+      }
+      hash = S_hash_cstr(S_HASH_INIT, ref->label);
+      hash = S_hash_cstr(hash, ref->url);
+      sum += S_hash_cstr(hash, ref->title);
+      if (ref->size > *max_size) {
+        *max_size = ref->size;
+      }
+    }
+    total = (total + sum) * 1099511628211ULL + 1;
+  }
+  return total;
+}
+
+static void S_unlink(cmark_block_cache *cache, cache_entry *entry) {
+  if (entry->prev) {
+    entry->prev->next = entry->next;
+  } else {
+    cache->head = entry->next;
+  }
+  if (entry->next) {
+    entry->next->prev = entry->prev;
+  } else {
+    cache->tail = entry->prev;
+  }
+}
+
+static void S_push_front(cmark_block_cache *cache, cache_entry *entry) {
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if (cache->head) {
+    cache->head->prev = entry;
+  } else {
+    cache->tail = entry;
+  }
+  cache->head = entry;
+}
+
+static size_t S_entry_size(cache_entry *entry) {
+  return sizeof(cache_entry) + entry->source_len + entry->html_len;
+}
+
+static void S_remove(cmark_block_cache *cache, cache_entry *entry) {
+  cache_entry **slot = &cache->buckets[entry->hash & (cache->nbuckets - 1)];
+
+  while (*slot != entry) {
+    slot = &(*slot)->chain;
+  }
+  *slot = entry->chain;
+  S_unlink(cache, entry);
+  cache->count--;
+  cache->size -= S_entry_size(entry);
+  cache->mem->free(entry);
+}
+
+static void S_grow(cmark_block_cache *cache) {
+  size_t nbuckets = cache->nbuckets * 2, i;
+  cache_entry **buckets, *entry, *next;
+
+  buckets = (cache_entry **)cache->mem->calloc(nbuckets, sizeof(*buckets));
+  for (i = 0; i < cache->nbuckets; i++) {
+    for (entry = cache->buckets[i]; entry != NULL; entry = next) {
+      next = entry->chain;
+      entry->chain = buckets[entry->hash & (nbuckets - 1)];
+      buckets[entry->hash & (nbuckets - 1)] = entry;
+    }
+  }
+  cache->mem->free(cache->buckets);
+  cache->buckets = buckets;
+  cache->nbuckets = nbuckets;
+}
+
+static cache_entry *S_find(cmark_block_cache *cache, uint64_t hash,
+                           uint64_t refs_hash, int options, int start_line,
+                           const unsigned char *source, size_t source_len) {
+  cache_entry *entry = cache->buckets[hash & (cache->nbuckets - 1)];
+
+  for (; entry != NULL; entry = entry->chain) {
+    if (entry->hash == hash && entry->refs_hash == refs_hash &&
+        entry->options == options && entry->start_line == start_line &&
+        entry->source_len == source_len &&
+        memcmp(entry->data, source, source_len) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static void S_insert(cmark_block_cache *cache, uint64_t hash,
+                     uint64_t refs_hash, int options, int start_line,
+                     unsigned int ref_size, const unsigned char *source,
+                     size_t source_len, const char *html, size_t html_len) {
+  cache_entry *entry;
+  size_t size = sizeof(cache_entry) + source_len + html_len;
+  size_t bucket;
+
+  if (size > cache->max_size ||
+      S_find(cache, hash, refs_hash, options, start_line, source,
+             source_len) != NULL) {
+    return;
+  }
+  while (cache->size + size > cache->max_size) {
+    S_remove(cache, cache->tail);
+  }
+  if (cache->count >= cache->nbuckets * CACHE_MAX_LOAD) {
+    S_grow(cache);
+  }
+
+  entry = (cache_entry *)cache->mem->calloc(1, size);
+  entry->hash = hash;
+  entry->refs_hash = refs_hash;
+  entry->options = options;
+  entry->start_line = start_line;
+  entry->ref_size = ref_size;
+  entry->source_len = source_len;
+  entry->html_len = html_len;
+  memcpy(entry->data, source, source_len);
+  memcpy(entry->data + source_len, html, html_len);
+
+  bucket = hash & (cache->nbuckets - 1);
+  entry->chain = cache->buckets[bucket];
+  cache->buckets[bucket] = entry;
+  S_push_front(cache, entry);
+  cache->count++;
+  cache->size += size;
+}
+
+cmark_block_cache *cmark_block_cache_new(size_t max_size) {
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  cmark_block_cache *cache =
+      (cmark_block_cache *)mem->calloc(1, sizeof(cmark_block_cache));
+
+  cache->mem = mem;
+  cache->max_size = max_size;
+  cache->nbuckets = 64;
+  cache->buckets =
+      (cache_entry **)mem->calloc(cache->nbuckets, sizeof(cache_entry *));
+  S_lock_init(cache);
+  return cache;
+}
+
+void cmark_block_cache_free(cmark_block_cache *cache) {
+  cache_entry *entry, *next;
+
+  if (cache == NULL) {
+    return;
+  }
+  for (entry = cache->head; entry != NULL; entry = next) {
+    next = entry->next;
+    cache->mem->free(entry);
+  }
+  S_lock_destroy(cache);
+  cache->mem->free(cache->buckets);
+  cache->mem->free(cache);
+}
+
+void cmark_block_cache_get_stats(cmark_block_cache *cache, size_t *hits,
+                                 size_t *misses, size_t *entries,
+                                 size_t *size) {
+  S_lock(cache);
+  *hits = cache->hits;
+  *misses = cache->misses;
+  *entries = cache->count;
+  *size = cache->size;
+  S_unlock(cache);
+}
+
+// Advance '*pos', at the start of line '*line' of 'data', to the start of
+// line 'target' (or the end of the data).  Lines end as in the parser.
+static void S_skip_lines(const unsigned char *data, size_t len, size_t *pos,
+                         int *line, int target) {
+  size_t i = *pos;
+
+  while (*line < target && i < len) {
+    if (data[i] == '\n' ||
+        (data[i] == '\r' && (i + 1 == len || data[i + 1] != '\n'))) {
+      (*line)++;
+    }
+    i++;
+  }
+  *pos = i;
+}
+
+char *cmark_block_cache_render_html(cmark_block_cache *cache,
+                                    cmark_parser *parser, const char *buffer,
+                                    size_t len) {
+  return cmark_block_cache_render_html_with_url_map(cache, parser, buffer, len,
+                                                    NULL);
+}
+
+char *cmark_block_cache_render_html_with_url_map(cmark_block_cache *cache,
+                                                 cmark_parser *parser,
+                                                 const char *buffer,
+                                                 size_t len,
+                                                 const cmark_url_map *urls) {
+  const unsigned char *data = (const unsigned char *)buffer;
+  cmark_strbuf html = CMARK_BUF_INIT(parser->mem);
+  cmark_reference_map *refmap;
+  cmark_node *root, *block;
+  cache_entry *entry;
+  char *rendered;
+  uint64_t refs_hash, hash;
+  unsigned int max_ref, ref_size;
+  size_t pos = 0, start, html_start;
+  // lazy inlines give the same HTML, so they share entries
+  int line = 1, start_line,
+      options = parser->options & ~CMARK_OPT_LAZY_INLINES;
+  bool found;
+
+  // Heading ids depend on the headings before a block, not on its lines
+  // alone, so such documents are rendered whole.
+  if (options & CMARK_OPT_HEADING_IDS) {
+    root = cmark_parser_parse_document(parser, buffer, len);
+    rendered = cmark_render_html_with_url_map(root, options, urls);
+    cmark_node_free(root);
+    return rendered;
+  }
+
+  parser->defer_inlines = true;
+  root = cmark_parser_parse_document(parser, buffer, len);
+  refmap = parser->refmap;
+  refs_hash = S_hash_references(refmap, &max_ref);
+  if (urls != NULL) {
+    // an empty map, whose hash is 0, rewrites nothing
+    refs_hash ^= urls->hash;
+  }
+
+  for (block = root->first_child; block != NULL; block = block->next) {
+    // Positions only show in the HTML with CMARK_OPT_SOURCEPOS.
+    start_line = options & CMARK_OPT_SOURCEPOS ? block->start_line : 0;
+
+    // A top-level block is parsed from its own lines alone, so its HTML
+    // follows from them and the definitions they may refer to.  Blocks
+    // whose lines can't be told apart from the previous one's are not
+    // cached.
+    found = false;
+    entry = NULL;
+    hash = 0;
+    if (block->start_line >= line) {
+      S_skip_lines(data, len, &pos, &line, block->start_line);
+      start = pos;
+      S_skip_lines(data, len, &pos, &line, block->end_line + 1);
+      hash = S_hash(S_HASH_INIT, data + start, pos - start);
+
+      S_lock(cache);
+      entry = S_find(cache, hash, refs_hash, options, start_line,
+                     data + start, pos - start);
+      // A cached block expanded references without running out of the
+      // document's allowance; it mustn't run out here either.
+      if (entry != NULL &&
+          refmap->ref_size + entry->ref_size <= refmap->max_ref_size) {
+        cmark_strbuf_put(&html, entry->data + entry->source_len,
+                         (bufsize_t)entry->html_len);
+        refmap->ref_size += entry->ref_size;
+        S_unlink(cache, entry);
+        S_push_front(cache, entry);
+        cache->hits++;
+        found = true;
+      } else {
+        cache->misses++;
+      }
+      S_unlock(cache);
+    } else {
+      start = pos;
+    }
+    if (found) {
+      continue;
+    }
+
+    ref_size = refmap->ref_size;
+    cmark_parser_parse_block_inlines(parser, block);
+    ref_size = refmap->ref_size - ref_size;
+    html_start = (size_t)html.size;
+    rendered = cmark_render_html_with_url_map(block, options, urls);
+    cmark_strbuf_puts(&html, rendered);
+    parser->mem->free(rendered);
+
+    // Only HTML that no limit on reference expansion cut short is valid
+    // for other documents.
+    if (pos > start &&
+        (uint64_t)refmap->ref_size + max_ref <= refmap->max_ref_size) {
+      S_lock(cache);
+      S_insert(cache, hash, refs_hash, options, start_line, ref_size,
+               data + start, pos - start, (const char *)html.ptr + html_start,
+               (size_t)html.size - html_start);
+      S_unlock(cache);
+    }
+  }
+
+  cmark_node_free(root);
+  return (char *)cmark_strbuf_detach(&html);
+}
+
+// Hash the definitions in 'refmap' that a bracketed label in data[start,
+// end) names, continuing from 'hash'.  Every label, whether of a shortcut,
+// collapsed or full reference, runs from a '[' to the next unescaped ']'
+// with no unescaped '[' in between.
+static uint64_t S_hash_labels(uint64_t hash, cmark_reference_map *refmap,
+                              const unsigned char *data, size_t start,
+                              size_t end) {
+  unsigned int ref_size = refmap->ref_size;
+  cmark_reference *ref;
+  cmark_chunk label;
+  size_t i, j;
+
+  for (i = start; i < end; i++) {
+    if (data[i] != '[') {
+      continue;
+    }
+    for (j = i + 1; j < end && j - i <= MAX_LINK_LABEL_LENGTH; j++) {
+      if (data[j] == '\\' && j + 1 < end) {
+        j++;
+      } else if (data[j] == '[' || data[j] == ']') {
+        break;
+      }
+    }
+    if (j == end || data[j] != ']') {
+      continue;
+    }
+    label.data = (unsigned char *)data + i + 1;
+    label.len = (bufsize_t)(j - i - 1);
+    ref = cmark_reference_lookup(refmap, &label);
+    // looking a label up is not using it
+    refmap->ref_size = ref_size;
+    if (ref != NULL) {
+      hash = S_hash_cstr(hash, ref->label);
+      hash = S_hash_cstr(hash, ref->url);
+      hash = S_hash_cstr(hash, ref->title);
+    }
+  }
+  return hash;
+}
+
+// Whether 'block' is or holds a heading, looking at blocks only so as not
+// to parse pending inlines.
+static bool S_contains_heading(cmark_node *block) {
+  cmark_node *cur = block;
+
+  while (cur != NULL) {
+    if (cur->type == CMARK_NODE_HEADING) {
+      return true;
+    }
+    if (cur->first_child && cur->type != CMARK_NODE_PARAGRAPH) {
+      cur = cur->first_child;
+      continue;
+    }
+    while (cur != block && cur->next == NULL) {
+      cur = cur->parent;
+    }
+    cur = cur == block ? NULL : cur->next;
+  }
+  return false;
+}
+
+void cmark_parser_block_keys(cmark_parser *parser, cmark_node *root,
+                             const char *buffer, size_t len,
+                             unsigned long long *keys) {
+  const unsigned char *data = (const unsigned char *)buffer;
+  int options = parser->options & ~CMARK_OPT_LAZY_INLINES, line = 1,
+      last_line = 1;
+  size_t pos = 0, last_pos = 0, start;
+  uint64_t hash, headings = S_HASH_INIT;
+  cmark_reference_map *refmap = parser->refmap;
+  cmark_node *block;
+
+  // with lazy inlines, the document has taken the definitions over
+  if (refmap == NULL && root->type == CMARK_NODE_DOCUMENT &&
+      root->as.document != NULL) {
+    refmap = root->as.document->refmap;
+  }
+
+  for (block = root->first_child; block != NULL; block = block->next) {
+    // A block may start on the line the previous one ends on.
+    if (block->start_line < line) {
+      pos = last_pos;
+      line = last_line;
+    }
+    S_skip_lines(data, len, &pos, &line, block->start_line);
+    start = pos;
+    S_skip_lines(data, len, &pos, &line, block->end_line);
+    last_pos = pos;
+    last_line = line;
+    S_skip_lines(data, len, &pos, &line, block->end_line + 1);
+
+    hash = S_hash(S_HASH_INIT, data + start, pos - start);
+    hash = S_hash(hash, (const unsigned char *)&options, sizeof(options));
+    if (options & CMARK_OPT_SOURCEPOS) {
+      hash = S_hash(hash, (const unsigned char *)&block->start_line,
+                    sizeof(block->start_line));
+    }
+    if (refmap != NULL) {
+      hash = S_hash_labels(hash, refmap, data, start, pos);
+    }
+
+    // Heading ids are made unique across the document.
+    if ((options & CMARK_OPT_HEADING_IDS) && S_contains_heading(block)) {
+      hash = S_hash(hash, (const unsigned char *)&headings, sizeof(headings));
+      headings = S_hash(headings, data + start, pos - start);
+    }
+    *keys++ = (unsigned long long)hash;
+  }
+}
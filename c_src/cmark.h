@@ -86,6 +86,11 @@ typedef enum {
 typedef struct cmark_node cmark_node;
 typedef struct cmark_parser cmark_parser;
 typedef struct cmark_iter cmark_iter;
+typedef struct cmark_reference_map cmark_reference_map;
+typedef struct cmark_compact cmark_compact;
+typedef struct cmark_live_document cmark_live_document;
+typedef struct cmark_block_cache cmark_block_cache;
+typedef struct cmark_url_map cmark_url_map;
 
 /**
  * ## Custom memory allocator support
@@ -270,10 +275,21 @@ const char *cmark_node_get_type_string(cmark_node *node);
 
 /** Returns the string contents of 'node', or an empty
     string if none is set.  Returns NULL if called on a
-    node that does not have string content.
+    node that does not have string content.  The text of a
+    node parsed from a document may point into the document
+    and isn't NUL-terminated then: use
+    cmark_node_get_literal_chunk for its length.  Setting the
+    literal or unlinking the node gives it a NUL-terminated
+    copy.
  */
 CMARK_EXPORT const char *cmark_node_get_literal(cmark_node *node);
 
+/** Returns the string contents of 'node' as cmark_node_get_literal does,
+ * with their length in bytes in '*len'.
+ */
+CMARK_EXPORT const char *cmark_node_get_literal_chunk(cmark_node *node,
+                                                      size_t *len);
+
 /** Sets the string contents of 'node'.  Returns 1 on success,
  * 0 on failure.
  */
@@ -486,6 +502,67 @@ void cmark_parser_feed(cmark_parser *parser, const char *buffer, size_t len);
 CMARK_EXPORT
 cmark_node *cmark_parser_finish(cmark_parser *parser);
 
+/** Parse the complete document in 'buffer' of length 'len' with
+ * 'parser' and return a pointer to a tree of nodes, like
+ * 'cmark_parser_feed' followed by 'cmark_parser_finish'.  Nothing may
+ * have been fed to the parser before.  Since the whole input is known
+ * up front, block content does not need to be collected line by line.
+ */
+CMARK_EXPORT
+cmark_node *cmark_parser_parse_document(cmark_parser *parser,
+                                        const char *buffer, size_t len);
+
+/** Parse the beginning of the document in 'buffer' of length 'len' with
+ * 'parser', like 'cmark_parser_parse_document', for an excerpt of at most
+ * 'max_blocks' top-level blocks and 'max_chars' characters of text (no
+ * limit if 0; see 'cmark_render_html_excerpt').  Lines are fed until the
+ * blocks closed so far make up the excerpt and no link reference
+ * definition can follow; the last block of the tree may then be cut
+ * short.  Inlines are parsed as with CMARK_OPT_LAZY_INLINES.  Rendered
+ * with 'cmark_render_html_excerpt' and the same limits, the tree gives
+ * the same excerpt as the whole document would.
+ */
+CMARK_EXPORT
+cmark_node *cmark_parser_parse_excerpt(cmark_parser *parser,
+                                       const char *buffer, size_t len,
+                                       int max_blocks, int max_chars);
+
+/** Let 'parser' use up to 'threads' threads (including the calling
+ * one) for parsing.  Once the block structure is known, the inline
+ * content of paragraphs and headings is parsed on a pool of threads if
+ * the document is large enough to be worth it.  With
+ * 'cmark_parser_parse_document', a multi-megabyte input is also split
+ * at blank lines between top-level blocks into segments whose block
+ * structure is parsed side by side; where a split turns out to fall
+ * inside a block, the segments around it are parsed as one.  The
+ * resulting tree is the same as with a single thread, which is the
+ * default.  The memory allocator of the parser must be thread-safe when
+ * 'threads' is greater than 1, as the default allocator is.
+ */
+CMARK_EXPORT
+void cmark_parser_set_threads(cmark_parser *parser, int threads);
+
+/** Functions a parser starts and waits for its threads with.  'create'
+ * runs 'start' with 'arg' on a new thread, stores a handle to it in
+ * '*thread' and returns 0, or returns nonzero if it can't.  'join' waits
+ * for the thread with handle 'thread' to finish.
+ */
+typedef struct cmark_thread_functions {
+  int (*create)(void **thread, void *(*start)(void *), void *arg);
+  void (*join)(void *thread);
+} cmark_thread_functions;
+
+/** Have 'parser' start the threads it may use (see
+ * 'cmark_parser_set_threads') with 'functions', which must outlive it,
+ * instead of with 'pthread_create', or again with that if 'functions'
+ * is NULL.  Hosts that manage their own threads, such as a language
+ * runtime, can pass theirs.  Builds without POSIX threads parse on the
+ * calling thread alone either way.
+ */
+CMARK_EXPORT
+void cmark_parser_set_thread_functions(
+    cmark_parser *parser, const cmark_thread_functions *functions);
+
 /** Parse a CommonMark document in 'buffer' of length 'len'.
  * Returns a pointer to a tree of nodes.  The memory allocated for
  * the node tree should be released using 'cmark_node_free'
@@ -501,10 +578,252 @@ cmark_node *cmark_parse_document(const char *buffer, size_t len, int options);
 CMARK_EXPORT
 cmark_node *cmark_parse_file(FILE *f, int options);
 
+/**
+ * ## Reference Dictionaries
+ *
+ * A reference dictionary holds link reference definitions that are
+ * parsed once and shared by any number of documents.  A parser consults
+ * its dictionary only for labels the document does not define itself.
+ * Dictionaries are never modified after they are created, so one
+ * dictionary may be used by several parsers at the same time, also from
+ * different threads.
+ *
+ *     cmark_reference_map *glossary =
+ *         cmark_reference_map_parse(defs, defs_len, CMARK_OPT_DEFAULT);
+ *     cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+ *     cmark_parser_set_reference_dictionary(parser, glossary);
+ *     cmark_parser_feed(parser, page, page_len);
+ *     document = cmark_parser_finish(parser);
+ *     cmark_parser_free(parser);
+ *     ...
+ *     cmark_reference_map_free(glossary);
+ */
+
+/** Parse the link reference definitions in 'buffer' of length 'len'
+ * into a new reference dictionary.  All other content of the buffer is
+ * ignored.  The dictionary should be released using
+ * 'cmark_reference_map_free' once no parser refers to it anymore.
+ */
+CMARK_EXPORT
+cmark_reference_map *cmark_reference_map_parse(const char *buffer, size_t len,
+                                               int options);
+
+/** Frees the memory allocated for a reference dictionary.
+ */
+CMARK_EXPORT
+void cmark_reference_map_free(cmark_reference_map *map);
+
+/** Makes 'parser' fall back to 'dictionary' when resolving references
+ * that are not defined in the document.  The dictionary must outlive
+ * the parser.  Passing NULL removes the dictionary.
+ */
+CMARK_EXPORT
+void cmark_parser_set_reference_dictionary(cmark_parser *parser,
+                                           const cmark_reference_map *dictionary);
+
+/**
+ * ## Compact Trees
+ *
+ * A compact tree is a read-only copy of a node tree that numbers its
+ * nodes and keeps them in arrays, taking a fraction of the memory of
+ * the node tree and rendering without chasing pointers.  It suits
+ * documents that are kept around to be rendered repeatedly.
+ */
+
+/** Creates a compact copy of the tree rooted at 'root'.  The node tree
+ * may be freed afterwards.  Returns NULL if the tree is too large.
+ */
+CMARK_EXPORT
+cmark_compact *cmark_compact_new(cmark_node *root);
+
+/** Frees the memory allocated for a compact tree.
+ */
+CMARK_EXPORT
+void cmark_compact_free(cmark_compact *tree);
+
+/**
+ * ## Live Documents
+ *
+ * A live document keeps the source and tree of a document that is being
+ * edited, as in a live preview.  An edit re-parses only the top-level
+ * blocks around the changed text and leaves the others in place, unless
+ * the edit touches a link reference definition or the blocks cannot be
+ * told apart, in which case the whole document is parsed again.  Either
+ * way the tree equals that of parsing the edited source from scratch.
+ * The source is still copied and the lines of the blocks after the edit
+ * renumbered, which takes time in proportion to the document, if much
+ * less than parsing it.
+ */
+
+/** Parses 'buffer' into a live document with the given 'options'.
+ * Returns NULL if the buffer is too large.
+ */
+CMARK_EXPORT
+cmark_live_document *cmark_live_document_new(const char *buffer, size_t len,
+                                             int options);
+
+/** Replaces 'length' bytes of the source at 'offset' with 'text'.  On
+ * return, the top-level blocks from '*index' on have been replaced:
+ * '*removed' of them were dropped and '*added' new ones put in their
+ * place.  Returns 0, leaving the document as it was, if the range lies
+ * outside the source or the result would be too large.
+ */
+CMARK_EXPORT
+int cmark_live_document_edit(cmark_live_document *doc, size_t offset,
+                             size_t length, const char *text, size_t text_len,
+                             size_t *index, size_t *removed, size_t *added);
+
+/** Returns the document node of 'doc', which belongs to 'doc' and may
+ * change with each edit.
+ */
+CMARK_EXPORT
+cmark_node *cmark_live_document_root(cmark_live_document *doc);
+
+/** Returns the current source of 'doc', setting '*len' to its length.
+ */
+CMARK_EXPORT
+const char *cmark_live_document_source(cmark_live_document *doc,
+                                       size_t *len);
+
+/** Frees a live document along with its tree.
+ */
+CMARK_EXPORT
+void cmark_live_document_free(cmark_live_document *doc);
+
+/**
+ * ## Block Caches
+ *
+ * A block cache keeps the HTML of top-level blocks across renders, so
+ * that a document rendered again after a small edit only has the inlines
+ * of the blocks that changed parsed and rendered.  Entries are keyed by
+ * the source lines of a block, the options, and all the link reference
+ * definitions in effect (the block's line number too with
+ * CMARK_OPT_SOURCEPOS).  A cache may be shared by several threads.
+ */
+
+/** Creates a block cache taking up to about 'max_size' bytes, beyond
+ * which the least recently used blocks are dropped.
+ */
+CMARK_EXPORT
+cmark_block_cache *cmark_block_cache_new(size_t max_size);
+
+/** Parses 'buffer' with 'parser', which must not have been fed yet, and
+ * renders it as HTML with the parser's options, taking the HTML of the
+ * blocks found in 'cache' from there and adding that of the others.
+ * The result is that of 'cmark_render_html'.  It is the caller's
+ * responsibility to free the returned buffer and the parser.
+ */
+CMARK_EXPORT
+char *cmark_block_cache_render_html(cmark_block_cache *cache,
+                                    cmark_parser *parser, const char *buffer,
+                                    size_t len);
+
+/** Like 'cmark_block_cache_render_html', rewriting the URLs of links and
+ * images with 'urls' as 'cmark_render_html_with_url_map' does.  Entries
+ * are also keyed by the rewrites in 'urls', which may be NULL.
+ */
+CMARK_EXPORT
+char *cmark_block_cache_render_html_with_url_map(cmark_block_cache *cache,
+                                                 cmark_parser *parser,
+                                                 const char *buffer,
+                                                 size_t len,
+                                                 const cmark_url_map *urls);
+
+/** Reports the number of blocks looked up in 'cache' and found or not
+ * found, and the number and total size of its entries.
+ */
+CMARK_EXPORT
+void cmark_block_cache_get_stats(cmark_block_cache *cache, size_t *hits,
+                                 size_t *misses, size_t *entries,
+                                 size_t *size);
+
+/** Frees a block cache.
+ */
+CMARK_EXPORT
+void cmark_block_cache_free(cmark_block_cache *cache);
+
+/** Sets 'keys[i]' to a key for the i-th top-level block of 'root', which
+ * 'parser' has just parsed from 'buffer', without rendering it: a hash of
+ * the source lines of the block, the options of 'parser' and the link
+ * reference definitions the block may refer to (its line number too with
+ * CMARK_OPT_SOURCEPOS, and the headings before it with
+ * CMARK_OPT_HEADING_IDS).  Blocks with the same key render the same HTML,
+ * unless the limit on reference expansion cuts one short.
+ */
+CMARK_EXPORT
+void cmark_parser_block_keys(cmark_parser *parser, cmark_node *root,
+                             const char *buffer, size_t len,
+                             unsigned long long *keys);
+
+/**
+ * ## URL Maps
+ *
+ * A URL map rewrites the destinations of links and images as a tree is
+ * rendered as HTML, for instance to point relative image paths at a
+ * CDN.  An exact rewrite replaces a whole URL; a prefix rewrite
+ * replaces the beginning of the URLs that start with its prefix.  The
+ * exact rewrite of a URL takes precedence, then that of its longest
+ * prefix.  Once all rewrites are added, a map may be used by several
+ * threads at the same time.
+ *
+ *     cmark_url_map *urls = cmark_url_map_new();
+ *     cmark_url_map_add_prefix(urls, "/img/", 5,
+ *                              "https://cdn.example.com/img/", 28);
+ *     html = cmark_render_html_with_url_map(document, options, urls);
+ *     ...
+ *     cmark_url_map_free(urls);
+ */
+
+/** Creates an empty URL map.
+ */
+CMARK_EXPORT
+cmark_url_map *cmark_url_map_new(void);
+
+/** Makes 'map' replace the URL 'url' of length 'url_len' with
+ * 'replacement' of length 'replacement_len', in place of any earlier
+ * exact rewrite of 'url'.  Returns 0, leaving the map as it was, if
+ * either string contains a NUL byte or is too large.
+ */
+CMARK_EXPORT
+int cmark_url_map_add_exact(cmark_url_map *map, const char *url,
+                            size_t url_len, const char *replacement,
+                            size_t replacement_len);
+
+/** Makes 'map' replace 'prefix' of length 'prefix_len' at the start of
+ * URLs with 'replacement' of length 'replacement_len', in place of any
+ * earlier rewrite of the same prefix.  Returns 0 as
+ * 'cmark_url_map_add_exact' does.
+ */
+CMARK_EXPORT
+int cmark_url_map_add_prefix(cmark_url_map *map, const char *prefix,
+                             size_t prefix_len, const char *replacement,
+                             size_t replacement_len);
+
+/** Frees a URL map.
+ */
+CMARK_EXPORT
+void cmark_url_map_free(cmark_url_map *map);
+
 /**
  * ## Rendering
  */
 
+/** Where the 'cmark_render_*_to_sink' functions send their output, a
+ * piece at a time, instead of building it up whole in memory.
+ */
+typedef struct cmark_sink {
+  /** Called with each piece of output in turn.  'data' is only valid
+   * for the call.  Returns 0 to stop rendering.
+   */
+  int (*write)(void *opaque, const char *data, size_t len);
+  /** Passed to 'write'. */
+  void *opaque;
+  /** The output is passed on whenever this many bytes have built up,
+   * once the node being rendered is done.
+   */
+  size_t flush_size;
+} cmark_sink;
+
 /** Render a 'node' tree as XML.  It is the caller's responsibility
  * to free the returned buffer.
  */
@@ -518,6 +837,66 @@ char *cmark_render_xml(cmark_node *root, int options);
 CMARK_EXPORT
 char *cmark_render_html(cmark_node *root, int options);
 
+/** Render a 'node' tree as HTML like 'cmark_render_html', rewriting the
+ * URLs of links and images with 'urls' (see 'cmark_url_map_new') before
+ * they are checked for safety and escaped.  'urls' may be NULL.
+ */
+CMARK_EXPORT
+char *cmark_render_html_with_url_map(cmark_node *root, int options,
+                                     const cmark_url_map *urls);
+
+/** A heading listed by 'cmark_render_html_toc'.
+ */
+typedef struct {
+  int level;
+  /** The `id` attribute given to the heading. */
+  char *id;
+  /** The text of the heading, without markup. */
+  char *text;
+} cmark_toc_entry;
+
+/** Render a 'node' tree as HTML like 'cmark_render_html' with
+ * CMARK_OPT_HEADING_IDS, setting '*toc' to an array of its '*toc_length'
+ * headings in document order (NULL if there are none), which is to be
+ * freed with 'cmark_toc_free'.  It is the caller's responsibility to free
+ * the returned buffer.
+ */
+CMARK_EXPORT
+char *cmark_render_html_toc(cmark_node *root, int options,
+                            cmark_toc_entry **toc, size_t *toc_length);
+
+/** Frees the 'length' entries of 'toc' and the array itself.
+ */
+CMARK_EXPORT
+void cmark_toc_free(cmark_toc_entry *toc, size_t length);
+
+/** Render the children of 'root' as HTML one after another, like
+ * 'cmark_render_html', setting 'ends[i]' to the offset in the result at
+ * which the HTML of the i-th child ends.  'ends' must have room for an
+ * entry per child.  It is the caller's responsibility to free the
+ * returned buffer.
+ */
+CMARK_EXPORT
+char *cmark_render_html_blocks(cmark_node *root, int options, size_t *ends);
+
+/** Render the first 'max_blocks' children of 'root' as HTML, with at
+ * most 'max_chars' characters of text in all (no limit if 0).  Text,
+ * code and line breaks count towards 'max_chars', one character per code
+ * point.  Text beyond it is cut, at a space if the cut falls inside a
+ * word, and followed by an ellipsis (U+2026); the elements it was in are
+ * closed.  Raw HTML is copied whole.  It is the caller's responsibility
+ * to free the returned buffer.
+ */
+CMARK_EXPORT
+char *cmark_render_html_excerpt(cmark_node *root, int options, int max_blocks,
+                                int max_chars);
+
+/** Render a compact tree as an HTML fragment, like 'cmark_render_html'.
+ * It is the caller's responsibility to free the returned buffer.
+ */
+CMARK_EXPORT
+char *cmark_compact_render_html(cmark_compact *tree, int options);
+
 /** Render a 'node' tree as a groff man page, without the header.
  * It is the caller's responsibility to free the returned buffer.
  */
@@ -536,6 +915,86 @@ char *cmark_render_commonmark(cmark_node *root, int options, int width);
 CMARK_EXPORT
 char *cmark_render_latex(cmark_node *root, int options, int width);
 
+/** Render a 'node' tree as plain text: the text of its paragraphs,
+ * headings and code blocks, with 'separator' between blocks (a blank
+ * line if NULL) and a final newline.  Links and images are reduced to
+ * their text; raw HTML is left out.  It is the caller's responsibility
+ * to free the returned buffer.
+ */
+CMARK_EXPORT
+char *cmark_render_text(cmark_node *root, int options, const char *separator);
+
+/** The following functions render a 'node' tree as the functions above
+ * of the same name do, sending the output to 'sink' as it is produced
+ * so that it is never held whole in memory.  They return 0 if the sink
+ * stopped rendering, and 1 otherwise.
+ */
+CMARK_EXPORT
+int cmark_render_xml_to_sink(cmark_node *root, int options, cmark_sink *sink);
+
+/** See 'cmark_render_html_with_url_map'; 'urls' may be NULL.
+ */
+CMARK_EXPORT
+int cmark_render_html_to_sink(cmark_node *root, int options,
+                              const cmark_url_map *urls, cmark_sink *sink);
+
+CMARK_EXPORT
+int cmark_render_man_to_sink(cmark_node *root, int options, int width,
+                             cmark_sink *sink);
+
+CMARK_EXPORT
+int cmark_render_commonmark_to_sink(cmark_node *root, int options, int width,
+                                    cmark_sink *sink);
+
+CMARK_EXPORT
+int cmark_render_latex_to_sink(cmark_node *root, int options, int width,
+                               cmark_sink *sink);
+
+CMARK_EXPORT
+int cmark_render_text_to_sink(cmark_node *root, int options,
+                              const char *separator, cmark_sink *sink);
+
+/** Parses a document and renders it as HTML a top-level block at a time.
+ */
+typedef struct cmark_html_pipeline cmark_html_pipeline;
+
+/** Create a pipeline that parses the document fed to 'parser' and renders
+ * it to 'sink' like 'cmark_render_html_to_sink' with the options of
+ * 'parser' and 'urls' (which may be NULL).  As soon as a top-level block
+ * is closed, its inlines are parsed, it is rendered and it is freed, so
+ * that the memory used follows the largest top-level block rather than
+ * the whole document.  Since a block is rendered before the rest of the
+ * document is seen, links can only use the link reference definitions
+ * that come before them (or those of the reference dictionary of
+ * 'parser'); otherwise the output is the same as for the whole document.
+ * Nothing may have been fed to 'parser' before, and it is to be used
+ * through the pipeline only.  The pipeline is to be freed with
+ * 'cmark_html_pipeline_free' before 'parser'.
+ */
+CMARK_EXPORT
+cmark_html_pipeline *cmark_html_pipeline_new(cmark_parser *parser,
+                                             const cmark_url_map *urls,
+                                             cmark_sink *sink);
+
+/** Feeds a string of length 'len' to 'pipeline', like 'cmark_parser_feed',
+ * rendering the blocks it closes.  Returns 0 if the sink stopped
+ * rendering, and 1 otherwise.
+ */
+CMARK_EXPORT
+int cmark_html_pipeline_feed(cmark_html_pipeline *pipeline, const char *buffer,
+                             size_t len);
+
+/** Finish parsing and render the remaining blocks.  Returns 0 if the sink
+ * stopped rendering, and 1 otherwise.
+ */
+CMARK_EXPORT
+int cmark_html_pipeline_finish(cmark_html_pipeline *pipeline);
+
+/** Frees 'pipeline' and what is left of the document it parsed.
+ */
+CMARK_EXPORT
+void cmark_html_pipeline_free(cmark_html_pipeline *pipeline);
+
 /**
  * ## Options
  */
@@ -574,6 +1033,14 @@ char *cmark_render_latex(cmark_node *root, int options, int width);
  */
 #define CMARK_OPT_NOBREAKS (1 << 4)
 
+/** Give headings in HTML output an `id` attribute made from their text:
+ * lowercased ASCII letters, digits, `-`, `_` and non-ASCII characters,
+ * with spaces turned into `-` and other characters dropped.  Ids already
+ * given in the document get a numbered suffix (`intro-1`, `intro-2`,
+ * ...); a heading without such characters gets `section`.
+ */
+#define CMARK_OPT_HEADING_IDS (1 << 12)
+
 /**
  * ### Options affecting parsing
  */
@@ -591,6 +1058,20 @@ char *cmark_render_latex(cmark_node *root, int options, int width);
  */
 #define CMARK_OPT_SMART (1 << 10)
 
+/** Leave the inlines of paragraphs and headings unparsed until they are
+ * first reached: by an iterator entering the block, by
+ * `cmark_node_first_child` or `cmark_node_last_child` on it, by a
+ * renderer, or by moving the block to another tree.  Callers that only
+ * look at part of a document, or only at its block structure, pay for
+ * that part alone.  The tree keeps the reference definitions (and any
+ * dictionary set with `cmark_parser_set_reference_dictionary`, which must
+ * outlive it) until it is freed.  The limit on reference expansion applies
+ * in the order the blocks are reached.  Reaching a block changes the
+ * tree, so a lazily parsed tree must not be read from several threads at
+ * once.
+ */
+#define CMARK_OPT_LAZY_INLINES (1 << 11)
+
 /**
  * ## Version information
  */
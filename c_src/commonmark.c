@@ -12,8 +12,13 @@
 #include "scanners.h"
 #include "render.h"
 
-#define OUT(s, wrap, escaping) renderer->out(renderer, s, wrap, escaping)
-#define LIT(s) renderer->out(renderer, s, false, LITERAL)
+#define OUT(s, wrap, escaping)                                                 \
+  renderer->out(renderer, s, (bufsize_t)strlen(s), wrap, escaping)
+#define LIT(s) OUT(s, false, LITERAL)
+// the literal of 'node', which needn't be NUL-terminated
+#define OUT_LITERAL(node, wrap, escaping)                                      \
+  renderer->out(renderer, (const char *)(node)->data, (node)->len, wrap,       \
+                escaping)
 #define CR() renderer->cr(renderer)
 #define BLANKLINE() renderer->blankline(renderer)
 #define ENCODED_SIZE 20
@@ -72,13 +77,13 @@ static CMARK_INLINE void outc(cmark_renderer *renderer, cmark_escaping escape,
   }
 }
 
-static int longest_backtick_sequence(const char *code) {
+static int longest_backtick_sequence(const unsigned char *code,
+                                     bufsize_t code_len) {
   int longest = 0;
   int current = 0;
-  size_t i = 0;
-  size_t code_len = strlen(code);
+  bufsize_t i = 0;
   while (i <= code_len) {
-    if (code[i] == '`') {
+    if (i < code_len && code[i] == '`') {
       current++;
     } else {
       if (current > longest) {
@@ -91,15 +96,15 @@ static int longest_backtick_sequence(const char *code) {
   return longest;
 }
 
-static int shortest_unused_backtick_sequence(const char *code) {
+static int shortest_unused_backtick_sequence(const unsigned char *code,
+                                             bufsize_t code_len) {
   // note: if the shortest sequence is >= 32, this returns 32
   // so as not to overflow the bit array.
   uint32_t used = 1;
   int current = 0;
-  size_t i = 0;
-  size_t code_len = strlen(code);
+  bufsize_t i = 0;
   while (i <= code_len) {
-    if (code[i] == '`') {
+    if (i < code_len && code[i] == '`') {
       current++;
     } else {
       if (current > 0 && current < 32) {
@@ -147,7 +152,8 @@ static bool is_autolink(cmark_node *node) {
     url += 7;
   }
   return link_text->data != NULL &&
-         strcmp((const char *)url, (char *)link_text->data) == 0;
+         strlen((const char *)url) == (size_t)link_text->len &&
+         memcmp(url, link_text->data, link_text->len) == 0;
 }
 
 // if node is a block node, returns node.
@@ -284,9 +290,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     }
     info = cmark_node_get_fence_info(node);
     fencechar[0] = strchr(info, '`') == NULL ? '`' : '~';
-    code = cmark_node_get_literal(node);
-
-    numticks = longest_backtick_sequence(code) + 1;
+    numticks = longest_backtick_sequence(node->data, node->len) + 1;
     if (numticks < 3) {
       numticks = 3;
     }
@@ -296,7 +300,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     LIT(" ");
     OUT(info, false, LITERAL);
     CR();
-    OUT(cmark_node_get_literal(node), false, LITERAL);
+    OUT_LITERAL(node, false, LITERAL);
     CR();
     for (i = 0; i < numticks; i++) {
       LIT(fencechar);
@@ -307,7 +311,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
 
   case CMARK_NODE_HTML_BLOCK:
     BLANKLINE();
-    OUT(cmark_node_get_literal(node), false, LITERAL);
+    OUT_LITERAL(node, false, LITERAL);
     BLANKLINE();
     break;
 
@@ -331,7 +335,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_TEXT:
-    OUT(cmark_node_get_literal(node), allow_wrap, NORMAL);
+    OUT_LITERAL(node, allow_wrap, NORMAL);
     break;
 
   case CMARK_NODE_LINEBREAK:
@@ -355,9 +359,9 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_CODE:
-    code = cmark_node_get_literal(node);
-    code_len = strlen(code);
-    numticks = shortest_unused_backtick_sequence(code);
+    code = (const char *)node->data;
+    code_len = node->len;
+    numticks = shortest_unused_backtick_sequence(node->data, node->len);
     has_nonspace = false;
     for (i=0; i < code_len; i++) {
       if (code[i] != ' ') {
@@ -374,7 +378,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     if (extra_spaces) {
       LIT(" ");
     }
-    OUT(cmark_node_get_literal(node), allow_wrap, LITERAL);
+    OUT_LITERAL(node, allow_wrap, LITERAL);
     if (extra_spaces) {
       LIT(" ");
     }
@@ -384,7 +388,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_HTML_INLINE:
-    OUT(cmark_node_get_literal(node), false, LITERAL);
+    OUT_LITERAL(node, false, LITERAL);
     break;
 
   case CMARK_NODE_CUSTOM_INLINE:
@@ -470,11 +474,41 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
   return 1;
 }
 
+// The bytes outc outputs as they are whatever surrounds them.  It only
+// escapes ASCII characters: in NORMAL, control characters and those that
+// may start or end markup, some of them only next to others or with
+// CMARK_OPT_SMART; in TITLE, those that may end the title; in URL, those
+// that may end the destination, and whitespace.
+#define NORMAL_PLAIN(b)                                                        \
+  ((b) >= 0x80 ||                                                              \
+   ((b) >= 0x20 && (b) != '*' && (b) != '_' && (b) != '[' && (b) != ']' &&     \
+    (b) != '#' && (b) != '<' && (b) != '>' && (b) != '\\' && (b) != '`' &&     \
+    (b) != '!' && (b) != '&' && (b) != '-' && (b) != '+' && (b) != '=' &&      \
+    (b) != '.' && (b) != ')' && (b) != '"' && (b) != '\''))
+#define TITLE_PLAIN(b)                                                         \
+  ((b) != '`' && (b) != '<' && (b) != '>' && (b) != '"' && (b) != '\\')
+#define URL_PLAIN(b)                                                           \
+  ((b) != '`' && (b) != '<' && (b) != '>' && (b) != '\\' && (b) != ')' &&      \
+   (b) != '(' && (b) != ' ' && ((b) < '\t' || (b) > '\r'))
+#define PLAIN(b)                                                               \
+  CMARK_PLAIN_BITS(NORMAL_PLAIN(b), TITLE_PLAIN(b), URL_PLAIN(b))
+
+static const unsigned char PLAIN_CHARS[256] = CMARK_PLAIN_CHARS(PLAIN);
+
 char *cmark_render_commonmark(cmark_node *root, int options, int width) {
   if (options & CMARK_OPT_HARDBREAKS) {
     // disable breaking on width, since it has
     // a different meaning with OPT_HARDBREAKS
     width = 0;
   }
-  return cmark_render(root, options, width, outc, S_render_node);
+  return cmark_render(root, options, width, outc, PLAIN_CHARS, S_render_node);
+}
+
+int cmark_render_commonmark_to_sink(cmark_node *root, int options, int width,
+                                    cmark_sink *sink) {
+  if (options & CMARK_OPT_HARDBREAKS) {
+    width = 0;
+  }
+  return cmark_render_to_sink(root, options, width, outc, PLAIN_CHARS,
+                              S_render_node, sink);
 }
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "cmark.h"
+#include "node.h"
+#include "compact.h"
+
+// Number of strings a node of type 'type' keeps in the side table.
+static int S_string_count(cmark_node_type type) {
+  switch (type) {
+  case CMARK_NODE_TEXT:
+  case CMARK_NODE_CODE:
+  case CMARK_NODE_HTML_INLINE:
+  case CMARK_NODE_HTML_BLOCK:
+    return 1;
+  case CMARK_NODE_CODE_BLOCK:
+  case CMARK_NODE_LINK:
+  case CMARK_NODE_IMAGE:
+  case CMARK_NODE_CUSTOM_BLOCK:
+  case CMARK_NODE_CUSTOM_INLINE:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+static size_t S_cstr_len(const unsigned char *s) {
+  return s ? strlen((const char *)s) : 0;
+}
+
+// Bytes the strings of 'node' take up in the pool.
+static size_t S_pool_size(cmark_node *node) {
+  switch (node->type) {
+  case CMARK_NODE_TEXT:
+  case CMARK_NODE_CODE:
+  case CMARK_NODE_HTML_INLINE:
+  case CMARK_NODE_HTML_BLOCK:
+    return (size_t)node->len + 1;
+  case CMARK_NODE_CODE_BLOCK:
+    return (size_t)node->len + 1 + S_cstr_len(node->as.code.info) + 1;
+  case CMARK_NODE_LINK:
+  case CMARK_NODE_IMAGE:
+    return S_cstr_len(node->as.link.url) + 1 +
+           S_cstr_len(node->as.link.title) + 1;
+  case CMARK_NODE_CUSTOM_BLOCK:
+  case CMARK_NODE_CUSTOM_INLINE:
+    return S_cstr_len(node->as.custom.on_enter) + 1 +
+           S_cstr_len(node->as.custom.on_exit) + 1;
+  default:
+    return 0;
+  }
+}
+
+// Preorder successor of 'node' within the tree rooted at 'root', along
+// with the resulting change in depth.
+static cmark_node *S_next(cmark_node *root, cmark_node *node, uint32_t *depth) {
+  if (node->first_child) {
+    (*depth)++;
+    return node->first_child;
+  }
+  while (node != root && node->next == NULL) {
+    node = node->parent;
+    (*depth)--;
+  }
+  return node == root ? NULL : node->next;
+}
+
+static void S_add_string(cmark_compact *tree, uint32_t *nstrings,
+                         size_t *pool_used, const unsigned char *data,
+                         size_t len, bool is_null) {
+  cmark_compact_string *s = &tree->strings[(*nstrings)++];
+
+  s->offset = (uint32_t)*pool_used;
+  s->len = is_null ? CMARK_COMPACT_NONE : (uint32_t)len;
+  if (len > 0) {
+    memcpy(tree->pool + *pool_used, data, len);
+  }
+  tree->pool[*pool_used + len] = 0;
+  *pool_used += len + 1;
+}
+
+static void S_add_cstr(cmark_compact *tree, uint32_t *nstrings,
+                       size_t *pool_used, const unsigned char *s) {
+  S_add_string(tree, nstrings, pool_used, s, S_cstr_len(s), s == NULL);
+}
+
+cmark_compact *cmark_compact_new(cmark_node *root) {
+  cmark_mem *mem;
+  cmark_compact *tree;
+  cmark_node *cur, *parent, *grandparent;
+  uint32_t size = 0, nstrings = 0, nlists = 0, depth = 0, max_depth = 0;
+  uint32_t i, *last;
+  size_t pool_size = 0;
+
+  if (root == NULL) {
+    return NULL;
+  }
+  mem = root->mem;
+  cmark_node_parse_pending_inlines(root);
+
+  // Size everything up front so that each table is allocated once.
+  for (cur = root; cur != NULL; cur = S_next(root, cur, &depth)) {
+    if (depth > max_depth) {
+      max_depth = depth;
+    }
+    size++;
+    nstrings += S_string_count((cmark_node_type)cur->type);
+    if (cur->type == CMARK_NODE_LIST) {
+      nlists++;
+    }
+    pool_size += S_pool_size(cur);
+  }
+  if (size >= CMARK_COMPACT_NONE || pool_size >= CMARK_COMPACT_NONE) {
+    return NULL;
+  }
+
+  tree = (cmark_compact *)mem->calloc(1, sizeof(*tree));
+  tree->mem = mem;
+  tree->size = size;
+  tree->depth = max_depth + 1;
+  tree->type = (uint8_t *)mem->calloc(size, sizeof(uint8_t));
+  tree->flags = (uint8_t *)mem->calloc(size, sizeof(uint8_t));
+  tree->first_child = (uint32_t *)mem->calloc(size, sizeof(uint32_t));
+  tree->next = (uint32_t *)mem->calloc(size, sizeof(uint32_t));
+  tree->aux = (uint32_t *)mem->calloc(size, sizeof(uint32_t));
+  tree->pos = (cmark_compact_pos *)mem->calloc(size, sizeof(cmark_compact_pos));
+  tree->strings = (cmark_compact_string *)mem->calloc(
+      nstrings ? nstrings : 1, sizeof(cmark_compact_string));
+  tree->lists = (cmark_list *)mem->calloc(nlists ? nlists : 1,
+                                          sizeof(cmark_list));
+  tree->pool = (unsigned char *)mem->calloc(pool_size ? pool_size : 1, 1);
+
+  // last[d] is the most recent node seen at depth d, i.e. the previous
+  // sibling of the next node at that depth.
+  last = (uint32_t *)mem->calloc(tree->depth, sizeof(uint32_t));
+
+  nstrings = 0;
+  nlists = 0;
+  pool_size = 0;
+  depth = 0;
+  i = 0;
+  for (cur = root; cur != NULL; cur = S_next(root, cur, &depth), i++) {
+    tree->type[i] = (uint8_t)cur->type;
+    tree->first_child[i] = CMARK_COMPACT_NONE;
+    tree->next[i] = CMARK_COMPACT_NONE;
+    tree->pos[i].start_line = cur->start_line;
+    tree->pos[i].start_column = cur->start_column;
+    tree->pos[i].end_line = cur->end_line;
+    tree->pos[i].end_column = cur->end_column;
+
+    if (depth > 0) {
+      if (cur->prev == NULL) {
+        tree->first_child[last[depth - 1]] = i;
+      } else {
+        tree->next[last[depth]] = i;
+      }
+    }
+    last[depth] = i;
+
+    switch (cur->type) {
+    case CMARK_NODE_TEXT:
+    case CMARK_NODE_CODE:
+    case CMARK_NODE_HTML_INLINE:
+    case CMARK_NODE_HTML_BLOCK:
+      tree->aux[i] = nstrings;
+      S_add_string(tree, &nstrings, &pool_size, cur->data, (size_t)cur->len,
+                   false);
+      break;
+    case CMARK_NODE_CODE_BLOCK:
+      tree->aux[i] = nstrings;
+      S_add_string(tree, &nstrings, &pool_size, cur->data, (size_t)cur->len,
+                   false);
+      S_add_cstr(tree, &nstrings, &pool_size, cur->as.code.info);
+      break;
+    case CMARK_NODE_LINK:
+    case CMARK_NODE_IMAGE:
+      tree->aux[i] = nstrings;
+      S_add_cstr(tree, &nstrings, &pool_size, cur->as.link.url);
+      S_add_cstr(tree, &nstrings, &pool_size, cur->as.link.title);
+      break;
+    case CMARK_NODE_CUSTOM_BLOCK:
+    case CMARK_NODE_CUSTOM_INLINE:
+      tree->aux[i] = nstrings;
+      S_add_cstr(tree, &nstrings, &pool_size, cur->as.custom.on_enter);
+      S_add_cstr(tree, &nstrings, &pool_size, cur->as.custom.on_exit);
+      break;
+    case CMARK_NODE_LIST:
+      tree->aux[i] = nlists;
+      tree->lists[nlists++] = cur->as.list;
+      break;
+    case CMARK_NODE_HEADING:
+      tree->aux[i] = (uint32_t)cur->as.heading.level;
+      break;
+    case CMARK_NODE_PARAGRAPH:
+      parent = cur->parent;
+      grandparent = parent ? parent->parent : NULL;
+      if (grandparent && grandparent->type == CMARK_NODE_LIST &&
+          grandparent->as.list.tight) {
+        tree->flags[i] |= CMARK_COMPACT__TIGHT;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  mem->free(last);
+  return tree;
+}
+
+void cmark_compact_free(cmark_compact *tree) {
+  cmark_mem *mem;
+
+  if (tree == NULL) {
+    return;
+  }
+  mem = tree->mem;
+  mem->free(tree->type);
+  mem->free(tree->flags);
+  mem->free(tree->first_child);
+  mem->free(tree->next);
+  mem->free(tree->aux);
+  mem->free(tree->pos);
+  mem->free(tree->strings);
+  mem->free(tree->lists);
+  mem->free(tree->pool);
+  mem->free(tree);
+}
@@ -0,0 +1,65 @@
+#ifndef CMARK_COMPACT_H
+#define CMARK_COMPACT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "cmark.h"
+#include "node.h"
+
+// Index of a missing node, or length of a NULL string.
+#define CMARK_COMPACT_NONE UINT32_MAX
+
+enum cmark_compact__flags {
+  // paragraph whose grandparent is a tight list
+  CMARK_COMPACT__TIGHT = (1 << 0),
+};
+
+// A string in the pool of a compact tree, NUL-terminated there.
+typedef struct {
+  uint32_t offset;
+  uint32_t len;
+} cmark_compact_string;
+
+typedef struct {
+  int start_line;
+  int start_column;
+  int end_line;
+  int end_column;
+} cmark_compact_pos;
+
+// A node tree stored as arrays indexed by node number, in preorder (the
+// root is node 0).  The fields needed for traversal are kept in dense
+// arrays; everything else lives in side tables that 'aux' indexes:
+//
+// - text, code, inline and block HTML: 'strings' (the literal)
+// - code blocks: 'strings' (the literal, followed by the info string)
+// - links and images: 'strings' (url, followed by title)
+// - custom nodes: 'strings' (on_enter, followed by on_exit)
+// - lists: 'lists'
+// - headings: the level itself
+struct cmark_compact {
+  cmark_mem *mem;
+  uint32_t size;
+  uint32_t depth;
+
+  uint8_t *type;
+  uint8_t *flags;
+  uint32_t *first_child;
+  uint32_t *next;
+  uint32_t *aux;
+
+  cmark_compact_pos *pos;
+  cmark_compact_string *strings;
+  cmark_list *lists;
+  unsigned char *pool;
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -15,6 +15,10 @@ extern "C" {
 
 #define HAVE___BUILTIN_EXPECT
 
+#ifndef _WIN32
+  #define HAVE_PTHREAD_H
+#endif
+
 #define HAVE___ATTRIBUTE__
 
 #ifdef HAVE___ATTRIBUTE__
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "cmark.h"
+#include "node.h"
+#include "parser.h"
+#include "references.h"
+#include "iterator.h"
+#include "buffer.h"
+
+// The position just past the last "]:" in 'data', which every link
+// reference definition contains, or 0 if there is none.
+static bufsize_t S_definitions_end(const unsigned char *data, bufsize_t len) {
+  bufsize_t i;
+
+  for (i = len - 1; i > 0; i--) {
+    if (data[i] == ':' && data[i - 1] == ']') {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+// The start of the line after the one at 'pos'.  Lines end as in the
+// parser.
+static bufsize_t S_next_line(const unsigned char *data, bufsize_t len,
+                             bufsize_t pos) {
+  while (pos < len && data[pos] != '\n' && data[pos] != '\r') {
+    pos++;
+  }
+  if (pos < len && data[pos] == '\r') {
+    pos++;
+  }
+  if (pos < len && data[pos] == '\n') {
+    pos++;
+  }
+  return pos;
+}
+
+static bufsize_t S_text_length(cmark_node *block) {
+  cmark_iter iter;
+  bufsize_t length = 0;
+
+  cmark_iter_init(&iter, block);
+  while (cmark_iter_step(&iter) != CMARK_EVENT_DONE) {
+    if (iter.cur.ev_type == CMARK_EVENT_ENTER) {
+      length += cmark_node_text_length(iter.cur.node);
+    }
+  }
+  return length;
+}
+
+// Whether every bracketed label in data[start, end) names a definition
+// in 'refmap'.  Labels are found as in cmark_parser_block_keys: from a
+// '[' to the next unescaped ']' with no unescaped '[' in between, which
+// also finds the text of inline links, to be on the safe side.
+static bool S_labels_defined(cmark_reference_map *refmap,
+                             const unsigned char *data, bufsize_t start,
+                             bufsize_t end) {
+  unsigned int ref_size = refmap->ref_size;
+  cmark_reference *ref;
+  cmark_chunk label;
+  bufsize_t i, j;
+
+  for (i = start; i < end; i++) {
+    if (data[i] != '[') {
+      continue;
+    }
+    for (j = i + 1; j < end && j - i <= MAX_LINK_LABEL_LENGTH; j++) {
+      if (data[j] == '\\' && j + 1 < end) {
+        j++;
+      } else if (data[j] == '[' || data[j] == ']') {
+        break;
+      }
+    }
+    if (j == end || data[j] != ']') {
+      continue;
+    }
+    label.data = (unsigned char *)data + i + 1;
+    label.len = j - i - 1;
+    ref = cmark_reference_lookup(refmap, &label);
+    // looking a label up is not using it
+    refmap->ref_size = ref_size;
+    if (ref == NULL) {
+      return false;
+    }
+  }
+  return true;
+}
+
+cmark_node *cmark_parser_parse_excerpt(cmark_parser *parser,
+                                       const char *buffer, size_t len,
+                                       int max_blocks, int max_chars) {
+  cmark_mem *mem = parser->mem;
+  const unsigned char *data;
+  cmark_node *block = NULL, *next, *last;
+  bufsize_t size, pos = 0, line_end, definitions_end, defined, block_end;
+  bufsize_t taken = 0, chars = 0, *lines = NULL;
+  int blocks = 0, line_count = 0, line_capacity = 0;
+  bool waiting = false;
+
+  parser->options |= CMARK_OPT_LAZY_INLINES;
+  if (len > (size_t)(BUFSIZE_MAX / 2) || (max_blocks <= 0 && max_chars <= 0)) {
+    return cmark_parser_parse_document(parser, buffer, len);
+  }
+
+  // Fed a line at a time, the parser still borrows block content from
+  // its copy of the input.
+  cmark_strbuf_set(&parser->source, (const unsigned char *)buffer,
+                   (bufsize_t)len);
+  data = parser->source.ptr;
+  size = parser->source.size;
+  definitions_end = S_definitions_end(data, size);
+
+  // Inlines parsed along the way expand references within the limit for
+  // the whole document (see finalize_document).
+  parser->refmap->max_ref_size = cmark_reference_limit(len);
+
+  while (pos < size) {
+    // where each line fed starts, to find the source of blocks
+    if (line_count == line_capacity) {
+      line_capacity = line_capacity ? 2 * line_capacity : 64;
+      lines = (bufsize_t *)mem->realloc(lines, line_capacity * sizeof(*lines));
+    }
+    lines[line_count++] = pos;
+
+    line_end = S_next_line(data, size, pos);
+    cmark_parser_feed(parser, (const char *)data + pos,
+                      (size_t)(line_end - pos));
+    pos = line_end;
+    if (pos == size) {
+      break;
+    }
+
+    // The blocks closed so far are those of the whole document, and the
+    // definitions in them are known; those in an open block are not.
+    last = parser->root->last_child;
+    defined = pos;
+    if (last != NULL && (last->flags & CMARK_NODE__OPEN) &&
+        last->start_line > 0 && last->start_line <= line_count) {
+      defined = lines[last->start_line - 1];
+    }
+    if (waiting && definitions_end > defined) {
+      continue;
+    }
+    waiting = false;
+
+    // Take in the top-level blocks closed since the last line, unless a
+    // label in them may yet be defined.
+    while ((next = block ? block->next : parser->root->first_child) != NULL &&
+           !(next->flags & CMARK_NODE__OPEN)) {
+      block_end = next->end_line < line_count ? lines[next->end_line] : pos;
+      if (definitions_end > defined &&
+          !S_labels_defined(parser->refmap, data, taken, block_end)) {
+        waiting = true;
+        break;
+      }
+      block = next;
+      taken = block_end;
+      blocks++;
+      if (max_chars > 0) {
+        cmark_parser_parse_block_inlines(parser, block);
+        chars += S_text_length(block);
+      }
+      if ((max_blocks > 0 && blocks >= max_blocks) ||
+          (max_chars > 0 && chars >= max_chars)) {
+        mem->free(lines);
+        // as if the rest had been fed, for the same limits
+        parser->total_size = (size_t)size;
+        return cmark_parser_finish(parser);
+      }
+    }
+  }
+
+  mem->free(lines);
+  return cmark_parser_finish(parser);
+}
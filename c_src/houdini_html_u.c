@@ -41,7 +41,7 @@ bufsize_t houdini_unescape_ent(cmark_strbuf *ob, const uint8_t *src,
 
   if (size >= 3 && src[0] == '#') {
     int codepoint = 0;
-    int num_digits = 0;
+    bufsize_t num_digits = 0;
     int max_digits = 7;
 
     if (_isdigit(src[1])) {
@@ -6,9 +6,13 @@
 #include "config.h"
 #include "cmark.h"
 #include "node.h"
+#include "iterator.h"
+#include "compact.h"
 #include "buffer.h"
 #include "houdini.h"
 #include "scanners.h"
+#include "url_map.h"
+#include "render.h"
 
 #define BUFFER_SIZE 100
 
@@ -24,9 +28,25 @@ static CMARK_INLINE void cr(cmark_strbuf *html) {
     cmark_strbuf_putc(html, '\n');
 }
 
+// Ids given to headings so far with CMARK_OPT_HEADING_IDS, in an open
+// addressing table, and the headings listed for a table of contents.
+struct heading_ids {
+  char **table;
+  size_t capacity;
+  size_t count;
+  bool collect;
+  cmark_toc_entry *toc;
+  size_t toc_length;
+  size_t toc_capacity;
+};
+
 struct render_state {
   cmark_strbuf *html;
   cmark_node *plain;
+  struct heading_ids ids;
+  // rewrites of link and image URLs, and the URL being rewritten
+  const cmark_url_map *urls;
+  cmark_strbuf url;
 };
 
 static void S_render_sourcepos(cmark_node *node, cmark_strbuf *html,
@@ -40,6 +60,164 @@ static void S_render_sourcepos(cmark_node *node, cmark_strbuf *html,
   }
 }
 
+// Write the destination of a link or image, rewritten if the URL map has
+// a rewrite for it, unless it is unsafe.
+static void S_render_url(struct render_state *state, const unsigned char *url,
+                         int options) {
+  const cmark_url_rewrite *rewrite = NULL;
+  bufsize_t len;
+
+  if (url == NULL) {
+    return;
+  }
+  len = (bufsize_t)strlen((const char *)url);
+  if (state->urls != NULL) {
+    rewrite = cmark_url_map_lookup(state->urls, url, len);
+  }
+  if (rewrite != NULL) {
+    cmark_strbuf_set(&state->url, rewrite->to, rewrite->to_len);
+    cmark_strbuf_put(&state->url, url + rewrite->from_len,
+                     len - rewrite->from_len);
+    url = state->url.ptr;
+    len = state->url.size;
+  }
+  if ((options & CMARK_OPT_UNSAFE) || !(_scan_dangerous_url(url))) {
+    houdini_escape_href(state->html, url, len);
+  }
+}
+
+// 64-bit FNV-1a of a NUL-terminated id.
+static uint64_t S_id_hash(const unsigned char *id) {
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (; *id; id++) {
+    hash ^= *id;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static char **S_id_slot(struct heading_ids *ids, const unsigned char *id) {
+  size_t i = (size_t)S_id_hash(id) & (ids->capacity - 1);
+
+  while (ids->table[i] != NULL && strcmp(ids->table[i], (const char *)id)) {
+    i = (i + 1) & (ids->capacity - 1);
+  }
+  return &ids->table[i];
+}
+
+static void S_add_id(struct heading_ids *ids, cmark_mem *mem,
+                     const unsigned char *id, bufsize_t len) {
+  char **old = ids->table;
+  size_t old_capacity = ids->capacity, i;
+  char *copy;
+
+  // keep the table at most half full
+  if ((ids->count + 1) * 2 > ids->capacity) {
+    ids->capacity = old_capacity ? old_capacity * 2 : 16;
+    ids->table = (char **)mem->calloc(ids->capacity, sizeof(char *));
+    for (i = 0; i < old_capacity; i++) {
+      if (old[i] != NULL) {
+        *S_id_slot(ids, (const unsigned char *)old[i]) = old[i];
+      }
+    }
+    mem->free(old);
+  }
+
+  copy = (char *)mem->calloc(len + 1, 1);
+  memcpy(copy, id, len);
+  *S_id_slot(ids, id) = copy;
+  ids->count++;
+}
+
+static void S_free_ids(struct heading_ids *ids, cmark_mem *mem) {
+  size_t i;
+
+  for (i = 0; i < ids->capacity; i++) {
+    mem->free(ids->table[i]);
+  }
+  mem->free(ids->table);
+}
+
+static char *S_strdup(cmark_mem *mem, const unsigned char *data,
+                      bufsize_t len) {
+  char *copy = (char *)mem->calloc(len + 1, 1);
+
+  memcpy(copy, data, len);
+  return copy;
+}
+
+// Add the id made from the heading 'text' to 'html' (see
+// CMARK_OPT_HEADING_IDS), and list the heading if asked to.
+static void S_render_heading_id(struct heading_ids *ids, cmark_strbuf *html,
+                                int level, cmark_strbuf *text) {
+  cmark_mem *toc_mem = cmark_get_default_mem_allocator();
+  cmark_strbuf id = CMARK_BUF_INIT(html->mem);
+  bufsize_t i, base_len;
+  unsigned char c;
+  char suffix[BUFFER_SIZE];
+  int n = 0;
+
+  for (i = 0; i < text->size; i++) {
+    c = text->ptr[i];
+    if (c >= 'A' && c <= 'Z') {
+      cmark_strbuf_putc(&id, c - 'A' + 'a');
+    } else if (cmark_isalnum(c) || c == '-' || c == '_' || c >= 0x80) {
+      cmark_strbuf_putc(&id, c);
+    } else if (c == ' ' || c == '\t' || c == '\n') {
+      cmark_strbuf_putc(&id, '-');
+    }
+  }
+  if (id.size == 0) {
+    cmark_strbuf_puts(&id, "section");
+  }
+
+  base_len = id.size;
+  while (ids->count > 0 && *S_id_slot(ids, id.ptr) != NULL) {
+    cmark_strbuf_truncate(&id, base_len);
+    snprintf(suffix, BUFFER_SIZE, "-%d", ++n);
+    cmark_strbuf_puts(&id, suffix);
+  }
+  S_add_id(ids, html->mem, id.ptr, id.size);
+
+  cmark_strbuf_puts(html, " id=\"");
+  cmark_strbuf_put(html, id.ptr, id.size);
+  cmark_strbuf_putc(html, '"');
+
+  if (ids->collect) {
+    if (ids->toc_length == ids->toc_capacity) {
+      ids->toc_capacity = ids->toc_capacity ? ids->toc_capacity * 2 : 8;
+      ids->toc = (cmark_toc_entry *)toc_mem->realloc(
+          ids->toc, ids->toc_capacity * sizeof(cmark_toc_entry));
+    }
+    ids->toc[ids->toc_length].level = level;
+    ids->toc[ids->toc_length].id = S_strdup(toc_mem, id.ptr, id.size);
+    ids->toc[ids->toc_length].text = S_strdup(toc_mem, text->ptr, text->size);
+    ids->toc_length++;
+  }
+  cmark_strbuf_free(&id);
+}
+
+// The text of a heading, without markup.
+static void S_heading_text(cmark_node *heading, cmark_strbuf *text) {
+  cmark_iter iter;
+  cmark_node *node;
+
+  cmark_iter_init(&iter, heading);
+  while (cmark_iter_step(&iter) != CMARK_EVENT_DONE) {
+    node = iter.cur.node;
+    if (iter.cur.ev_type != CMARK_EVENT_ENTER) {
+      continue;
+    }
+    if (node->type == CMARK_NODE_TEXT || node->type == CMARK_NODE_CODE) {
+      cmark_strbuf_put(text, node->data, node->len);
+    } else if (node->type == CMARK_NODE_SOFTBREAK ||
+               node->type == CMARK_NODE_LINEBREAK) {
+      cmark_strbuf_putc(text, ' ');
+    }
+  }
+}
+
 static int S_render_node(cmark_node *node, cmark_event_type ev_type,
                          struct render_state *state, int options) {
   cmark_node *parent;
@@ -134,6 +312,14 @@ static int S_render_node(cmark_node *node, cmark_event_type ev_type,
       cr(html);
       start_heading[2] = (char)('0' + node->as.heading.level);
       cmark_strbuf_puts(html, start_heading);
+      if (options & CMARK_OPT_HEADING_IDS) {
+        cmark_strbuf text = CMARK_BUF_INIT(html->mem);
+
+        S_heading_text(node, &text);
+        S_render_heading_id(&state->ids, html, node->as.heading.level,
+                            &text);
+        cmark_strbuf_free(&text);
+      }
       S_render_sourcepos(node, html, options);
       cmark_strbuf_putc(html, '>');
     } else {
@@ -276,11 +462,7 @@ static int S_render_node(cmark_node *node, cmark_event_type ev_type,
   case CMARK_NODE_LINK:
     if (entering) {
       cmark_strbuf_puts(html, "<a href=\"");
-      if (node->as.link.url && ((options & CMARK_OPT_UNSAFE) ||
-                                !(_scan_dangerous_url(node->as.link.url)))) {
-        houdini_escape_href(html, node->as.link.url,
-                            strlen((char *)node->as.link.url));
-      }
+      S_render_url(state, node->as.link.url, options);
       if (node->as.link.title) {
         cmark_strbuf_puts(html, "\" title=\"");
         escape_html(html, node->as.link.title,
@@ -295,11 +477,7 @@ static int S_render_node(cmark_node *node, cmark_event_type ev_type,
   case CMARK_NODE_IMAGE:
     if (entering) {
       cmark_strbuf_puts(html, "<img src=\"");
-      if (node->as.link.url && ((options & CMARK_OPT_UNSAFE) ||
-                                !(_scan_dangerous_url(node->as.link.url)))) {
-        houdini_escape_href(html, node->as.link.url,
-                            strlen((char *)node->as.link.url));
-      }
+      S_render_url(state, node->as.link.url, options);
       cmark_strbuf_puts(html, "\" alt=\"");
       state->plain = node;
     } else {
@@ -323,19 +501,691 @@ static int S_render_node(cmark_node *node, cmark_event_type ev_type,
 }
 
 char *cmark_render_html(cmark_node *root, int options) {
-  char *result;
+  return cmark_render_html_with_url_map(root, options, NULL);
+}
+
+// Render 'root' into the buffer of 'state', passing the output on to
+// 'sink' between nodes if there is one, but for the last byte, which cr()
+// looks at.  Returns 0 if the sink failed.
+static int S_render_tree(cmark_node *root, int options,
+                         struct render_state *state, cmark_sink *sink) {
+  cmark_strbuf *html = state->html;
+  cmark_event_type ev_type;
+  cmark_iter iter;
+
+  cmark_node_parse_pending_inlines(root);
+  cmark_iter_init(&iter, root);
+  while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+    S_render_node(iter.cur.node, ev_type, state, options);
+    if (sink != NULL && (size_t)html->size >= sink->flush_size &&
+        !cmark_strbuf_drain(html, html->size - 1, sink)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int S_render_html(cmark_node *root, int options,
+                         const cmark_url_map *urls, cmark_strbuf *html,
+                         cmark_sink *sink) {
+  struct render_state state = {html, NULL};
+  int ok;
+
+  state.urls = urls;
+  cmark_strbuf_init(root->mem, &state.url, 0);
+
+  ok = S_render_tree(root, options, &state, sink);
+  S_free_ids(&state.ids, root->mem);
+  cmark_strbuf_free(&state.url);
+
+  return ok;
+}
+
+char *cmark_render_html_with_url_map(cmark_node *root, int options,
+                                     const cmark_url_map *urls) {
+  cmark_strbuf html = CMARK_BUF_INIT(root->mem);
+
+  S_render_html(root, options, urls, &html, NULL);
+  return (char *)cmark_strbuf_detach(&html);
+}
+
+int cmark_render_html_to_sink(cmark_node *root, int options,
+                              const cmark_url_map *urls, cmark_sink *sink) {
+  cmark_strbuf html = CMARK_BUF_INIT(root->mem);
+  int ok = S_render_html(root, options, urls, &html, sink) &&
+           cmark_strbuf_drain(&html, html.size, sink);
+
+  cmark_strbuf_free(&html);
+  return ok;
+}
+
+struct cmark_html_stream {
+  cmark_mem *mem;
+  cmark_strbuf html;
+  struct render_state state;
+  int options;
+  cmark_sink *sink;
+};
+
+cmark_html_stream *cmark_html_stream_new(cmark_mem *mem, int options,
+                                         const cmark_url_map *urls,
+                                         cmark_sink *sink) {
+  cmark_html_stream *stream =
+      (cmark_html_stream *)mem->calloc(1, sizeof(cmark_html_stream));
+
+  stream->mem = mem;
+  cmark_strbuf_init(mem, &stream->html, 0);
+  stream->state.html = &stream->html;
+  stream->state.urls = urls;
+  cmark_strbuf_init(mem, &stream->state.url, 0);
+  stream->options = options;
+  stream->sink = sink;
+  return stream;
+}
+
+int cmark_html_stream_render(cmark_html_stream *stream, cmark_node *block) {
+  return S_render_tree(block, stream->options, &stream->state, stream->sink);
+}
+
+int cmark_html_stream_finish(cmark_html_stream *stream) {
+  return cmark_strbuf_drain(&stream->html, stream->html.size, stream->sink);
+}
+
+void cmark_html_stream_free(cmark_html_stream *stream) {
+  if (stream == NULL) {
+    return;
+  }
+  S_free_ids(&stream->state.ids, stream->mem);
+  cmark_strbuf_free(&stream->state.url);
+  cmark_strbuf_free(&stream->html);
+  stream->mem->free(stream);
+}
+
+char *cmark_render_html_toc(cmark_node *root, int options,
+                            cmark_toc_entry **toc, size_t *toc_length) {
+  cmark_strbuf html = CMARK_BUF_INIT(root->mem);
+  cmark_event_type ev_type;
+  struct render_state state = {&html, NULL};
+  cmark_iter iter;
+
+  options |= CMARK_OPT_HEADING_IDS;
+  state.ids.collect = true;
+
+  cmark_node_parse_pending_inlines(root);
+  cmark_iter_init(&iter, root);
+  while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+    S_render_node(iter.cur.node, ev_type, &state, options);
+  }
+  S_free_ids(&state.ids, root->mem);
+
+  *toc = state.ids.toc;
+  *toc_length = state.ids.toc_length;
+  return (char *)cmark_strbuf_detach(&html);
+}
+
+void cmark_toc_free(cmark_toc_entry *toc, size_t length) {
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    mem->free(toc[i].id);
+    mem->free(toc[i].text);
+  }
+  mem->free(toc);
+}
+
+char *cmark_render_html_blocks(cmark_node *root, int options, size_t *ends) {
+  cmark_strbuf html = CMARK_BUF_INIT(root->mem);
+  cmark_event_type ev_type;
+  cmark_node *child;
+  struct render_state state = {&html, NULL};
+  cmark_iter iter;
+
+  for (child = root->first_child; child != NULL; child = child->next) {
+    cmark_node_parse_pending_inlines(child);
+    cmark_iter_init(&iter, child);
+    while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+      S_render_node(iter.cur.node, ev_type, &state, options);
+    }
+    *ends++ = (size_t)html.size;
+  }
+  S_free_ids(&state.ids, root->mem);
+
+  return (char *)cmark_strbuf_detach(&html);
+}
+
+// Where to cut the text of 'block' after 'length' characters (as counted
+// by cmark_node_text_length): at the end of the last word that ends there,
+// in whichever node it is.  Raw inline HTML is a cut of its own, since it
+// may open elements that only a later node closes.  Sets '*cut' to the
+// node to be rendered up to byte '*end' before the ellipsis, or not at all
+// if '*end' is -1; a single word running up to the limit is cut there.
+static void S_find_cut(cmark_node *block, bufsize_t length, int options,
+                       cmark_node **cut, bufsize_t *end) {
+  cmark_iter iter;
+  cmark_node *node, *word_node = NULL, *last_node = NULL;
+  bufsize_t i, count = 0, word_end = 0, last_end = 0;
+  bool in_space = true;
+
+  cmark_iter_init(&iter, block);
+  while (cmark_iter_step(&iter) != CMARK_EVENT_DONE) {
+    node = iter.cur.node;
+    if (iter.cur.ev_type != CMARK_EVENT_ENTER) {
+      continue;
+    }
+    switch (node->type) {
+    case CMARK_NODE_HTML_INLINE:
+      if (!(options & CMARK_OPT_UNSAFE)) {
+        break;
+      }
+      // fall through
+    case CMARK_NODE_SOFTBREAK:
+    case CMARK_NODE_LINEBREAK:
+      if (node->type == CMARK_NODE_HTML_INLINE || count == length) {
+        if (last_node != NULL) {
+          *cut = last_node;
+          *end = last_end;
+        } else {
+          *cut = node;
+          *end = -1;
+        }
+        return;
+      }
+      count++;
+      if (!in_space) {
+        word_node = last_node;
+        word_end = last_end;
+        in_space = true;
+      }
+      break;
+    case CMARK_NODE_TEXT:
+    case CMARK_NODE_CODE:
+    case CMARK_NODE_CODE_BLOCK:
+      for (i = 0; i < node->len; i++) {
+        if ((node->data[i] & 0xC0) != 0x80) {
+          if (count == length) {
+            if (in_space || node->data[i] == ' ' || node->data[i] == '\n') {
+              *cut = last_node != NULL ? last_node : node;
+              *end = last_node != NULL ? last_end : 0;
+            } else if (word_node != NULL) {
+              *cut = word_node;
+              *end = word_end;
+            } else {
+              *cut = node;
+              *end = i;
+            }
+            return;
+          }
+          count++;
+        }
+        if (node->data[i] == ' ' || node->data[i] == '\n') {
+          if (!in_space) {
+            word_node = last_node;
+            word_end = last_end;
+            in_space = true;
+          }
+        } else {
+          last_node = node;
+          last_end = i + 1;
+          in_space = false;
+        }
+      }
+      break;
+    default:
+      // blocks within 'block' separate words as spaces do
+      if (node->type < CMARK_NODE_FIRST_INLINE && !in_space) {
+        word_node = last_node;
+        word_end = last_end;
+        in_space = true;
+      }
+      break;
+    }
+  }
+  // not reached for blocks longer than 'length'
+  *cut = last_node;
+  *end = last_end;
+}
+
+// Render the leaf 'node' cut down to its first 'end' bytes, followed by
+// an ellipsis; with 'end' -1, only the ellipsis.
+static void S_render_cut(cmark_node *node, bufsize_t end,
+                         struct render_state *state, int options) {
+  static const char ellipsis[] = "\xE2\x80\xA6"; // U+2026
+  cmark_strbuf cut = CMARK_BUF_INIT(node->mem);
+  unsigned char *data = node->data;
+  bufsize_t len = node->len;
+
+  if (end < 0) {
+    cmark_strbuf_puts(state->html, ellipsis);
+    return;
+  }
+
+  cmark_strbuf_put(&cut, data, end);
+  cmark_strbuf_puts(&cut, ellipsis);
+  node->data = cut.ptr;
+  node->len = cut.size;
+  S_render_node(node, CMARK_EVENT_ENTER, state, options);
+  node->data = data;
+  node->len = len;
+  cmark_strbuf_free(&cut);
+}
+
+static bufsize_t S_block_text_length(cmark_node *block) {
+  cmark_iter iter;
+  bufsize_t length = 0;
+
+  cmark_iter_init(&iter, block);
+  while (cmark_iter_step(&iter) != CMARK_EVENT_DONE) {
+    if (iter.cur.ev_type == CMARK_EVENT_ENTER) {
+      length += cmark_node_text_length(iter.cur.node);
+    }
+  }
+  return length;
+}
+
+char *cmark_render_html_excerpt(cmark_node *root, int options, int max_blocks,
+                                int max_chars) {
   cmark_strbuf html = CMARK_BUF_INIT(root->mem);
   cmark_event_type ev_type;
-  cmark_node *cur;
+  cmark_node *child, *cur, *cut = NULL;
   struct render_state state = {&html, NULL};
-  cmark_iter *iter = cmark_iter_new(root);
+  cmark_iter iter;
+  bufsize_t left = max_chars, length, end = 0;
+  int blocks = 0;
+
+  for (child = root->first_child; child != NULL; child = child->next) {
+    if ((max_blocks > 0 && blocks == max_blocks) ||
+        (max_chars > 0 && left == 0)) {
+      break;
+    }
+    blocks++;
+
+    cmark_node_parse_pending_inlines(child);
+    if (max_chars > 0) {
+      length = S_block_text_length(child);
+      if (length > left) {
+        S_find_cut(child, left, options, &cut, &end);
+      }
+      left = length > left ? 0 : left - length;
+    }
+    cmark_iter_init(&iter, child);
+    while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+      cur = iter.cur.node;
+      if (cur == cut) {
+        // cut the text short and close the elements it is in
+        S_render_cut(cur, end, &state, options);
+        for (cur = cur->parent; cur != root; cur = cur->parent) {
+          S_render_node(cur, CMARK_EVENT_EXIT, &state, options);
+        }
+        S_free_ids(&state.ids, root->mem);
+        return (char *)cmark_strbuf_detach(&html);
+      }
+      S_render_node(cur, ev_type, &state, options);
+    }
+  }
+  S_free_ids(&state.ids, root->mem);
+
+  return (char *)cmark_strbuf_detach(&html);
+}
+
+// Rendering of compact trees mirrors S_render_node.
+
+struct compact_render_state {
+  cmark_strbuf *html;
+  cmark_compact *tree;
+  uint32_t plain;
+  struct heading_ids ids;
+};
+
+static const int S_compact_leaf_mask =
+    (1 << CMARK_NODE_HTML_BLOCK) | (1 << CMARK_NODE_THEMATIC_BREAK) |
+    (1 << CMARK_NODE_CODE_BLOCK) | (1 << CMARK_NODE_TEXT) |
+    (1 << CMARK_NODE_SOFTBREAK) | (1 << CMARK_NODE_LINEBREAK) |
+    (1 << CMARK_NODE_CODE) | (1 << CMARK_NODE_HTML_INLINE);
+
+// nodes with strings in the side table
+static const int S_compact_string_mask =
+    (1 << CMARK_NODE_TEXT) | (1 << CMARK_NODE_CODE) |
+    (1 << CMARK_NODE_HTML_INLINE) | (1 << CMARK_NODE_HTML_BLOCK) |
+    (1 << CMARK_NODE_CODE_BLOCK) | (1 << CMARK_NODE_LINK) |
+    (1 << CMARK_NODE_IMAGE) | (1 << CMARK_NODE_CUSTOM_BLOCK) |
+    (1 << CMARK_NODE_CUSTOM_INLINE);
+
+static void S_render_compact_sourcepos(cmark_compact *tree, uint32_t node,
+                                       cmark_strbuf *html, int options) {
+  char buffer[BUFFER_SIZE];
+  if (CMARK_OPT_SOURCEPOS & options) {
+    cmark_compact_pos *pos = &tree->pos[node];
+    snprintf(buffer, BUFFER_SIZE, " data-sourcepos=\"%d:%d-%d:%d\"",
+             pos->start_line, pos->start_column, pos->end_line,
+             pos->end_column);
+    cmark_strbuf_puts(html, buffer);
+  }
+}
+
+// The text of a heading, without markup.  Its inlines follow it in
+// preorder, up to the next block.
+static void S_compact_heading_text(cmark_compact *tree, uint32_t heading,
+                                   cmark_strbuf *text) {
+  cmark_compact_string *str;
+  uint32_t node;
+
+  for (node = heading + 1;
+       node < tree->size && tree->type[node] >= CMARK_NODE_FIRST_INLINE;
+       node++) {
+    switch (tree->type[node]) {
+    case CMARK_NODE_TEXT:
+    case CMARK_NODE_CODE:
+      str = &tree->strings[tree->aux[node]];
+      cmark_strbuf_put(text, tree->pool + str->offset, (bufsize_t)str->len);
+      break;
+
+    case CMARK_NODE_SOFTBREAK:
+    case CMARK_NODE_LINEBREAK:
+      cmark_strbuf_putc(text, ' ');
+      break;
+
+    default:
+      break;
+    }
+  }
+}
+
+static void S_render_compact_node(uint32_t node, bool entering,
+                                  struct compact_render_state *state,
+                                  int options) {
+  cmark_compact *tree = state->tree;
+  cmark_strbuf *html = state->html;
+  cmark_compact_string *str = NULL;
+  const unsigned char *data = NULL;
+  char start_heading[] = "<h0";
+  char end_heading[] = "</h0";
+  char buffer[BUFFER_SIZE];
+
+  if ((1 << tree->type[node]) & S_compact_string_mask) {
+    str = &tree->strings[tree->aux[node]];
+    data = tree->pool + str->offset;
+  }
 
-  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
-    cur = cmark_iter_get_node(iter);
-    S_render_node(cur, ev_type, &state, options);
+  if (state->plain == node) { // back at original node
+    state->plain = CMARK_COMPACT_NONE;
+  }
+
+  if (state->plain != CMARK_COMPACT_NONE) {
+    switch (tree->type[node]) {
+    case CMARK_NODE_TEXT:
+    case CMARK_NODE_CODE:
+    case CMARK_NODE_HTML_INLINE:
+      escape_html(html, data, str->len);
+      break;
+
+    case CMARK_NODE_LINEBREAK:
+    case CMARK_NODE_SOFTBREAK:
+      cmark_strbuf_putc(html, ' ');
+      break;
+
+    default:
+      break;
+    }
+    return;
+  }
+
+  switch (tree->type[node]) {
+  case CMARK_NODE_DOCUMENT:
+    break;
+
+  case CMARK_NODE_BLOCK_QUOTE:
+    if (entering) {
+      cr(html);
+      cmark_strbuf_puts(html, "<blockquote");
+      S_render_compact_sourcepos(tree, node, html, options);
+      cmark_strbuf_puts(html, ">\n");
+    } else {
+      cr(html);
+      cmark_strbuf_puts(html, "</blockquote>\n");
+    }
+    break;
+
+  case CMARK_NODE_LIST: {
+    cmark_list *list = &tree->lists[tree->aux[node]];
+
+    if (entering) {
+      cr(html);
+      if (list->list_type == CMARK_BULLET_LIST) {
+        cmark_strbuf_puts(html, "<ul");
+      } else if (list->start == 1) {
+        cmark_strbuf_puts(html, "<ol");
+      } else {
+        snprintf(buffer, BUFFER_SIZE, "<ol start=\"%d\"", list->start);
+        cmark_strbuf_puts(html, buffer);
+      }
+      S_render_compact_sourcepos(tree, node, html, options);
+      cmark_strbuf_puts(html, ">\n");
+    } else {
+      cmark_strbuf_puts(html, list->list_type == CMARK_BULLET_LIST
+                                  ? "</ul>\n"
+                                  : "</ol>\n");
+    }
+    break;
+  }
+
+  case CMARK_NODE_ITEM:
+    if (entering) {
+      cr(html);
+      cmark_strbuf_puts(html, "<li");
+      S_render_compact_sourcepos(tree, node, html, options);
+      cmark_strbuf_putc(html, '>');
+    } else {
+      cmark_strbuf_puts(html, "</li>\n");
+    }
+    break;
+
+  case CMARK_NODE_HEADING:
+    if (entering) {
+      cr(html);
+      start_heading[2] = (char)('0' + tree->aux[node]);
+      cmark_strbuf_puts(html, start_heading);
+      if (options & CMARK_OPT_HEADING_IDS) {
+        cmark_strbuf text = CMARK_BUF_INIT(html->mem);
+
+        S_compact_heading_text(tree, node, &text);
+        S_render_heading_id(&state->ids, html, (int)tree->aux[node], &text);
+        cmark_strbuf_free(&text);
+      }
+      S_render_compact_sourcepos(tree, node, html, options);
+      cmark_strbuf_putc(html, '>');
+    } else {
+      end_heading[3] = (char)('0' + tree->aux[node]);
+      cmark_strbuf_puts(html, end_heading);
+      cmark_strbuf_puts(html, ">\n");
+    }
+    break;
+
+  case CMARK_NODE_CODE_BLOCK: {
+    cmark_compact_string *info = str + 1;
+    const unsigned char *info_data = tree->pool + info->offset;
+
+    cr(html);
+
+    if (info->len == CMARK_COMPACT_NONE || info->len == 0) {
+      cmark_strbuf_puts(html, "<pre");
+      S_render_compact_sourcepos(tree, node, html, options);
+      cmark_strbuf_puts(html, "><code>");
+    } else {
+      bufsize_t first_tag = 0;
+      while (info_data[first_tag] && !cmark_isspace(info_data[first_tag])) {
+        first_tag += 1;
+      }
+
+      cmark_strbuf_puts(html, "<pre");
+      S_render_compact_sourcepos(tree, node, html, options);
+      cmark_strbuf_puts(html, "><code class=\"language-");
+      escape_html(html, info_data, first_tag);
+      cmark_strbuf_puts(html, "\">");
+    }
+
+    escape_html(html, data, str->len);
+    cmark_strbuf_puts(html, "</code></pre>\n");
+    break;
+  }
+
+  case CMARK_NODE_HTML_BLOCK:
+    cr(html);
+    if (!(options & CMARK_OPT_UNSAFE)) {
+      cmark_strbuf_puts(html, "<!-- raw HTML omitted -->");
+    } else {
+      cmark_strbuf_put(html, data, str->len);
+    }
+    cr(html);
+    break;
+
+  case CMARK_NODE_CUSTOM_BLOCK: {
+    cmark_compact_string *block = entering ? str : str + 1;
+    cr(html);
+    if (block->len != CMARK_COMPACT_NONE) {
+      cmark_strbuf_put(html, tree->pool + block->offset, block->len);
+    }
+    cr(html);
+    break;
+  }
+
+  case CMARK_NODE_THEMATIC_BREAK:
+    cr(html);
+    cmark_strbuf_puts(html, "<hr");
+    S_render_compact_sourcepos(tree, node, html, options);
+    cmark_strbuf_puts(html, " />\n");
+    break;
+
+  case CMARK_NODE_PARAGRAPH:
+    if (!(tree->flags[node] & CMARK_COMPACT__TIGHT)) {
+      if (entering) {
+        cr(html);
+        cmark_strbuf_puts(html, "<p");
+        S_render_compact_sourcepos(tree, node, html, options);
+        cmark_strbuf_putc(html, '>');
+      } else {
+        cmark_strbuf_puts(html, "</p>\n");
+      }
+    }
+    break;
+
+  case CMARK_NODE_TEXT:
+    escape_html(html, data, str->len);
+    break;
+
+  case CMARK_NODE_LINEBREAK:
+    cmark_strbuf_puts(html, "<br />\n");
+    break;
+
+  case CMARK_NODE_SOFTBREAK:
+    if (options & CMARK_OPT_HARDBREAKS) {
+      cmark_strbuf_puts(html, "<br />\n");
+    } else if (options & CMARK_OPT_NOBREAKS) {
+      cmark_strbuf_putc(html, ' ');
+    } else {
+      cmark_strbuf_putc(html, '\n');
+    }
+    break;
+
+  case CMARK_NODE_CODE:
+    cmark_strbuf_puts(html, "<code>");
+    escape_html(html, data, str->len);
+    cmark_strbuf_puts(html, "</code>");
+    break;
+
+  case CMARK_NODE_HTML_INLINE:
+    if (!(options & CMARK_OPT_UNSAFE)) {
+      cmark_strbuf_puts(html, "<!-- raw HTML omitted -->");
+    } else {
+      cmark_strbuf_put(html, data, str->len);
+    }
+    break;
+
+  case CMARK_NODE_CUSTOM_INLINE: {
+    cmark_compact_string *block = entering ? str : str + 1;
+    if (block->len != CMARK_COMPACT_NONE) {
+      cmark_strbuf_put(html, tree->pool + block->offset, block->len);
+    }
+    break;
+  }
+
+  case CMARK_NODE_STRONG:
+    cmark_strbuf_puts(html, entering ? "<strong>" : "</strong>");
+    break;
+
+  case CMARK_NODE_EMPH:
+    cmark_strbuf_puts(html, entering ? "<em>" : "</em>");
+    break;
+
+  case CMARK_NODE_LINK:
+  case CMARK_NODE_IMAGE: {
+    bool image = tree->type[node] == CMARK_NODE_IMAGE;
+    cmark_compact_string *title = str + 1;
+
+    if (entering) {
+      cmark_strbuf_puts(html, image ? "<img src=\"" : "<a href=\"");
+      if (str->len != CMARK_COMPACT_NONE &&
+          ((options & CMARK_OPT_UNSAFE) || !(_scan_dangerous_url(data)))) {
+        houdini_escape_href(html, data, str->len);
+      }
+      if (image) {
+        cmark_strbuf_puts(html, "\" alt=\"");
+        state->plain = node;
+        break;
+      }
+    }
+    if (entering != image && title->len != CMARK_COMPACT_NONE) {
+      cmark_strbuf_puts(html, "\" title=\"");
+      escape_html(html, tree->pool + title->offset, title->len);
+    }
+    if (image) {
+      cmark_strbuf_puts(html, "\" />");
+    } else {
+      cmark_strbuf_puts(html, entering ? "\">" : "</a>");
+    }
+    break;
+  }
+
+  default:
+    assert(false);
+    break;
+  }
+}
+
+char *cmark_compact_render_html(cmark_compact *tree, int options) {
+  cmark_strbuf html = CMARK_BUF_INIT(tree->mem);
+  struct compact_render_state state = {&html, tree, CMARK_COMPACT_NONE};
+  uint32_t *stack = (uint32_t *)tree->mem->calloc(tree->depth,
+                                                  sizeof(uint32_t));
+  uint32_t depth = 0;
+  uint32_t cur = 0;
+
+  S_render_compact_node(cur, true, &state, options);
+  for (;;) {
+    bool leaf = ((1 << tree->type[cur]) & S_compact_leaf_mask) != 0;
+
+    if (!leaf && tree->first_child[cur] != CMARK_COMPACT_NONE) {
+      stack[depth++] = cur;
+      cur = tree->first_child[cur];
+      S_render_compact_node(cur, true, &state, options);
+      continue;
+    }
+    if (!leaf) {
+      S_render_compact_node(cur, false, &state, options);
+    }
+    // climb until a node with a next sibling, closing containers
+    while (depth > 0 && tree->next[cur] == CMARK_COMPACT_NONE) {
+      cur = stack[--depth];
+      S_render_compact_node(cur, false, &state, options);
+    }
+    if (depth == 0) {
+      break;
+    }
+    cur = tree->next[cur];
+    S_render_compact_node(cur, true, &state, options);
   }
-  result = (char *)cmark_strbuf_detach(&html);
 
-  cmark_iter_free(iter);
-  return result;
+  tree->mem->free(stack);
+  S_free_ids(&state.ids, tree->mem);
+  return (char *)cmark_strbuf_detach(&html);
 }
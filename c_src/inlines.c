@@ -22,10 +22,10 @@ static const char *LEFTSINGLEQUOTE = "\xE2\x80\x98";
 static const char *RIGHTSINGLEQUOTE = "\xE2\x80\x99";
 
 // Macros for creating various kinds of simple.
-#define make_linebreak(mem) make_simple(mem, CMARK_NODE_LINEBREAK)
-#define make_softbreak(mem) make_simple(mem, CMARK_NODE_SOFTBREAK)
-#define make_emph(mem) make_simple(mem, CMARK_NODE_EMPH)
-#define make_strong(mem) make_simple(mem, CMARK_NODE_STRONG)
+#define make_linebreak(subj) make_simple(subj, CMARK_NODE_LINEBREAK)
+#define make_softbreak(subj) make_simple(subj, CMARK_NODE_SOFTBREAK)
+#define make_emph(subj) make_simple(subj, CMARK_NODE_EMPH)
+#define make_strong(subj) make_simple(subj, CMARK_NODE_STRONG)
 
 #define MAXBACKTICKS 1000
 
@@ -51,16 +51,21 @@ typedef struct bracket {
 
 typedef struct {
   cmark_mem *mem;
+  cmark_node *document;
   cmark_chunk input;
   int line;
   bufsize_t pos;
   int block_offset;
-  int column_offset;
+  bufsize_t column_offset;
   cmark_reference_map *refmap;
   delimiter *last_delim;
   bracket *last_bracket;
   bufsize_t backticks[MAXBACKTICKS + 1];
   bool scanned_for_backticks;
+  // text node whose text is being collected in 'text_buf', for text
+  // merged into it that doesn't directly follow its own
+  cmark_node *text_run;
+  cmark_strbuf text_buf;
 } subject;
 
 static CMARK_INLINE bool S_is_line_end_char(char c) {
@@ -72,43 +77,45 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
 
 static int parse_inline(subject *subj, cmark_node *parent, int options);
 
-static void subject_from_buf(cmark_mem *mem, int line_number, int block_offset, subject *e,
+static void subject_from_buf(cmark_mem *mem, cmark_node *document,
+                             int line_number, int block_offset, subject *e,
                              cmark_chunk *chunk, cmark_reference_map *refmap);
 static bufsize_t subject_find_special_char(subject *subj, int options);
 
 // Create an inline with a literal string value.
 static CMARK_INLINE cmark_node *make_literal(subject *subj, cmark_node_type t,
-                                             int start_column, int end_column) {
-  cmark_node *e = (cmark_node *)subj->mem->calloc(1, sizeof(*e));
-  e->mem = subj->mem;
+                                             bufsize_t start_column,
+                                             bufsize_t end_column) {
+  cmark_node *e = cmark_node_alloc(subj->mem, subj->document);
   e->type = (uint16_t)t;
   e->start_line = e->end_line = subj->line;
   // columns are 1 based.
-  e->start_column = start_column + 1 + subj->column_offset + subj->block_offset;
-  e->end_column = end_column + 1 + subj->column_offset + subj->block_offset;
+  e->start_column =
+      (int)(start_column + 1 + subj->column_offset + subj->block_offset);
+  e->end_column =
+      (int)(end_column + 1 + subj->column_offset + subj->block_offset);
   return e;
 }
 
 // Create an inline with no value.
-static CMARK_INLINE cmark_node *make_simple(cmark_mem *mem, cmark_node_type t) {
-  cmark_node *e = (cmark_node *)mem->calloc(1, sizeof(*e));
-  e->mem = mem;
+static CMARK_INLINE cmark_node *make_simple(subject *subj, cmark_node_type t) {
+  cmark_node *e = cmark_node_alloc(subj->mem, subj->document);
   e->type = t;
   return e;
 }
 
-static cmark_node *make_str(subject *subj, int sc, int ec, cmark_chunk s) {
+// Text that doesn't need unescaping is borrowed from the subject (whose
+// buffer the document takes over) or from a string constant.
+static cmark_node *make_str(subject *subj, bufsize_t sc, bufsize_t ec,
+                            cmark_chunk s) {
   cmark_node *e = make_literal(subj, CMARK_NODE_TEXT, sc, ec);
-  e->data = (unsigned char *)subj->mem->realloc(NULL, s.len + 1);
-  if (s.data != NULL) {
-    memcpy(e->data, s.data, s.len);
-  }
-  e->data[s.len] = 0;
+  e->data = (unsigned char *)s.data;
   e->len = s.len;
+  e->flags |= CMARK_NODE__BORROWED_DATA;
   return e;
 }
 
-static cmark_node *make_str_from_buf(subject *subj, int sc, int ec,
+static cmark_node *make_str_from_buf(subject *subj, bufsize_t sc, bufsize_t ec,
                                      cmark_strbuf *buf) {
   cmark_node *e = make_literal(subj, CMARK_NODE_TEXT, sc, ec);
   e->len = buf->size;
@@ -116,9 +123,80 @@ static cmark_node *make_str_from_buf(subject *subj, int sc, int ec,
   return e;
 }
 
+// Hand the text collected for the current run over to its node.
+static void S_end_text_run(subject *subj) {
+  cmark_node *node = subj->text_run;
+
+  if (node != NULL) {
+    node->len = subj->text_buf.size;
+    node->data = cmark_strbuf_detach(&subj->text_buf);
+    subj->text_run = NULL;
+  }
+}
+
+// Append 'len' bytes of text at 'data' (borrowed or not), ending at
+// 'end_column', to the text node 'node'.  Text that directly follows the
+// borrowed text of the node just extends it; other text is collected
+// with the node's own in a run.
+static void S_append_text(subject *subj, cmark_node *node,
+                          const unsigned char *data, bufsize_t len,
+                          bool borrowed, bufsize_t end_column) {
+  node->end_column = (int)end_column;
+  if (node != subj->text_run) {
+    if (borrowed && (node->flags & CMARK_NODE__BORROWED_DATA) &&
+        node->data + node->len == data) {
+      node->len += len;
+      return;
+    }
+    S_end_text_run(subj);
+    cmark_strbuf_put(&subj->text_buf, node->data, node->len);
+    if (!(node->flags & CMARK_NODE__BORROWED_DATA)) {
+      subj->mem->free(node->data);
+    }
+    node->flags &= ~CMARK_NODE__BORROWED_DATA;
+    node->data = NULL;
+    node->len = 0;
+    subj->text_run = node;
+  }
+  cmark_strbuf_put(&subj->text_buf, data, len);
+}
+
+// Merge the text node 'from' into the text node 'into' before it, and
+// free it.
+static void S_merge_text(subject *subj, cmark_node *into, cmark_node *from) {
+  if (from == subj->text_run) {
+    S_end_text_run(subj);
+  }
+  S_append_text(subj, into, from->data, from->len,
+                (from->flags & CMARK_NODE__BORROWED_DATA) != 0,
+                from->end_column);
+  cmark_node_free(from);
+}
+
+static CMARK_INLINE bool S_is_free_text(cmark_node *node) {
+  return node != NULL && node->type == CMARK_NODE_TEXT &&
+         !(node->flags & CMARK_NODE__PINNED);
+}
+
+// Once no delimiter or bracket refers to the text node 'node' any more,
+// merge it with the text around it.
+static void S_unpin_text(subject *subj, cmark_node *node) {
+  cmark_node *prev = node->prev;
+
+  node->flags &= ~CMARK_NODE__PINNED;
+  if (S_is_free_text(prev)) {
+    S_merge_text(subj, prev, node);
+    node = prev;
+  }
+  if (S_is_free_text(node->next)) {
+    S_merge_text(subj, node, node->next);
+  }
+}
+
 // Like make_str, but parses entities.
 static cmark_node *make_str_with_entities(subject *subj,
-                                          int start_column, int end_column,
+                                          bufsize_t start_column,
+                                          bufsize_t end_column,
                                           cmark_chunk *content) {
   cmark_strbuf unescaped = CMARK_BUF_INIT(subj->mem);
 
@@ -155,22 +233,25 @@ static unsigned char *cmark_clean_autolink(cmark_mem *mem, cmark_chunk *url,
 }
 
 static CMARK_INLINE cmark_node *make_autolink(subject *subj,
-                                              int start_column, int end_column,
+                                              bufsize_t start_column,
+                                              bufsize_t end_column,
                                               cmark_chunk url, int is_email) {
-  cmark_node *link = make_simple(subj->mem, CMARK_NODE_LINK);
+  cmark_node *link = make_simple(subj, CMARK_NODE_LINK);
   link->as.link.url = cmark_clean_autolink(subj->mem, &url, is_email);
   link->as.link.title = NULL;
   link->start_line = link->end_line = subj->line;
-  link->start_column = start_column + 1;
-  link->end_column = end_column + 1;
+  link->start_column = (int)(start_column + 1);
+  link->end_column = (int)(end_column + 1);
   cmark_node_append_child(link, make_str_with_entities(subj, start_column + 1, end_column - 1, &url));
   return link;
 }
 
-static void subject_from_buf(cmark_mem *mem, int line_number, int block_offset, subject *e,
+static void subject_from_buf(cmark_mem *mem, cmark_node *document,
+                             int line_number, int block_offset, subject *e,
                              cmark_chunk *chunk, cmark_reference_map *refmap) {
   int i;
   e->mem = mem;
+  e->document = document;
   e->input = *chunk;
   e->line = line_number;
   e->pos = 0;
@@ -183,6 +264,8 @@ static void subject_from_buf(cmark_mem *mem, int line_number, int block_offset,
     e->backticks[i] = 0;
   }
   e->scanned_for_backticks = false;
+  e->text_run = NULL;
+  cmark_strbuf_init(mem, &e->text_buf, 0);
 }
 
 static CMARK_INLINE int isbacktick(int c) { return (c == '`'); }
@@ -245,9 +328,9 @@ static CMARK_INLINE cmark_chunk take_while(subject *subj, int (*f)(int)) {
 // Return the number of newlines in a given span of text in a subject.  If
 // the number is greater than zero, also return the number of characters
 // between the last newline and the end of the span in `since_newline`.
-static int count_newlines(subject *subj, bufsize_t from, bufsize_t len, int *since_newline) {
+static int count_newlines(subject *subj, bufsize_t from, bufsize_t len, bufsize_t *since_newline) {
   int nls = 0;
-  int since_nl = 0;
+  bufsize_t since_nl = 0;
 
   while (len--) {
     if (subj->input.data[from++] == '\n') {
@@ -268,17 +351,17 @@ static int count_newlines(subject *subj, bufsize_t from, bufsize_t len, int *sin
 // Adjust `node`'s `end_line`, `end_column`, and `subj`'s `line` and
 // `column_offset` according to the number of newlines in a just-matched span
 // of text in `subj`.
-static void adjust_subj_node_newlines(subject *subj, cmark_node *node, int matchlen, int extra, int options) {
+static void adjust_subj_node_newlines(subject *subj, cmark_node *node, bufsize_t matchlen, bufsize_t extra, int options) {
   if (!(options & CMARK_OPT_SOURCEPOS)) {
     return;
   }
 
-  int since_newline;
+  bufsize_t since_newline;
   int newlines = count_newlines(subj, subj->pos - matchlen - extra, matchlen, &since_newline);
   if (newlines) {
     subj->line += newlines;
     node->end_line += newlines;
-    node->end_column = since_newline;
+    node->end_column = (int)since_newline;
     subj->column_offset = -subj->pos + since_newline + extra;
   }
 }
@@ -394,9 +477,9 @@ static cmark_node *handle_backticks(subject *subj, int options) {
 
 // Scan ***, **, or * and return number scanned, or 0.
 // Advances position.
-static int scan_delims(subject *subj, unsigned char c, bool *can_open,
-                       bool *can_close) {
-  int numdelims = 0;
+static bufsize_t scan_delims(subject *subj, unsigned char c, bool *can_open,
+                             bool *can_close) {
+  bufsize_t numdelims = 0;
   bufsize_t before_char_pos;
   int32_t after_char = 0;
   int32_t before_char = 0;
@@ -473,6 +556,8 @@ static void print_delimiters(subject *subj)
 }
 */
 
+// Take 'delim' off the stack.  Its text, unless freed already (and the
+// pointer cleared), is left as plain text.
 static void remove_delimiter(subject *subj, delimiter *delim) {
   if (delim == NULL)
     return;
@@ -486,6 +571,9 @@ static void remove_delimiter(subject *subj, delimiter *delim) {
   if (delim->previous != NULL) {
     delim->previous->next = delim->next;
   }
+  if (delim->inl_text != NULL) {
+    S_unpin_text(subj, delim->inl_text);
+  }
   subj->mem->free(delim);
 }
 
@@ -495,6 +583,9 @@ static void pop_bracket(subject *subj) {
     return;
   b = subj->last_bracket;
   subj->last_bracket = subj->last_bracket->previous;
+  if (b->inl_text != NULL) {
+    S_unpin_text(subj, b->inl_text);
+  }
   subj->mem->free(b);
 }
 
@@ -506,6 +597,7 @@ static void push_delimiter(subject *subj, unsigned char c, bool can_open,
   delim->can_close = can_close;
   delim->inl_text = inl_text;
   delim->length = inl_text->len;
+  inl_text->flags |= CMARK_NODE__PINNED;
   delim->previous = subj->last_delim;
   delim->next = NULL;
   if (delim->previous != NULL) {
@@ -522,6 +614,7 @@ static void push_bracket(subject *subj, bool image, cmark_node *inl_text) {
   b->image = image;
   b->active = true;
   b->inl_text = inl_text;
+  inl_text->flags |= CMARK_NODE__PINNED;
   b->previous = subj->last_bracket;
   b->previous_delimiter = subj->last_delim;
   b->position = subj->pos;
@@ -558,7 +651,7 @@ static cmark_node *handle_delim(subject *subj, unsigned char c, bool smart) {
 
 // Assumes we have a hyphen at the current position.
 static cmark_node *handle_hyphen(subject *subj, bool smart) {
-  int startpos = subj->pos;
+  bufsize_t startpos = subj->pos;
 
   advance(subj);
 
@@ -570,10 +663,10 @@ static cmark_node *handle_hyphen(subject *subj, bool smart) {
     advance(subj);
   }
 
-  int numhyphens = subj->pos - startpos;
-  int en_count = 0;
-  int em_count = 0;
-  int i;
+  bufsize_t numhyphens = subj->pos - startpos;
+  bufsize_t en_count = 0;
+  bufsize_t em_count = 0;
+  bufsize_t i;
   cmark_strbuf buf = CMARK_BUF_INIT(subj->mem);
 
   if (numhyphens % 3 == 0) { // if divisible by 3, use all em dashes
@@ -722,9 +815,7 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
   opener_num_chars -= use_delims;
   closer_num_chars -= use_delims;
   opener_inl->len = opener_num_chars;
-  opener_inl->data[opener_num_chars] = 0;
   closer_inl->len = closer_num_chars;
-  closer_inl->data[closer_num_chars] = 0;
 
   // free delimiters between opener and closer
   delim = closer->previous;
@@ -736,15 +827,15 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
 
   // create new emph or strong, and splice it in to our inlines
   // between the opener and closer
-  emph = use_delims == 1 ? make_emph(subj->mem) : make_strong(subj->mem);
+  emph = use_delims == 1 ? make_emph(subj) : make_strong(subj);
 
   tmp = opener_inl->next;
+  cmark_node_insert_after(opener_inl, emph);
   while (tmp && tmp != closer_inl) {
     tmpnext = tmp->next;
     cmark_node_append_child(emph, tmp);
     tmp = tmpnext;
   }
-  cmark_node_insert_after(opener_inl, emph);
 
   emph->start_line = opener_inl->start_line;
   emph->end_line = closer_inl->end_line;
@@ -754,6 +845,7 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
   // if opener has 0 characters, remove it and its associated inline
   if (opener_num_chars == 0) {
     cmark_node_free(opener_inl);
+    opener->inl_text = NULL;
     remove_delimiter(subj, opener);
   }
 
@@ -761,6 +853,7 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
   if (closer_num_chars == 0) {
     // remove empty closer inline
     cmark_node_free(closer_inl);
+    closer->inl_text = NULL;
     // remove closer from list
     tmp_delim = closer->next;
     remove_delimiter(subj, closer);
@@ -779,7 +872,7 @@ static cmark_node *handle_backslash(subject *subj) {
     advance(subj);
     return make_str(subj, subj->pos - 2, subj->pos - 1, cmark_chunk_dup(&subj->input, subj->pos - 1, 1));
   } else if (!is_eof(subj) && skip_line_end(subj)) {
-    return make_linebreak(subj->mem);
+    return make_linebreak(subj);
   } else {
     return make_str(subj, subj->pos - 1, subj->pos - 1, cmark_chunk_literal("\\"));
   }
@@ -873,10 +966,9 @@ static cmark_node *handle_pointy_brace(subject *subj, int options) {
     subj->pos += matchlen;
     cmark_node *node = make_literal(subj, CMARK_NODE_HTML_INLINE,
                                     subj->pos - matchlen - 1, subj->pos - 1);
-    node->data = (unsigned char *)subj->mem->realloc(NULL, len + 1);
-    memcpy(node->data, src, len);
-    node->data[len] = 0;
+    node->data = (unsigned char *)src;
     node->len = len;
+    node->flags |= CMARK_NODE__BORROWED_DATA;
     adjust_subj_node_newlines(subj, node, matchlen, 1, options);
     return node;
   }
@@ -1110,12 +1202,12 @@ noMatch:
   return make_str(subj, subj->pos - 1, subj->pos - 1, cmark_chunk_literal("]"));
 
 match:
-  inl = make_simple(subj->mem, is_image ? CMARK_NODE_IMAGE : CMARK_NODE_LINK);
+  inl = make_simple(subj, is_image ? CMARK_NODE_IMAGE : CMARK_NODE_LINK);
   inl->as.link.url = url;
   inl->as.link.title = title;
   inl->start_line = inl->end_line = subj->line;
   inl->start_column = opener->inl_text->start_column;
-  inl->end_column = subj->pos + subj->column_offset + subj->block_offset;
+  inl->end_column = (int)(subj->pos + subj->column_offset + subj->block_offset);
   cmark_node_insert_before(opener->inl_text, inl);
   // Add link text:
   tmp = opener->inl_text->next;
@@ -1127,6 +1219,7 @@ match:
 
   // Free the bracket [:
   cmark_node_free(opener->inl_text);
+  opener->inl_text = NULL;
 
   process_emphasis(subj, opener->previous_delimiter);
   pop_bracket(subj);
@@ -1168,9 +1261,9 @@ static cmark_node *handle_newline(subject *subj) {
   skip_spaces(subj);
   if (nlpos > 1 && peek_at(subj, nlpos - 1) == ' ' &&
       peek_at(subj, nlpos - 2) == ' ') {
-    return make_linebreak(subj->mem);
+    return make_linebreak(subj);
   } else {
-    return make_softbreak(subj->mem);
+    return make_softbreak(subj);
   }
 }
 
@@ -1220,7 +1313,7 @@ static bufsize_t subject_find_special_char(subject *subj, int options) {
 // Parse an inline, advancing subject, and add it as a child of parent.
 // Return 0 if no inline can be parsed, 1 otherwise.
 static int parse_inline(subject *subj, cmark_node *parent, int options) {
-  cmark_node *new_inl = NULL;
+  cmark_node *new_inl = NULL, *last;
   cmark_chunk contents;
   unsigned char c;
   bufsize_t startpos, endpos;
@@ -1286,23 +1379,42 @@ static int parse_inline(subject *subj, cmark_node *parent, int options) {
       cmark_chunk_rtrim(&contents);
     }
 
+    // the most common case of text following text needs no new node
+    if (S_is_free_text(parent->last_child)) {
+      S_append_text(subj, parent->last_child, contents.data, contents.len,
+                    true,
+                    endpos + subj->column_offset + subj->block_offset);
+      return 1;
+    }
     new_inl = make_str(subj, startpos, endpos - 1, contents);
   }
   if (new_inl != NULL) {
-    cmark_node_append_child(parent, new_inl);
+    // Adjacent text is merged as it is parsed; text a delimiter or bracket
+    // refers to is merged once it is left as plain text.
+    last = parent->last_child;
+    if (S_is_free_text(new_inl) && S_is_free_text(last)) {
+      S_merge_text(subj, last, new_inl);
+    } else {
+      cmark_node_append_child(parent, new_inl);
+    }
   }
 
   return 1;
 }
 
 // Parse inlines from parent's string_content, adding as children of parent.
-void cmark_parse_inlines(cmark_mem *mem, cmark_node *parent,
-                         cmark_reference_map *refmap, int options) {
+void cmark_parse_inlines(cmark_mem *mem, cmark_node *document,
+                         cmark_node *parent, cmark_reference_map *refmap,
+                         int options) {
   subject subj;
-  cmark_chunk content = {parent->data, parent->len};
-  subject_from_buf(mem, parent->start_line, parent->start_column - 1 + parent->internal_offset, &subj, &content, refmap);
+  unsigned char *data = parent->data;
+  cmark_chunk content = {data, parent->len};
+  subject_from_buf(mem, document, parent->start_line, parent->start_column - 1 + parent->internal_offset, &subj, &content, refmap);
   cmark_chunk_rtrim(&subj.input);
 
+  // The block's inlines are no longer pending while they are added to it,
+  // so that adding them doesn't start parsing them again.
+  parent->data = NULL;
   while (!is_eof(&subj) && parse_inline(&subj, parent, options))
     ;
 
@@ -1314,6 +1426,9 @@ void cmark_parse_inlines(cmark_mem *mem, cmark_node *parent,
   while (subj.last_bracket) {
     pop_bracket(&subj);
   }
+  S_end_text_run(&subj);
+  cmark_strbuf_free(&subj.text_buf);
+  parent->data = data;
 }
 
 // Parse zero or more space characters, including at most one newline.
@@ -1339,7 +1454,7 @@ bufsize_t cmark_parse_reference_inline(cmark_mem *mem, cmark_chunk *input,
   bufsize_t matchlen = 0;
   bufsize_t beforetitle;
 
-  subject_from_buf(mem, -1, 0, &subj, input, NULL);
+  subject_from_buf(mem, NULL, -1, 0, &subj, input, NULL);
 
   // parse label:
   if (!link_label(&subj, &lab) || lab.len == 0)
@@ -11,8 +11,9 @@ extern "C" {
 unsigned char *cmark_clean_url(cmark_mem *mem, cmark_chunk *url);
 unsigned char *cmark_clean_title(cmark_mem *mem, cmark_chunk *title);
 
-void cmark_parse_inlines(cmark_mem *mem, cmark_node *parent,
-                         cmark_reference_map *refmap, int options);
+void cmark_parse_inlines(cmark_mem *mem, cmark_node *document,
+                         cmark_node *parent, cmark_reference_map *refmap,
+                         int options);
 
 bufsize_t cmark_parse_reference_inline(cmark_mem *mem, cmark_chunk *input,
                                        cmark_reference_map *refmap);
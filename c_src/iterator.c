@@ -6,70 +6,25 @@
 #include "cmark.h"
 #include "iterator.h"
 
-static const int S_leaf_mask =
-    (1 << CMARK_NODE_HTML_BLOCK) | (1 << CMARK_NODE_THEMATIC_BREAK) |
-    (1 << CMARK_NODE_CODE_BLOCK) | (1 << CMARK_NODE_TEXT) |
-    (1 << CMARK_NODE_SOFTBREAK) | (1 << CMARK_NODE_LINEBREAK) |
-    (1 << CMARK_NODE_CODE) | (1 << CMARK_NODE_HTML_INLINE);
-
 cmark_iter *cmark_iter_new(cmark_node *root) {
   if (root == NULL) {
     return NULL;
   }
   cmark_mem *mem = root->mem;
   cmark_iter *iter = (cmark_iter *)mem->calloc(1, sizeof(cmark_iter));
-  iter->mem = mem;
-  iter->root = root;
-  iter->cur.ev_type = CMARK_EVENT_NONE;
-  iter->cur.node = NULL;
-  iter->next.ev_type = CMARK_EVENT_ENTER;
-  iter->next.node = root;
+  cmark_iter_init(iter, root);
   return iter;
 }
 
 void cmark_iter_free(cmark_iter *iter) { iter->mem->free(iter); }
 
-static bool S_is_leaf(cmark_node *node) {
-  return ((1 << node->type) & S_leaf_mask) != 0;
-}
-
 cmark_event_type cmark_iter_next(cmark_iter *iter) {
-  cmark_event_type ev_type = iter->next.ev_type;
-  cmark_node *node = iter->next.node;
-
-  iter->cur.ev_type = ev_type;
-  iter->cur.node = node;
-
-  if (ev_type == CMARK_EVENT_DONE) {
-    return ev_type;
+  // the inlines of a block left pending are parsed before entering it
+  if (iter->next.ev_type == CMARK_EVENT_ENTER &&
+      cmark_node_inlines_pending(iter->next.node)) {
+    cmark_node_parse_pending_inlines(iter->next.node);
   }
-
-  /* roll forward to next item, setting both fields */
-  if (ev_type == CMARK_EVENT_ENTER && !S_is_leaf(node)) {
-    if (node->first_child == NULL) {
-      /* stay on this node but exit */
-      iter->next.ev_type = CMARK_EVENT_EXIT;
-    } else {
-      iter->next.ev_type = CMARK_EVENT_ENTER;
-      iter->next.node = node->first_child;
-    }
-  } else if (node == iter->root) {
-    /* don't move past root */
-    iter->next.ev_type = CMARK_EVENT_DONE;
-    iter->next.node = NULL;
-  } else if (node->next) {
-    iter->next.ev_type = CMARK_EVENT_ENTER;
-    iter->next.node = node->next;
-  } else if (node->parent) {
-    iter->next.ev_type = CMARK_EVENT_EXIT;
-    iter->next.node = node->parent;
-  } else {
-    assert(false);
-    iter->next.ev_type = CMARK_EVENT_DONE;
-    iter->next.node = NULL;
-  }
-
-  return ev_type;
+  return cmark_iter_step(iter);
 }
 
 void cmark_iter_reset(cmark_iter *iter, cmark_node *current,
@@ -91,32 +46,47 @@ void cmark_consolidate_text_nodes(cmark_node *root) {
   if (root == NULL) {
     return;
   }
-  cmark_iter *iter = cmark_iter_new(root);
-  cmark_strbuf buf = CMARK_BUF_INIT(iter->mem);
+  cmark_iter iter;
+  cmark_strbuf buf = CMARK_BUF_INIT(root->mem);
   cmark_event_type ev_type;
   cmark_node *cur, *tmp, *next;
+  bool copied;
 
-  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
-    cur = cmark_iter_get_node(iter);
+  cmark_iter_init(&iter, root);
+  while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+    cur = iter.cur.node;
     if (ev_type == CMARK_EVENT_ENTER && cur->type == CMARK_NODE_TEXT &&
         cur->next && cur->next->type == CMARK_NODE_TEXT) {
       cmark_strbuf_clear(&buf);
-      cmark_strbuf_put(&buf, cur->data, cur->len);
+      copied = false;
       tmp = cur->next;
       while (tmp && tmp->type == CMARK_NODE_TEXT) {
-        cmark_iter_next(iter); // advance pointer
-        cmark_strbuf_put(&buf, tmp->data, tmp->len);
+        cmark_iter_step(&iter); // advance pointer
+        if (!copied && (cur->flags & tmp->flags & CMARK_NODE__BORROWED_DATA) &&
+            cur->data + cur->len == tmp->data) {
+          // adjacent in the same buffer: extend the borrowed span
+          cur->len += tmp->len;
+        } else {
+          if (!copied) {
+            cmark_strbuf_put(&buf, cur->data, cur->len);
+            copied = true;
+          }
+          cmark_strbuf_put(&buf, tmp->data, tmp->len);
+        }
         cur->end_column = tmp->end_column;
         next = tmp->next;
         cmark_node_free(tmp);
         tmp = next;
       }
-      iter->mem->free(cur->data);
-      cur->len = buf.size;
-      cur->data = cmark_strbuf_detach(&buf);
+      if (copied) {
+        if (!(cur->flags & CMARK_NODE__BORROWED_DATA))
+          root->mem->free(cur->data);
+        cur->flags &= ~CMARK_NODE__BORROWED_DATA;
+        cur->len = buf.size;
+        cur->data = cmark_strbuf_detach(&buf);
+      }
     }
   }
 
   cmark_strbuf_free(&buf);
-  cmark_iter_free(iter);
 }
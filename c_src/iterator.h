@@ -5,7 +5,11 @@
 extern "C" {
 #endif
 
+#include <assert.h>
+
+#include "config.h"
 #include "cmark.h"
+#include "node.h"
 
 typedef struct {
   cmark_event_type ev_type;
@@ -19,6 +23,64 @@ struct cmark_iter {
   cmark_iter_state next;
 };
 
+// Nodes that are only entered, never exited.
+#define CMARK_ITER_LEAF_MASK                                                   \
+  ((1 << CMARK_NODE_HTML_BLOCK) | (1 << CMARK_NODE_THEMATIC_BREAK) |           \
+   (1 << CMARK_NODE_CODE_BLOCK) | (1 << CMARK_NODE_TEXT) |                     \
+   (1 << CMARK_NODE_SOFTBREAK) | (1 << CMARK_NODE_LINEBREAK) |                 \
+   (1 << CMARK_NODE_CODE) | (1 << CMARK_NODE_HTML_INLINE))
+
+// Internal walks keep their iterator on the stack: cmark_iter_init and
+// cmark_iter_step are the allocation-free, inlined counterparts of
+// cmark_iter_new and cmark_iter_next.
+static CMARK_INLINE void cmark_iter_init(cmark_iter *iter, cmark_node *root) {
+  iter->mem = root->mem;
+  iter->root = root;
+  iter->cur.ev_type = CMARK_EVENT_NONE;
+  iter->cur.node = NULL;
+  iter->next.ev_type = CMARK_EVENT_ENTER;
+  iter->next.node = root;
+}
+
+static CMARK_INLINE cmark_event_type cmark_iter_step(cmark_iter *iter) {
+  cmark_event_type ev_type = iter->next.ev_type;
+  cmark_node *node = iter->next.node;
+
+  iter->cur = iter->next;
+
+  if (ev_type == CMARK_EVENT_DONE) {
+    return ev_type;
+  }
+
+  /* roll forward to next item, setting both fields; leaves, the bulk of
+     most trees, go straight to their successor */
+  if (ev_type == CMARK_EVENT_ENTER &&
+      !((1 << node->type) & CMARK_ITER_LEAF_MASK)) {
+    if (node->first_child == NULL) {
+      /* stay on this node but exit */
+      iter->next.ev_type = CMARK_EVENT_EXIT;
+    } else {
+      iter->next.node = node->first_child;
+    }
+  } else if (node == iter->root) {
+    /* don't move past root */
+    iter->next.ev_type = CMARK_EVENT_DONE;
+    iter->next.node = NULL;
+  } else if (node->next) {
+    iter->next.ev_type = CMARK_EVENT_ENTER;
+    iter->next.node = node->next;
+  } else if (node->parent) {
+    iter->next.ev_type = CMARK_EVENT_EXIT;
+    iter->next.node = node->parent;
+  } else {
+    assert(false);
+    iter->next.ev_type = CMARK_EVENT_DONE;
+    iter->next.node = NULL;
+  }
+
+  return ev_type;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,8 +11,13 @@
 #include "scanners.h"
 #include "render.h"
 
-#define OUT(s, wrap, escaping) renderer->out(renderer, s, wrap, escaping)
-#define LIT(s) renderer->out(renderer, s, false, LITERAL)
+#define OUT(s, wrap, escaping)                                                 \
+  renderer->out(renderer, s, (bufsize_t)strlen(s), wrap, escaping)
+#define LIT(s) OUT(s, false, LITERAL)
+// the literal of 'node', which needn't be NUL-terminated
+#define OUT_LITERAL(node, wrap, escaping)                                      \
+  renderer->out(renderer, (const char *)(node)->data, (node)->len, wrap,       \
+                escaping)
 #define CR() renderer->cr(renderer)
 #define BLANKLINE() renderer->blankline(renderer)
 #define LIST_NUMBER_STRING_SIZE 20
@@ -318,7 +323,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     CR();
     LIT("\\begin{verbatim}");
     CR();
-    OUT(cmark_node_get_literal(node), false, LITERAL);
+    OUT_LITERAL(node, false, LITERAL);
     CR();
     LIT("\\end{verbatim}");
     BLANKLINE();
@@ -347,7 +352,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_TEXT:
-    OUT(cmark_node_get_literal(node), allow_wrap, NORMAL);
+    OUT_LITERAL(node, allow_wrap, NORMAL);
     break;
 
   case CMARK_NODE_LINEBREAK:
@@ -368,7 +373,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
 
   case CMARK_NODE_CODE:
     LIT("\\texttt{");
-    OUT(cmark_node_get_literal(node), false, NORMAL);
+    OUT_LITERAL(node, false, NORMAL);
     LIT("}");
     break;
 
@@ -448,6 +453,29 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
   return 1;
 }
 
+// The bytes outc outputs as they are whatever surrounds them: all but the
+// ASCII characters it escapes, some of them ('$', '_' and '~') only in
+// NORMAL, '-' (to keep "--" apart) and the first bytes of the characters
+// it replaces, U+00A0 (0xC2) and the quotes, dashes and ellipsis
+// (0xE2).
+#define ESCAPED(b)                                                             \
+  ((b) == '{' || (b) == '}' || (b) == '#' || (b) == '%' || (b) == '&' ||       \
+   (b) == '-' || (b) == '^' || (b) == '\\' || (b) == '|' || (b) == '<' ||      \
+   (b) == '>' || (b) == '[' || (b) == ']' || (b) == '"' || (b) == '\'' ||      \
+   (b) == 0xC2 || (b) == 0xE2)
+#define NORMAL_ESCAPED(b) ((b) == '$' || (b) == '_' || (b) == '~')
+#define PLAIN(b)                                                               \
+  CMARK_PLAIN_BITS(!ESCAPED(b) && !NORMAL_ESCAPED(b), !ESCAPED(b),             \
+                   !ESCAPED(b))
+
+static const unsigned char PLAIN_CHARS[256] = CMARK_PLAIN_CHARS(PLAIN);
+
 char *cmark_render_latex(cmark_node *root, int options, int width) {
-  return cmark_render(root, options, width, outc, S_render_node);
+  return cmark_render(root, options, width, outc, PLAIN_CHARS, S_render_node);
+}
+
+int cmark_render_latex_to_sink(cmark_node *root, int options, int width,
+                               cmark_sink *sink) {
+  return cmark_render_to_sink(root, options, width, outc, PLAIN_CHARS,
+                              S_render_node, sink);
 }
@@ -0,0 +1,375 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "cmark.h"
+#include "node.h"
+#include "parser.h"
+#include "references.h"
+#include "buffer.h"
+
+// Once blocks edited away account for more source than this and than the
+// document itself, the document is parsed anew to release their memory.
+#define LIVE_MIN_GARBAGE (1024 * 1024)
+
+struct cmark_live_document {
+  cmark_mem *mem;
+  int options;
+  cmark_strbuf source;
+  // offsets of the starts of the lines of 'source', followed by its size
+  bufsize_t *lines;
+  int nlines;
+  cmark_node *root;
+  // the link reference definitions of the document
+  cmark_reference_map *refmap;
+  // upper bound on the reference expansion in the tree, and the size of
+  // the largest definition
+  unsigned int ref_size;
+  unsigned int max_ref;
+  // bytes of source of blocks edited away, which 'root' may still hold
+  size_t garbage;
+};
+
+static bool S_is_line_end(const unsigned char *data, bufsize_t len,
+                          bufsize_t i) {
+  return data[i] == '\n' ||
+         (data[i] == '\r' && (i + 1 == len || data[i + 1] != '\n'));
+}
+
+// Append the starts of the lines in data[from, to) to 'lines', which has
+// room for them; 'from' is the start of a line.  Lines end at LF, CR LF
+// or a lone CR, as in the parser.
+static int S_index_lines(const unsigned char *data, bufsize_t len,
+                         bufsize_t from, bufsize_t to, bufsize_t *lines) {
+  int n = 0;
+  bufsize_t i;
+
+  if (from < to) {
+    lines[n++] = from;
+  }
+  for (i = from; i < to; i++) {
+    if (S_is_line_end(data, len, i) && i + 1 < to) {
+      lines[n++] = i + 1;
+    }
+  }
+  return n;
+}
+
+static int S_count_lines(const unsigned char *data, bufsize_t len,
+                         bufsize_t from, bufsize_t to) {
+  int n = from < to ? 1 : 0;
+  bufsize_t i;
+
+  for (i = from; i < to; i++) {
+    if (S_is_line_end(data, len, i) && i + 1 < to) {
+      n++;
+    }
+  }
+  return n;
+}
+
+// The line (counting from 1) that the byte at 'offset' belongs to.
+static int S_line_of(cmark_live_document *doc, bufsize_t offset) {
+  int lo = 0, hi = doc->nlines - 1, mid;
+
+  if (doc->nlines == 0) {
+    return 1;
+  }
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (doc->lines[mid] <= offset) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo + 1;
+}
+
+static bool S_contains_definition_marker(const unsigned char *data,
+                                         bufsize_t from, bufsize_t to) {
+  const unsigned char *p = data + from, *end = data + to;
+
+  while (p < end &&
+         (p = (const unsigned char *)memchr(p, ']', end - p)) != NULL) {
+    if (p + 1 < end && p[1] == ':') {
+      return true;
+    }
+    p++;
+  }
+  return false;
+}
+
+static void S_parse_all(cmark_live_document *doc) {
+  cmark_parser *parser = cmark_parser_new_with_mem(doc->options, doc->mem);
+  unsigned int i;
+
+  if (doc->root != NULL) {
+    cmark_node_free(doc->root);
+    cmark_reference_map_free(doc->refmap);
+  }
+
+  doc->root = cmark_parser_parse_document(
+      parser, (const char *)doc->source.ptr, doc->source.size);
+  doc->refmap = parser->refmap;
+  parser->refmap = NULL;
+  cmark_parser_free(parser);
+
+  doc->ref_size = doc->refmap->ref_size;
+  doc->max_ref = 0;
+  for (i = 0; i < doc->refmap->capacity; i++) {
+    if (doc->refmap->table[i] && doc->refmap->table[i]->size > doc->max_ref) {
+      doc->max_ref = doc->refmap->table[i]->size;
+    }
+  }
+  doc->garbage = 0;
+}
+
+static size_t S_count_children(cmark_node *node) {
+  size_t n = 0;
+  cmark_node *child;
+
+  for (child = node->first_child; child != NULL; child = child->next) {
+    n++;
+  }
+  return n;
+}
+
+// Move the source positions of 'node' and its descendants 'delta' lines,
+// leaving alone the nodes that have none.
+static void S_shift_lines(cmark_node *node, int delta) {
+  cmark_node *cur = node;
+
+  while (cur != NULL) {
+    if (cur->start_line != 0) {
+      cur->start_line += delta;
+    }
+    if (cur->end_line != 0) {
+      cur->end_line += delta;
+    }
+    if (cur->first_child) {
+      cur = cur->first_child;
+      continue;
+    }
+    while (cur != node && cur->next == NULL) {
+      cur = cur->parent;
+    }
+    cur = cur == node ? NULL : cur->next;
+  }
+}
+
+cmark_live_document *cmark_live_document_new(const char *buffer, size_t len,
+                                             int options) {
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  cmark_live_document *doc;
+
+  if (len > (size_t)(BUFSIZE_MAX / 2)) {
+    return NULL;
+  }
+
+  doc = (cmark_live_document *)mem->calloc(1, sizeof(*doc));
+  doc->mem = mem;
+  // the definitions are kept apart from the tree, which rules out lazy
+  // inlines
+  doc->options = options & ~CMARK_OPT_LAZY_INLINES;
+  cmark_strbuf_init(mem, &doc->source, 0);
+  cmark_strbuf_set(&doc->source, (const unsigned char *)buffer,
+                   (bufsize_t)len);
+
+  doc->nlines = S_count_lines(doc->source.ptr, doc->source.size, 0,
+                              doc->source.size);
+  doc->lines = (bufsize_t *)mem->calloc(doc->nlines + 1, sizeof(bufsize_t));
+  S_index_lines(doc->source.ptr, doc->source.size, 0, doc->source.size,
+                doc->lines);
+  doc->lines[doc->nlines] = doc->source.size;
+
+  S_parse_all(doc);
+  return doc;
+}
+
+void cmark_live_document_free(cmark_live_document *doc) {
+  if (doc == NULL) {
+    return;
+  }
+  cmark_node_free(doc->root);
+  cmark_reference_map_free(doc->refmap);
+  cmark_strbuf_free(&doc->source);
+  doc->mem->free(doc->lines);
+  doc->mem->free(doc);
+}
+
+cmark_node *cmark_live_document_root(cmark_live_document *doc) {
+  return doc->root;
+}
+
+const char *cmark_live_document_source(cmark_live_document *doc,
+                                       size_t *len) {
+  *len = (size_t)doc->source.size;
+  return (const char *)doc->source.ptr;
+}
+
+int cmark_live_document_edit(cmark_live_document *doc, size_t offset,
+                             size_t length, const char *text, size_t text_len,
+                             size_t *index, size_t *removed, size_t *added) {
+  cmark_mem *mem = doc->mem;
+  bufsize_t old_len = doc->source.size, new_len, end, delta_bytes;
+  bufsize_t region_start, region_end, old_region_end, pos;
+  bufsize_t *lines;
+  cmark_strbuf source = CMARK_BUF_INIT(mem);
+  cmark_parser *parser = NULL;
+  cmark_node *first, *last, *stop, *cur, *next, *region_root;
+  int first_line, last_line, nlines, delta_lines, n;
+  unsigned int max_ref_size, usage;
+  bool reparse;
+
+  if (offset > (size_t)old_len || length > (size_t)old_len - offset ||
+      text_len > (size_t)(BUFSIZE_MAX / 2) - (old_len - length)) {
+    return 0;
+  }
+  end = (bufsize_t)(offset + length);
+  delta_bytes = (bufsize_t)text_len - (bufsize_t)length;
+  new_len = old_len + delta_bytes;
+
+  // The lines the edit touches, starting one early in case it joins a CR
+  // at the end of the previous line with an LF.
+  first_line = S_line_of(doc, offset > 0 ? (bufsize_t)offset - 1 : 0);
+  last_line = S_line_of(doc, end);
+
+  // Re-parse from the start of the last top-level block that begins
+  // before the edit: the blocks before it are closed by its first line
+  // no matter what follows.
+  first = NULL;
+  for (cur = doc->root->first_child;
+       cur != NULL && cur->start_line < first_line; cur = cur->next) {
+    first = cur;
+  }
+  region_start = first ? doc->lines[first->start_line - 1] : 0;
+
+  // Definitions may change how links anywhere in the document resolve.
+  reparse = doc->garbage > LIVE_MIN_GARBAGE &&
+            doc->garbage > (size_t)old_len;
+  reparse = reparse || S_contains_definition_marker(
+                           doc->source.ptr, offset > 0 ? offset - 1 : 0,
+                           end < old_len ? end + 1 : end);
+
+  cmark_strbuf_put(&source, doc->source.ptr, (bufsize_t)offset);
+  cmark_strbuf_put(&source, (const unsigned char *)text, (bufsize_t)text_len);
+  cmark_strbuf_put(&source, doc->source.ptr + end, old_len - end);
+
+  // Lines before the edit keep their offsets; those after it move.
+  region_end = last_line < doc->nlines ? doc->lines[last_line] + delta_bytes
+                                       : new_len;
+  n = S_count_lines(source.ptr, new_len, doc->lines[first_line - 1],
+                    region_end);
+  nlines = (first_line - 1) + n +
+           (last_line < doc->nlines ? doc->nlines - last_line : 0);
+  lines = (bufsize_t *)mem->calloc(nlines + 1, sizeof(bufsize_t));
+  memcpy(lines, doc->lines, (first_line - 1) * sizeof(bufsize_t));
+  S_index_lines(source.ptr, new_len, doc->lines[first_line - 1], region_end,
+                lines + first_line - 1);
+  for (n = last_line; n < doc->nlines; n++) {
+    lines[n + nlines - doc->nlines] = doc->lines[n] + delta_bytes;
+  }
+  lines[nlines] = new_len;
+  delta_lines = nlines - doc->nlines;
+
+  cmark_strbuf_swap(&doc->source, &source);
+  cmark_strbuf_free(&source);
+  mem->free(doc->lines);
+  doc->lines = lines;
+  doc->nlines = nlines;
+
+  if (!reparse) {
+    parser = cmark_parser_new_with_mem(doc->options, mem);
+    cmark_parser_set_reference_dictionary(parser, doc->refmap);
+    parser->line_number = first ? first->start_line - 1 : 0;
+
+    // Parse up to the first top-level block after the edit that the
+    // re-parsed blocks end in front of; it and the blocks after it stay.
+    pos = region_start;
+    stop = first ? first : doc->root->first_child;
+    while (stop != NULL && stop->start_line <= last_line) {
+      stop = stop->next;
+    }
+    for (; stop != NULL; stop = stop->next) {
+      region_end = doc->lines[stop->start_line + delta_lines - 1];
+      if (!cmark_parser_can_split_before(doc->source.ptr[region_end])) {
+        continue;
+      }
+      cmark_parser_feed(parser, (const char *)doc->source.ptr + pos,
+                        region_end - pos);
+      pos = region_end;
+      if (cmark_parser_open_blocks_close_at_split(parser)) {
+        break;
+      }
+    }
+    if (stop == NULL) {
+      region_end = new_len;
+      cmark_parser_feed(parser, (const char *)doc->source.ptr + pos,
+                        region_end - pos);
+    }
+
+    parser->total_size = (size_t)new_len;
+    region_root = cmark_parser_finish(parser);
+
+    // The limit on reference expansion applies to the whole document.
+    max_ref_size = cmark_reference_limit((size_t)new_len);
+    usage = parser->refmap->ref_size;
+    reparse = S_contains_definition_marker(doc->source.ptr, region_start,
+                                           region_end) ||
+              doc->ref_size + usage + doc->max_ref > max_ref_size;
+    if (reparse) {
+      cmark_node_free(region_root);
+    } else {
+      doc->ref_size += usage;
+    }
+  }
+
+  if (reparse) {
+    if (parser != NULL) {
+      cmark_parser_free(parser);
+    }
+    *index = 0;
+    *removed = S_count_children(doc->root);
+    S_parse_all(doc);
+    *added = S_count_children(doc->root);
+    return 1;
+  }
+  cmark_parser_free(parser);
+
+  // Replace the blocks from 'first' up to 'stop'.
+  *index = 0;
+  if (first == NULL) {
+    first = doc->root->first_child;
+  }
+  for (cur = first ? first->prev : NULL; cur != NULL; cur = cur->prev) {
+    (*index)++;
+  }
+  last = first ? first->prev : NULL;
+  old_region_end = stop ? doc->lines[stop->start_line + delta_lines - 1] -
+                              delta_bytes
+                        : old_len;
+  doc->garbage += (size_t)(old_region_end - region_start);
+
+  *removed = 0;
+  for (cur = first; cur != stop; cur = next) {
+    next = cur->next;
+    cmark_node_free(cur);
+    (*removed)++;
+  }
+  if (delta_lines != 0) {
+    for (cur = stop; cur != NULL; cur = cur->next) {
+      S_shift_lines(cur, delta_lines);
+    }
+  }
+
+  *added = S_count_children(region_root);
+  if (stop != NULL) {
+    doc->root->end_line += delta_lines;
+  } else {
+    doc->root->end_line = region_root->end_line;
+    doc->root->end_column = region_root->end_column;
+  }
+  cmark_document_merge(doc->root, last, region_root);
+  return 1;
+}
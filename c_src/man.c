@@ -10,8 +10,13 @@
 #include "utf8.h"
 #include "render.h"
 
-#define OUT(s, wrap, escaping) renderer->out(renderer, s, wrap, escaping)
-#define LIT(s) renderer->out(renderer, s, false, LITERAL)
+#define OUT(s, wrap, escaping)                                                 \
+  renderer->out(renderer, s, (bufsize_t)strlen(s), wrap, escaping)
+#define LIT(s) OUT(s, false, LITERAL)
+// the literal of 'node', which needn't be NUL-terminated
+#define OUT_LITERAL(node, wrap, escaping)                                      \
+  renderer->out(renderer, (const char *)(node)->data, (node)->len, wrap,       \
+                escaping)
 #define CR() renderer->cr(renderer)
 #define BLANKLINE() renderer->blankline(renderer)
 #define LIST_NUMBER_SIZE 20
@@ -135,7 +140,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
   case CMARK_NODE_CODE_BLOCK:
     CR();
     LIT(".IP\n.nf\n\\f[C]\n");
-    OUT(cmark_node_get_literal(node), false, NORMAL);
+    OUT_LITERAL(node, false, NORMAL);
     CR();
     LIT("\\f[]\n.fi");
     CR();
@@ -174,7 +179,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_TEXT:
-    OUT(cmark_node_get_literal(node), allow_wrap, NORMAL);
+    OUT_LITERAL(node, allow_wrap, NORMAL);
     break;
 
   case CMARK_NODE_LINEBREAK:
@@ -195,7 +200,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
 
   case CMARK_NODE_CODE:
     LIT("\\f[C]");
-    OUT(cmark_node_get_literal(node), allow_wrap, NORMAL);
+    OUT_LITERAL(node, allow_wrap, NORMAL);
     LIT("\\f[]");
     break;
 
@@ -247,6 +252,21 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
   return 1;
 }
 
+// The bytes S_outc outputs as they are whatever surrounds them: all but
+// '.' and '\'' (escaped at the start of a line), '-', '\\' and the first
+// byte of the quotes and dashes it replaces (0xE2).
+#define ESCAPED(b)                                                             \
+  ((b) == '.' || (b) == '\'' || (b) == '-' || (b) == '\\' || (b) == 0xE2)
+#define PLAIN(b) CMARK_PLAIN_BITS(!ESCAPED(b), !ESCAPED(b), !ESCAPED(b))
+
+static const unsigned char PLAIN_CHARS[256] = CMARK_PLAIN_CHARS(PLAIN);
+
 char *cmark_render_man(cmark_node *root, int options, int width) {
-  return cmark_render(root, options, width, S_outc, S_render_node);
+  return cmark_render(root, options, width, S_outc, PLAIN_CHARS, S_render_node);
+}
+
+int cmark_render_man_to_sink(cmark_node *root, int options, int width,
+                             cmark_sink *sink) {
+  return cmark_render_to_sink(root, options, width, S_outc, PLAIN_CHARS,
+                              S_render_node, sink);
 }
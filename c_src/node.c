@@ -1,11 +1,32 @@
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "config.h"
 #include "node.h"
+#include "references.h"
 
 static void S_node_unlink(cmark_node *node);
 
+// Nodes of parsed documents are carved from slabs owned by the document
+// node.  A slab is freed once the document and all of its nodes are gone,
+// so nodes unlinked from a document may outlive it.  As long as the tree
+// consists of exactly the live nodes of its slabs, the document is torn
+// down by sweeping the slabs instead of walking the tree.
+#define NODE_SLAB_MIN 16
+#define NODE_SLAB_MAX 1024
+
+struct cmark_node_slab {
+  cmark_node_slab *next;
+  // the owning document, or NULL once it is freed
+  cmark_node *document;
+  // live nodes, plus one while the document holds the slab
+  bufsize_t refs;
+  bufsize_t used;
+  bufsize_t capacity;
+  cmark_node nodes[];
+};
+
 static CMARK_INLINE bool S_is_block(cmark_node *node) {
   if (node == NULL) {
     return false;
@@ -70,9 +91,124 @@ static bool S_can_contain(cmark_node *node, cmark_node *child) {
   return false;
 }
 
-cmark_node *cmark_node_new_with_mem(cmark_node_type type, cmark_mem *mem) {
-  cmark_node *node = (cmark_node *)mem->calloc(1, sizeof(*node));
+// Kept out of line so that it doesn't grow every node.
+static cmark_document *S_document(cmark_node *document) {
+  if (document->as.document == NULL) {
+    document->as.document =
+        (cmark_document *)document->mem->calloc(1, sizeof(cmark_document));
+  }
+  return document->as.document;
+}
+
+cmark_node *cmark_node_alloc(cmark_mem *mem, cmark_node *document) {
+  cmark_document *doc;
+  cmark_node_slab *slab;
+  cmark_node *node;
+
+  if (document == NULL) {
+    node = (cmark_node *)mem->calloc(1, sizeof(*node));
+    node->mem = mem;
+    return node;
+  }
+
+  doc = S_document(document);
+  slab = doc->slabs;
+  if (slab == NULL || slab->used == slab->capacity) {
+    bufsize_t capacity = slab == NULL ? NODE_SLAB_MIN
+                         : slab->capacity < NODE_SLAB_MAX ? slab->capacity * 2
+                                                          : NODE_SLAB_MAX;
+    slab = (cmark_node_slab *)mem->calloc(
+        1, sizeof(*slab) + capacity * sizeof(cmark_node));
+    slab->next = doc->slabs;
+    slab->document = doc->owner ? doc->owner : document;
+    slab->refs = 1;
+    slab->capacity = capacity;
+    doc->slabs = slab;
+  }
+
+  node = &slab->nodes[slab->used++];
+  slab->refs++;
   node->mem = mem;
+  node->slab_index = (uint16_t)slab->used;
+  return node;
+}
+
+static void S_slab_release(cmark_mem *mem, cmark_node_slab *slab) {
+  if (--slab->refs == 0) {
+    mem->free(slab);
+  }
+}
+
+static cmark_node_slab *S_slab(cmark_node *node) {
+  return (cmark_node_slab *)((char *)(node - (node->slab_index - 1)) -
+                             offsetof(cmark_node_slab, nodes));
+}
+
+static void S_node_release(cmark_node *node) {
+  if (node->slab_index == 0) {
+    node->mem->free(node);
+    return;
+  }
+
+  // mark the slot as free for the sweep in S_free_document
+  node->type = CMARK_NODE_NONE;
+  S_slab_release(node->mem, S_slab(node));
+}
+
+// The document whose slabs 'node' comes from, or 'node' itself if it is
+// a document.
+static cmark_node *S_owner(cmark_node *node) {
+  if (node->slab_index != 0) {
+    return S_slab(node)->document;
+  } else if (node->type == CMARK_NODE_DOCUMENT) {
+    return node;
+  }
+  return NULL;
+}
+
+cmark_node *cmark_node_owner(cmark_node *node) { return S_owner(node); }
+
+bufsize_t cmark_node_text_length(cmark_node *node) {
+  bufsize_t i, length = 0;
+
+  switch (node->type) {
+  case CMARK_NODE_TEXT:
+  case CMARK_NODE_CODE:
+  case CMARK_NODE_CODE_BLOCK:
+    for (i = 0; i < node->len; i++) {
+      // count all bytes but UTF-8 continuation bytes
+      if ((node->data[i] & 0xC0) != 0x80) {
+        length++;
+      }
+    }
+    return length;
+  case CMARK_NODE_SOFTBREAK:
+  case CMARK_NODE_LINEBREAK:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+void cmark_document_defer_inlines(cmark_node *document,
+                                  cmark_reference_map *refmap, int options) {
+  cmark_document *doc = S_document(document);
+
+  cmark_reference_map_free(doc->refmap);
+  doc->refmap = refmap;
+  doc->options = options;
+}
+
+// Nodes moved in or out of the tree of 'document' (if any) rule out
+// sweeping its slabs.
+static void S_mixed(cmark_node *document) {
+  if (document != NULL && document->as.document != NULL) {
+    document->as.document->mixed = true;
+  }
+}
+
+cmark_node *cmark_node_new_with_mem(cmark_node_type type, cmark_mem *mem) {
+  cmark_node *node = cmark_node_alloc(mem, NULL);
   node->type = (uint16_t)type;
 
   switch (node->type) {
@@ -100,34 +236,217 @@ cmark_node *cmark_node_new(cmark_node_type type) {
   return cmark_node_new_with_mem(type, &DEFAULT_MEM_ALLOCATOR);
 }
 
+void cmark_document_adopt_buffer(cmark_node *document, unsigned char *buffer) {
+  cmark_document *doc;
+
+  if (buffer == NULL) {
+    return;
+  }
+  doc = S_document(document);
+  if (doc->nbuffers == doc->capacity) {
+    doc->capacity = doc->capacity ? doc->capacity * 2 : 8;
+    doc->buffers = (unsigned char **)document->mem->realloc(
+        doc->buffers, doc->capacity * sizeof(*doc->buffers));
+  }
+  doc->buffers[doc->nbuffers++] = buffer;
+}
+
+cmark_node *cmark_document_new_arena(cmark_node *document) {
+  cmark_node *arena = cmark_node_alloc(document->mem, NULL);
+
+  arena->type = CMARK_NODE_DOCUMENT;
+  S_document(arena)->owner = document;
+  return arena;
+}
+
+void cmark_document_merge(cmark_node *document, cmark_node *after,
+                          cmark_node *other) {
+  cmark_document *doc = S_document(document);
+  cmark_document *from = S_document(other);
+  cmark_node_slab *slab, *next_slab;
+  cmark_node *child, *next;
+  bufsize_t i;
+
+  if (other->first_child != NULL) {
+    for (child = other->first_child; child != NULL; child = child->next) {
+      child->parent = document;
+    }
+    next = after ? after->next : document->first_child;
+    other->first_child->prev = after;
+    if (after != NULL) {
+      after->next = other->first_child;
+    } else {
+      document->first_child = other->first_child;
+    }
+    other->last_child->next = next;
+    if (next != NULL) {
+      next->prev = other->last_child;
+    } else {
+      document->last_child = other->last_child;
+    }
+    other->first_child = NULL;
+    other->last_child = NULL;
+  }
+
+  for (slab = from->slabs; slab != NULL; slab = next_slab) {
+    next_slab = slab->next;
+    slab->document = document;
+    slab->next = doc->slabs;
+    doc->slabs = slab;
+  }
+  from->slabs = NULL;
+  for (i = 0; i < from->nbuffers; i++) {
+    cmark_document_adopt_buffer(document, from->buffers[i]);
+  }
+  from->nbuffers = 0;
+  doc->mixed = doc->mixed || from->mixed;
+
+  cmark_node_free(other);
+}
+
+void cmark_document_trim(cmark_node *document) {
+  cmark_document *doc = document->as.document;
+  cmark_node_slab **link, *slab;
+  bufsize_t i;
+
+  if (doc == NULL) {
+    return;
+  }
+  for (i = 0; i < doc->nbuffers; i++) {
+    document->mem->free(doc->buffers[i]);
+  }
+  doc->nbuffers = 0;
+  if (doc->slabs == NULL) {
+    return;
+  }
+  link = &doc->slabs->next;
+  while ((slab = *link) != NULL) {
+    if (slab->refs == 1) {
+      *link = slab->next;
+      document->mem->free(slab);
+    } else {
+      link = &slab->next;
+    }
+  }
+}
+
+// Give a borrowed literal a NUL-terminated copy of its own.
+static void S_own_literal(cmark_node *node) {
+  unsigned char *data = (unsigned char *)node->mem->realloc(NULL, node->len + 1);
+
+  if (node->len > 0) {
+    memcpy(data, node->data, node->len);
+  }
+  data[node->len] = 0;
+  node->data = data;
+  node->flags &= ~CMARK_NODE__BORROWED_DATA;
+}
+
+// Literals may point into buffers owned by the document they were parsed
+// into.  A subtree leaving that document gets copies of its own so that
+// it can outlive it.
+static void S_own_literals(cmark_node *node) {
+  cmark_node *cur = node;
+
+  while (cur != NULL) {
+    if (cur->flags & CMARK_NODE__BORROWED_DATA) {
+      S_own_literal(cur);
+    }
+    if (cur->first_child) {
+      cur = cur->first_child;
+      continue;
+    }
+    while (cur != node && cur->next == NULL) {
+      cur = cur->parent;
+    }
+    cur = cur == node ? NULL : cur->next;
+  }
+}
+
+static cmark_node *S_root(cmark_node *node) {
+  while (node->parent) {
+    node = node->parent;
+  }
+  return node;
+}
+
+// Free the memory owned by a node other than a document.
+static void S_free_node_data(cmark_mem *mem, cmark_node *e) {
+  switch (e->type) {
+  case CMARK_NODE_CODE_BLOCK:
+    mem->free(e->data);
+    mem->free(e->as.code.info);
+    break;
+  case CMARK_NODE_TEXT:
+  case CMARK_NODE_HTML_INLINE:
+  case CMARK_NODE_CODE:
+  case CMARK_NODE_HTML_BLOCK:
+  // paragraphs and headings whose inlines were never parsed
+  case CMARK_NODE_PARAGRAPH:
+  case CMARK_NODE_HEADING:
+    if (!(e->flags & CMARK_NODE__BORROWED_DATA)) {
+      mem->free(e->data);
+    }
+    break;
+  case CMARK_NODE_LINK:
+  case CMARK_NODE_IMAGE:
+    mem->free(e->as.link.url);
+    mem->free(e->as.link.title);
+    break;
+  case CMARK_NODE_CUSTOM_BLOCK:
+  case CMARK_NODE_CUSTOM_INLINE:
+    mem->free(e->as.custom.on_enter);
+    mem->free(e->as.custom.on_exit);
+    break;
+  default:
+    break;
+  }
+}
+
+// Free the memory owned by a document node.  With 'sweep', the nodes of
+// the tree are freed along with the slabs they live in.
+static void S_free_document(cmark_node *e, bool sweep) {
+  cmark_mem *mem = e->mem;
+  cmark_document *doc = e->as.document;
+  cmark_node_slab *slab, *next_slab;
+  bufsize_t i;
+
+  for (slab = doc->slabs; slab != NULL; slab = next_slab) {
+    next_slab = slab->next;
+    if (sweep) {
+      for (i = 0; i < slab->used; i++) {
+        S_free_node_data(mem, &slab->nodes[i]);
+      }
+      mem->free(slab);
+    } else {
+      slab->document = NULL;
+      S_slab_release(mem, slab);
+    }
+  }
+  for (i = 0; i < doc->nbuffers; i++) {
+    mem->free(doc->buffers[i]);
+  }
+  mem->free(doc->buffers);
+  cmark_reference_map_free(doc->refmap);
+  mem->free(doc);
+}
+
 // Free a cmark_node list and any children.
 static void S_free_nodes(cmark_node *e) {
   cmark_mem *mem = e->mem;
   cmark_node *next;
   while (e != NULL) {
-    switch (e->type) {
-    case CMARK_NODE_CODE_BLOCK:
-      mem->free(e->data);
-      mem->free(e->as.code.info);
-      break;
-    case CMARK_NODE_TEXT:
-    case CMARK_NODE_HTML_INLINE:
-    case CMARK_NODE_CODE:
-    case CMARK_NODE_HTML_BLOCK:
-      mem->free(e->data);
-      break;
-    case CMARK_NODE_LINK:
-    case CMARK_NODE_IMAGE:
-      mem->free(e->as.link.url);
-      mem->free(e->as.link.title);
-      break;
-    case CMARK_NODE_CUSTOM_BLOCK:
-    case CMARK_NODE_CUSTOM_INLINE:
-      mem->free(e->as.custom.on_enter);
-      mem->free(e->as.custom.on_exit);
-      break;
-    default:
-      break;
+    if (e->type == CMARK_NODE_DOCUMENT && e->as.document != NULL) {
+      if (!e->as.document->mixed) {
+        next = e->next;
+        S_free_document(e, true);
+        S_node_release(e);
+        e = next;
+        continue;
+      }
+      S_free_document(e, false);
+    } else {
+      S_free_node_data(mem, e);
     }
     if (e->last_child) {
       // Splice children into list
@@ -135,7 +454,7 @@ static void S_free_nodes(cmark_node *e) {
       e->next = e->first_child;
     }
     next = e->next;
-    mem->free(e);
+    S_node_release(e);
     e = next;
   }
 }
@@ -235,6 +554,9 @@ cmark_node *cmark_node_first_child(cmark_node *node) {
   if (node == NULL) {
     return NULL;
   } else {
+    if (cmark_node_inlines_pending(node)) {
+      cmark_node_parse_pending_inlines(node);
+    }
     return node->first_child;
   }
 }
@@ -243,6 +565,9 @@ cmark_node *cmark_node_last_child(cmark_node *node) {
   if (node == NULL) {
     return NULL;
   } else {
+    if (cmark_node_inlines_pending(node)) {
+      cmark_node_parse_pending_inlines(node);
+    }
     return node->last_child;
   }
 }
@@ -294,6 +619,30 @@ const char *cmark_node_get_literal(cmark_node *node) {
   case CMARK_NODE_HTML_INLINE:
   case CMARK_NODE_CODE:
   case CMARK_NODE_CODE_BLOCK:
+    // A borrowed literal is returned as it is, without a copy that would
+    // change the tree: reading it takes its length.
+    return node->data ? (char *)node->data : "";
+
+  default:
+    break;
+  }
+
+  return NULL;
+}
+
+const char *cmark_node_get_literal_chunk(cmark_node *node, size_t *len) {
+  *len = 0;
+  if (node == NULL) {
+    return NULL;
+  }
+
+  switch (node->type) {
+  case CMARK_NODE_HTML_BLOCK:
+  case CMARK_NODE_TEXT:
+  case CMARK_NODE_HTML_INLINE:
+  case CMARK_NODE_CODE:
+  case CMARK_NODE_CODE_BLOCK:
+    *len = (size_t)node->len;
     return node->data ? (char *)node->data : "";
 
   default:
@@ -314,6 +663,10 @@ int cmark_node_set_literal(cmark_node *node, const char *content) {
   case CMARK_NODE_HTML_INLINE:
   case CMARK_NODE_CODE:
   case CMARK_NODE_CODE_BLOCK:
+    if (node->flags & CMARK_NODE__BORROWED_DATA) {
+      node->data = NULL;
+      node->flags &= ~CMARK_NODE__BORROWED_DATA;
+    }
     node->len = cmark_set_cstr(node->mem, &node->data, content);
     return 1;
 
@@ -675,7 +1028,29 @@ static void S_node_unlink(cmark_node *node) {
   }
 }
 
+// Unlink a node that is about to be inserted into the tree of 'dest'.
+static void S_node_move(cmark_node *node, cmark_node *dest) {
+  cmark_node *owner = S_owner(node);
+  cmark_node *dest_owner = S_owner(dest);
+
+  if (owner == NULL || owner != dest_owner) {
+    S_mixed(owner);
+    S_mixed(dest_owner);
+  }
+  if (node->parent && S_root(node) != S_root(dest)) {
+    // pending inlines can only be parsed in their own document
+    cmark_node_parse_pending_inlines(node);
+    S_own_literals(node);
+  }
+  S_node_unlink(node);
+}
+
 void cmark_node_unlink(cmark_node *node) {
+  if (node->parent) {
+    S_mixed(S_owner(node));
+    cmark_node_parse_pending_inlines(node);
+    S_own_literals(node);
+  }
   S_node_unlink(node);
 
   node->next = NULL;
@@ -683,16 +1058,25 @@ void cmark_node_unlink(cmark_node *node) {
   node->parent = NULL;
 }
 
+// Parse the inlines of 'node' if they are pending, before its children
+// change: they would come after the ones added otherwise.
+static void S_parse_pending_children(cmark_node *node) {
+  if (node != NULL && cmark_node_inlines_pending(node)) {
+    cmark_node_parse_pending_inlines(node);
+  }
+}
+
 int cmark_node_insert_before(cmark_node *node, cmark_node *sibling) {
   if (node == NULL || sibling == NULL) {
     return 0;
   }
+  S_parse_pending_children(node->parent);
 
   if (!node->parent || !S_can_contain(node->parent, sibling)) {
     return 0;
   }
 
-  S_node_unlink(sibling);
+  S_node_move(sibling, node);
 
   cmark_node *old_prev = node->prev;
 
@@ -720,12 +1104,13 @@ int cmark_node_insert_after(cmark_node *node, cmark_node *sibling) {
   if (node == NULL || sibling == NULL) {
     return 0;
   }
+  S_parse_pending_children(node->parent);
 
   if (!node->parent || !S_can_contain(node->parent, sibling)) {
     return 0;
   }
 
-  S_node_unlink(sibling);
+  S_node_move(sibling, node);
 
   cmark_node *old_next = node->next;
 
@@ -750,6 +1135,9 @@ int cmark_node_insert_after(cmark_node *node, cmark_node *sibling) {
 }
 
 int cmark_node_replace(cmark_node *oldnode, cmark_node *newnode) {
+  if (oldnode != NULL) {
+    S_parse_pending_children(oldnode->parent);
+  }
   if (!cmark_node_insert_before(oldnode, newnode)) {
     return 0;
   }
@@ -758,11 +1146,12 @@ int cmark_node_replace(cmark_node *oldnode, cmark_node *newnode) {
 }
 
 int cmark_node_prepend_child(cmark_node *node, cmark_node *child) {
+  S_parse_pending_children(node);
   if (!S_can_contain(node, child)) {
     return 0;
   }
 
-  S_node_unlink(child);
+  S_node_move(child, node);
 
   cmark_node *old_first_child = node->first_child;
 
@@ -782,11 +1171,12 @@ int cmark_node_prepend_child(cmark_node *node, cmark_node *child) {
 }
 
 int cmark_node_append_child(cmark_node *node, cmark_node *child) {
+  S_parse_pending_children(node);
   if (!S_can_contain(node, child)) {
     return 0;
   }
 
-  S_node_unlink(child);
+  S_node_move(child, node);
 
   cmark_node *old_last_child = node->last_child;
 
@@ -45,10 +45,36 @@ typedef struct {
   unsigned char *on_exit;
 } cmark_custom;
 
+typedef struct cmark_node_slab cmark_node_slab;
+
+// Memory owned by a document node: buffers that literals in the tree may
+// borrow, and the slabs its nodes are allocated from.
+typedef struct {
+  unsigned char **buffers;
+  bufsize_t nbuffers;
+  bufsize_t capacity;
+  cmark_node_slab *slabs;
+  // for an arena (see cmark_document_new_arena), the document its slabs
+  // hold nodes of
+  struct cmark_node *owner;
+  // nodes were moved between the tree and other trees
+  bool mixed;
+  // with CMARK_OPT_LAZY_INLINES, the definitions and options that the
+  // paragraphs and headings still holding their content are parsed with
+  cmark_reference_map *refmap;
+  int options;
+} cmark_document;
+
 enum cmark_node__internal_flags {
   CMARK_NODE__OPEN = (1 << 0),
   CMARK_NODE__LAST_LINE_BLANK = (1 << 1),
   CMARK_NODE__LAST_LINE_CHECKED = (1 << 2),
+  // node->data points into memory owned by someone else and must not be
+  // freed with the node
+  CMARK_NODE__BORROWED_DATA = (1 << 3),
+  // text that a delimiter or bracket of the inline parser refers to, which
+  // mustn't be merged with other text yet
+  CMARK_NODE__PINNED = (1 << 4),
 };
 
 struct cmark_node {
@@ -72,6 +98,8 @@ struct cmark_node {
   int internal_offset;
   uint16_t type;
   uint16_t flags;
+  // 1 + index of the node in its slab, or 0 if allocated on its own
+  uint16_t slab_index;
 
   union {
     cmark_list list;
@@ -79,12 +107,63 @@ struct cmark_node {
     cmark_heading heading;
     cmark_link link;
     cmark_custom custom;
+    cmark_document *document;
     int html_block_type;
   } as;
 };
 
 CMARK_EXPORT int cmark_node_check(cmark_node *node, FILE *out);
 
+// Whether the inlines of 'node' are yet to be parsed: its content is
+// kept until then.
+static CMARK_INLINE bool cmark_node_inlines_pending(cmark_node *node) {
+  return (node->type == CMARK_NODE_PARAGRAPH ||
+          node->type == CMARK_NODE_HEADING) &&
+         node->data != NULL;
+}
+
+// Parse the inlines that CMARK_OPT_LAZY_INLINES left pending in 'node' and
+// the blocks below it.  Does nothing for other trees.
+void cmark_node_parse_pending_inlines(cmark_node *node);
+
+// The characters 'node' adds to the text of a document: the code points
+// of its literal, or one for a line break.  Excerpts are measured in them.
+bufsize_t cmark_node_text_length(cmark_node *node);
+
+// The document 'node' is allocated from, if any (see cmark_node_alloc).
+cmark_node *cmark_node_owner(cmark_node *node);
+
+// Leave the inlines of the paragraphs and headings in the tree of
+// 'document' to be parsed when they are first reached, with 'refmap' (which
+// the document takes over) and 'options'.
+void cmark_document_defer_inlines(cmark_node *document,
+                                  cmark_reference_map *refmap, int options);
+
+// Hand 'buffer' (allocated with the document's allocator) over to
+// 'document', which frees it together with the tree.
+void cmark_document_adopt_buffer(cmark_node *document, unsigned char *buffer);
+
+// Allocate a zeroed node with 'mem', carved from the node slabs of
+// 'document' unless it is NULL.
+cmark_node *cmark_node_alloc(cmark_mem *mem, cmark_node *document);
+
+// Create an arena: a document node that other threads can allocate nodes
+// of 'document' from without touching its slabs.  The nodes count as
+// part of 'document' from the start.  The arena is given back with
+// cmark_document_merge.
+cmark_node *cmark_document_new_arena(cmark_node *document);
+
+// Move the children of the document 'other' into 'document' after its
+// child 'after' (first if NULL), hand its slabs and buffers over as well,
+// and free it.
+void cmark_document_merge(cmark_node *document, cmark_node *after,
+                          cmark_node *other);
+
+// Free the buffers 'document' adopted and the slabs none of its nodes
+// live in anymore, but for the one nodes are being carved from.  Nothing
+// left in the tree may borrow from the buffers.
+void cmark_document_trim(cmark_node *document);
+
 #ifdef __cplusplus
 }
 #endif
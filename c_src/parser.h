@@ -23,18 +23,52 @@ struct cmark_parser {
   bufsize_t first_nonspace;
   bufsize_t first_nonspace_column;
   bufsize_t thematic_break_kill_pos;
-  int indent;
+  bufsize_t indent;
   bool blank;
   bool partially_consumed_tab;
   cmark_strbuf curline;
   bufsize_t last_line_length;
   cmark_strbuf linebuf;
   cmark_strbuf content;
+  // Content of the open leaf block while it is still a verbatim span of
+  // 'source'.  It is moved into 'content' once a line has to be rewritten.
+  cmark_chunk content_span;
+  // Private copy of the input, when the whole document is known up front,
+  // and the position of the current line in it (NULL if the line differs
+  // from the source).  It may be fed a piece at a time.
+  cmark_strbuf source;
+  const unsigned char *curline_source;
   int options;
+  // threads that may parse inlines (see cmark_parser_set_threads)
+  int threads;
+  // how threads are started and waited for
+  const cmark_thread_functions *thread_functions;
+  // segments the blocks of the document were parsed in side by side, or
+  // 0 if they were parsed on one thread
+  int segments;
+  // leave the inlines of the finished document unparsed, for
+  // cmark_parser_parse_block_inlines
+  bool defer_inlines;
   bool last_buffer_ended_with_cr;
-  unsigned int total_size;
+  size_t total_size;
 };
 
+// Whether a line starting with 'c' can follow a split in the input: such
+// a line isn't indented and can't start or continue a list item, so it
+// closes every block open before it except fenced code and HTML blocks
+// (and paragraphs it continues lazily).
+bool cmark_parser_can_split_before(unsigned char c);
+
+// Whether the blocks open in 'parser' are all closed by a line that can
+// follow a split, which then starts a new top-level block just as at the
+// start of a document.
+bool cmark_parser_open_blocks_close_at_split(cmark_parser *parser);
+
+// Parse the inlines of 'block' and the blocks below it, in a document
+// finished with 'defer_inlines' set.
+void cmark_parser_parse_block_inlines(cmark_parser *parser,
+                                      cmark_node *block);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "cmark.h"
+#include "node.h"
+#include "parser.h"
+#include "references.h"
+#include "render.h"
+
+struct cmark_html_pipeline {
+  cmark_parser *parser;
+  cmark_html_stream *stream;
+  // the sink stopped rendering
+  bool stopped;
+};
+
+// The end of the line starting at 'pos'.  Lines end as in the parser.
+static size_t S_line_end(const char *data, size_t len, size_t pos) {
+  while (pos < len && data[pos] != '\n' && data[pos] != '\r') {
+    pos++;
+  }
+  if (pos < len && data[pos] == '\r') {
+    pos++;
+  }
+  if (pos < len && data[pos] == '\n') {
+    pos++;
+  }
+  return pos;
+}
+
+// Parse the inlines of the top-level blocks closed so far, render them
+// and free them.  Returns 0 if the sink stopped rendering.
+static int S_render_closed_blocks(cmark_html_pipeline *pipeline) {
+  cmark_parser *parser = pipeline->parser;
+  cmark_node *root = parser->root;
+  cmark_node *block;
+  bool freed = false;
+  int ok = 1;
+
+  // Inlines expand references within the limit for the input fed so far
+  // (see finalize_document).
+  parser->refmap->max_ref_size = cmark_reference_limit(parser->total_size);
+
+  while (ok && (block = root->first_child) != NULL &&
+         !(block->flags & CMARK_NODE__OPEN)) {
+    cmark_parser_parse_block_inlines(parser, block);
+    ok = cmark_html_stream_render(pipeline->stream, block);
+    cmark_node_free(block);
+    freed = true;
+  }
+  if (freed) {
+    // the content of the blocks and the slabs they were carved from
+    cmark_document_trim(root);
+  }
+  return ok;
+}
+
+cmark_html_pipeline *cmark_html_pipeline_new(cmark_parser *parser,
+                                             const cmark_url_map *urls,
+                                             cmark_sink *sink) {
+  cmark_html_pipeline *pipeline = (cmark_html_pipeline *)parser->mem->calloc(
+      1, sizeof(cmark_html_pipeline));
+
+  pipeline->parser = parser;
+  pipeline->stream =
+      cmark_html_stream_new(parser->mem, parser->options, urls, sink);
+  parser->defer_inlines = true;
+  return pipeline;
+}
+
+int cmark_html_pipeline_feed(cmark_html_pipeline *pipeline, const char *buffer,
+                             size_t len) {
+  size_t pos = 0, line_end;
+
+  // A line at a time, so that blocks are let go of as soon as they close.
+  // The parser copies the lines of the open blocks: nothing refers to the
+  // buffer afterwards.
+  while (!pipeline->stopped && pos < len) {
+    line_end = S_line_end(buffer, len, pos);
+    cmark_parser_feed(pipeline->parser, buffer + pos, line_end - pos);
+    pos = line_end;
+    pipeline->stopped = !S_render_closed_blocks(pipeline);
+  }
+  return !pipeline->stopped;
+}
+
+int cmark_html_pipeline_finish(cmark_html_pipeline *pipeline) {
+  if (pipeline->stopped) {
+    return 0;
+  }
+  cmark_parser_finish(pipeline->parser);
+  pipeline->stopped = !S_render_closed_blocks(pipeline) ||
+                      !cmark_html_stream_finish(pipeline->stream);
+  return !pipeline->stopped;
+}
+
+void cmark_html_pipeline_free(cmark_html_pipeline *pipeline) {
+  cmark_parser *parser;
+
+  if (pipeline == NULL) {
+    return;
+  }
+  parser = pipeline->parser;
+  cmark_html_stream_free(pipeline->stream);
+  cmark_node_free(parser->root);
+  parser->root = NULL;
+  parser->current = NULL;
+  parser->mem->free(pipeline);
+}
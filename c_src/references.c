@@ -5,6 +5,8 @@
 #include "inlines.h"
 #include "chunk.h"
 
+#define REFMAP_MIN_CAPACITY 16
+
 static void reference_free(cmark_reference_map *map, cmark_reference *ref) {
   cmark_mem *mem = map->mem;
   if (ref != NULL) {
@@ -17,126 +19,205 @@ static void reference_free(cmark_reference_map *map, cmark_reference *ref) {
 
 // normalize reference:  collapse internal whitespace to single space,
 // remove leading/trailing whitespace, case fold
-// Return NULL if the reference name is actually empty (i.e. composed
+// The result is written to 'normalized', replacing its contents.
+// Return false if the reference name is actually empty (i.e. composed
 // solely from whitespace)
-static unsigned char *normalize_reference(cmark_mem *mem, cmark_chunk *ref) {
-  cmark_strbuf normalized = CMARK_BUF_INIT(mem);
-  unsigned char *result;
+static bool normalize_reference(cmark_strbuf *normalized, cmark_chunk *ref) {
+  bufsize_t r, w = 0;
+  bool last_char_was_space = true; // drops leading whitespace
+  unsigned char c;
+
+  cmark_strbuf_clear(normalized);
 
   if (ref == NULL)
-    return NULL;
+    return false;
 
   if (ref->len == 0)
-    return NULL;
+    return false;
+
+  // Fast path: fold, trim and collapse ASCII in a single pass.
+  cmark_strbuf_grow(normalized, ref->len);
+  for (r = 0; r < ref->len; r++) {
+    c = ref->data[r];
+    if (c >= 0x80) {
+      break;
+    } else if (cmark_isspace(c)) {
+      if (!last_char_was_space) {
+        normalized->ptr[w++] = ' ';
+        last_char_was_space = true;
+      }
+    } else {
+      normalized->ptr[w++] = (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+      last_char_was_space = false;
+    }
+  }
+  normalized->size = w;
+  normalized->ptr[w] = '\0';
+
+  if (r < ref->len) {
+    // Non-ASCII label: fold the rest in full and normalize the whole
+    // result again, since the prefix may end with a space.
+    cmark_utf8proc_case_fold(normalized, ref->data + r, ref->len - r);
+    cmark_strbuf_trim(normalized);
+    cmark_strbuf_normalize_whitespace(normalized);
+  } else if (w > 0 && last_char_was_space) {
+    cmark_strbuf_truncate(normalized, w - 1);
+  }
 
-  cmark_utf8proc_case_fold(&normalized, ref->data, ref->len);
-  cmark_strbuf_trim(&normalized);
-  cmark_strbuf_normalize_whitespace(&normalized);
+  return normalized->size > 0;
+}
 
-  result = cmark_strbuf_detach(&normalized);
-  assert(result);
+// FNV-1a
+static unsigned int refhash(const unsigned char *label, bufsize_t len) {
+  unsigned int hash = 2166136261u;
+  bufsize_t i;
 
-  if (result[0] == '\0') {
-    mem->free(result);
-    return NULL;
+  for (i = 0; i < len; i++) {
+    hash ^= label[i];
+    hash *= 16777619u;
   }
 
-  return result;
+  return hash;
+}
+
+// Returns the slot holding 'label', or the empty slot where it would be
+// inserted.  Requires a table with at least one empty slot.
+static cmark_reference **find_slot(const cmark_reference_map *map,
+                                   const unsigned char *label, bufsize_t len,
+                                   unsigned int hash) {
+  unsigned int mask = map->capacity - 1;
+  unsigned int i = hash & mask;
+  cmark_reference *r;
+
+  while ((r = map->table[i]) != NULL) {
+    if (r->hash == hash && strncmp((const char *)r->label,
+                                   (const char *)label, len) == 0 &&
+        r->label[len] == '\0')
+      return &map->table[i];
+    i = (i + 1) & mask;
+  }
+
+  return &map->table[i];
+}
+
+static void grow_table(cmark_reference_map *map) {
+  cmark_reference **old = map->table;
+  unsigned int old_capacity = map->capacity;
+  unsigned int i, j, mask;
+
+  map->capacity = old_capacity ? old_capacity * 2 : REFMAP_MIN_CAPACITY;
+  map->table = (cmark_reference **)map->mem->calloc(map->capacity,
+                                                    sizeof(cmark_reference *));
+  mask = map->capacity - 1;
+
+  for (i = 0; i < old_capacity; i++) {
+    if (old[i] == NULL)
+      continue;
+    j = old[i]->hash & mask;
+    while (map->table[j] != NULL)
+      j = (j + 1) & mask;
+    map->table[j] = old[i];
+  }
+
+  map->mem->free(old);
 }
 
 void cmark_reference_create(cmark_reference_map *map, cmark_chunk *label,
                             cmark_chunk *url, cmark_chunk *title) {
   cmark_reference *ref;
-  unsigned char *reflabel = normalize_reference(map->mem, label);
+  cmark_reference **slot;
+  cmark_strbuf *norm = &map->scratch;
+  unsigned int hash;
 
   /* empty reference name, or composed from only whitespace */
-  if (reflabel == NULL)
+  if (!normalize_reference(norm, label))
     return;
 
-  assert(map->sorted == NULL);
+  // keep the load factor at or below 3/4
+  if ((map->size + 1) * 4 > map->capacity * 3)
+    grow_table(map);
+
+  hash = refhash(norm->ptr, norm->size);
+  slot = find_slot(map, norm->ptr, norm->size, hash);
+
+  /* the first definition of a label takes precedence */
+  if (*slot != NULL)
+    return;
 
   ref = (cmark_reference *)map->mem->calloc(1, sizeof(*ref));
-  ref->label = reflabel;
+  ref->label = (unsigned char *)map->mem->realloc(NULL, norm->size + 1);
+  memcpy(ref->label, norm->ptr, norm->size + 1);
   ref->url = cmark_clean_url(map->mem, url);
   ref->title = cmark_clean_title(map->mem, title);
-  ref->age = map->size;
-  ref->next = map->refs;
+  ref->hash = hash;
 
   if (ref->url != NULL)
     ref->size += strlen((char*)ref->url);
   if (ref->title != NULL)
     ref->size += strlen((char*)ref->title);
 
-  map->refs = ref;
+  *slot = ref;
   map->size++;
 }
 
-static int
-labelcmp(const unsigned char *a, const unsigned char *b) {
-  return strcmp((const char *)a, (const char *)b);
-}
-
-static int
-refcmp(const void *p1, const void *p2) {
-  cmark_reference *r1 = *(cmark_reference **)p1;
-  cmark_reference *r2 = *(cmark_reference **)p2;
-  int res = labelcmp(r1->label, r2->label);
-  return res ? res : ((int)r1->age - (int)r2->age);
-}
-
-static int
-refsearch(const void *label, const void *p2) {
-  cmark_reference *ref = *(cmark_reference **)p2;
-  return labelcmp((const unsigned char *)label, ref->label);
-}
-
-static void sort_references(cmark_reference_map *map) {
-  unsigned int i = 0, last = 0, size = map->size;
-  cmark_reference *r = map->refs, **sorted = NULL;
-
-  sorted = (cmark_reference **)map->mem->calloc(size, sizeof(cmark_reference *));
-  while (r) {
-    sorted[i++] = r;
-    r = r->next;
+void cmark_reference_map_merge(cmark_reference_map *map,
+                               cmark_reference_map *from) {
+  cmark_reference *r;
+  cmark_reference **slot;
+  unsigned int i;
+
+  for (i = 0; i < from->capacity; i++) {
+    r = from->table[i];
+    if (r == NULL)
+      continue;
+    from->table[i] = NULL;
+
+    if ((map->size + 1) * 4 > map->capacity * 3)
+      grow_table(map);
+
+    slot = find_slot(map, r->label, (bufsize_t)strlen((char *)r->label),
+                     r->hash);
+    if (*slot != NULL) {
+      reference_free(from, r);
+    } else {
+      *slot = r;
+      map->size++;
+    }
   }
-
-  qsort(sorted, size, sizeof(cmark_reference *), refcmp);
-
-  for (i = 1; i < size; i++) {
-    if (labelcmp(sorted[i]->label, sorted[last]->label) != 0)
-      sorted[++last] = sorted[i];
-  }
-  map->sorted = sorted;
-  map->size = last + 1;
+  from->size = 0;
 }
 
-// Returns reference if refmap contains a reference with matching
-// label, otherwise NULL.
+// Returns reference if refmap or its fallback dictionary contains a
+// reference with matching label, otherwise NULL.  The fallback is
+// only read, never modified.
 cmark_reference *cmark_reference_lookup(cmark_reference_map *map,
                                         cmark_chunk *label) {
-  cmark_reference **ref = NULL;
   cmark_reference *r = NULL;
-  unsigned char *norm;
+  const cmark_reference_map *fallback;
+  cmark_strbuf *norm;
+  unsigned int hash;
 
   if (label->len < 1 || label->len > MAX_LINK_LABEL_LENGTH)
     return NULL;
 
-  if (map == NULL || !map->size)
+  if (map == NULL)
     return NULL;
 
-  norm = normalize_reference(map->mem, label);
-  if (norm == NULL)
+  fallback = map->fallback;
+  if (!map->size && (fallback == NULL || !fallback->size))
     return NULL;
 
-  if (!map->sorted)
-    sort_references(map);
+  norm = &map->scratch;
+  if (!normalize_reference(norm, label))
+    return NULL;
 
-  ref = (cmark_reference **)bsearch(norm, map->sorted, map->size, sizeof(cmark_reference *),
-                refsearch);
-  map->mem->free(norm);
+  hash = refhash(norm->ptr, norm->size);
+  if (map->size)
+    r = *find_slot(map, norm->ptr, norm->size, hash);
+  if (r == NULL && fallback != NULL && fallback->size)
+    r = *find_slot(fallback, norm->ptr, norm->size, hash);
 
-  if (ref != NULL) {
-    r = ref[0];
+  if (r != NULL) {
     /* Check for expansion limit */
     if (map->max_ref_size && r->size > map->max_ref_size - map->ref_size)
       return NULL;
@@ -147,19 +228,16 @@ cmark_reference *cmark_reference_lookup(cmark_reference_map *map,
 }
 
 void cmark_reference_map_free(cmark_reference_map *map) {
-  cmark_reference *ref;
+  unsigned int i;
 
   if (map == NULL)
     return;
 
-  ref = map->refs;
-  while (ref) {
-    cmark_reference *next = ref->next;
-    reference_free(map, ref);
-    ref = next;
-  }
+  for (i = 0; i < map->capacity; i++)
+    reference_free(map, map->table[i]);
 
-  map->mem->free(map->sorted);
+  cmark_strbuf_free(&map->scratch);
+  map->mem->free(map->table);
   map->mem->free(map);
 }
 
@@ -167,5 +245,6 @@ cmark_reference_map *cmark_reference_map_new(cmark_mem *mem) {
   cmark_reference_map *map =
       (cmark_reference_map *)mem->calloc(1, sizeof(cmark_reference_map));
   map->mem = mem;
+  cmark_strbuf_init(mem, &map->scratch, 0);
   return map;
 }
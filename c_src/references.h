@@ -1,6 +1,9 @@
 #ifndef CMARK_REFERENCES_H
 #define CMARK_REFERENCES_H
 
+#include <limits.h>
+
+#include "config.h"
 #include "chunk.h"
 
 #ifdef __cplusplus
@@ -8,34 +11,49 @@ extern "C" {
 #endif
 
 struct cmark_reference {
-  struct cmark_reference *next;
   unsigned char *label;
   unsigned char *url;
   unsigned char *title;
-  unsigned int age;
+  unsigned int hash;
   unsigned int size;
 };
 
 typedef struct cmark_reference cmark_reference;
 
+// Open-addressing hash table keyed by normalized label.  `table` has
+// `capacity` slots (a power of two, or zero before the first insert)
+// and uses linear probing; `scratch` holds the normalized form of the
+// label currently being defined or looked up.  Labels missing from the
+// table are looked up in the read-only `fallback` dictionary, if any.
 struct cmark_reference_map {
   cmark_mem *mem;
-  cmark_reference *refs;
-  cmark_reference **sorted;
+  cmark_reference **table;
+  cmark_strbuf scratch;
+  const struct cmark_reference_map *fallback;
+  unsigned int capacity;
   unsigned int size;
   unsigned int ref_size;
   unsigned int max_ref_size;
 };
 
-typedef struct cmark_reference_map cmark_reference_map;
-
 cmark_reference_map *cmark_reference_map_new(cmark_mem *mem);
-void cmark_reference_map_free(cmark_reference_map *map);
 cmark_reference *cmark_reference_lookup(cmark_reference_map *map,
                                         cmark_chunk *label);
+// Move the definitions of 'from' over to 'map', where those of 'map' take
+// precedence, leaving 'from' empty.
+void cmark_reference_map_merge(cmark_reference_map *map,
+                               cmark_reference_map *from);
 extern void cmark_reference_create(cmark_reference_map *map, cmark_chunk *label,
                                    cmark_chunk *url, cmark_chunk *title);
 
+// Limit total size of extra content created from reference links to
+// document size to avoid superlinear growth. Always allow 100KB.
+static CMARK_INLINE unsigned int cmark_reference_limit(size_t size) {
+  if (size > UINT_MAX)
+    return UINT_MAX;
+  return size > 100000 ? (unsigned int)size : 100000;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,9 +1,12 @@
 #include <stdlib.h>
+#include <limits.h>
+#include <string.h>
 #include "buffer.h"
 #include "cmark.h"
 #include "utf8.h"
 #include "render.h"
 #include "node.h"
+#include "iterator.h"
 #include "cmark_ctype.h"
 
 static CMARK_INLINE void S_cr(cmark_renderer *renderer) {
@@ -18,15 +21,105 @@ static CMARK_INLINE void S_blankline(cmark_renderer *renderer) {
   }
 }
 
-static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
-                  cmark_escaping escape) {
-  int length = strlen(source);
+// The length of the run of characters at the start of 's' that the format
+// outputs as they are and that can't make the line wrap, with the number
+// of characters in '*chars', whether they are all digits in '*digits' and
+// the offset of the last space the line may be broken at in '*breakable'
+// (or -1).
+static bufsize_t S_plain_run(cmark_renderer *renderer, const uint8_t *s,
+                             bufsize_t len, bool wrap, cmark_escaping escape,
+                             bufsize_t *chars, bool *digits,
+                             bufsize_t *breakable) {
+  int mask = 1 << escape;
+  bufsize_t max_chars = BUFSIZE_MAX;
+  bufsize_t i = 0;
+  int n;
+  int32_t c;
+  uint8_t b;
+
+  // Once the line may be broken, a run mustn't go beyond width.
+  if (renderer->width > 0 && renderer->last_breakable > 0) {
+    max_chars = renderer->width - renderer->column;
+  }
+
+  *chars = 0;
+  *digits = true;
+  *breakable = -1;
+  while (i < len && *chars < max_chars) {
+    b = s[i];
+    if (b == ' ' && wrap) {
+      // A single space within width; S_out drops spaces at the start of a
+      // line and squeezes runs of them.  As there, a digit after the
+      // space keeps the line from being broken at it.
+      if ((i == 0 && renderer->begin_line) ||
+          (i + 1 < len && s[i + 1] == ' ')) {
+        break;
+      }
+      if (i + 1 == len || !cmark_isdigit(s[i + 1])) {
+        if (renderer->width > 0) {
+          if (renderer->column + *chars + 1 > renderer->width) {
+            break;
+          }
+          max_chars = renderer->width - renderer->column;
+        }
+        *breakable = i;
+      }
+      *digits = false;
+      (*chars)++;
+      i++;
+      continue;
+    }
+    if (escape == LITERAL ? b == '\n' : !(renderer->plain_chars[b] & mask)) {
+      break;
+    }
+    if (b < 0x80) {
+      n = 1;
+      c = b;
+    } else {
+      n = cmark_utf8proc_iterate(s + i, len - i, &c);
+      if (n < 0) {
+        break;
+      }
+    }
+    *digits = *digits && cmark_isdigit(c) == 1;
+    (*chars)++;
+    i += n;
+  }
+  return i;
+}
+
+// Break the line at the space at 'last_breakable': the space becomes the
+// newline and the prefix goes in after it, moving the rest of the line
+// along in place.
+static void S_break_line(cmark_renderer *renderer) {
+  cmark_strbuf *buf = renderer->buffer;
+  bufsize_t start = renderer->last_breakable + 1;
+  bufsize_t remainder_len = buf->size - start;
+  bufsize_t prefix_len = renderer->prefix->size;
+
+  if (prefix_len > 0) {
+    cmark_strbuf_grow(buf, buf->size + prefix_len);
+    memmove(buf->ptr + start + prefix_len, buf->ptr + start, remainder_len);
+    memcpy(buf->ptr + start, renderer->prefix->ptr, prefix_len);
+    buf->size += prefix_len;
+    buf->ptr[buf->size] = '\0';
+  }
+  buf->ptr[start - 1] = '\n';
+  renderer->column = prefix_len + remainder_len;
+}
+
+// Output 'length' bytes of 'source', which needn't be NUL-terminated.
+static void S_out(cmark_renderer *renderer, const char *source,
+                  bufsize_t length, bool wrap, cmark_escaping escape) {
   unsigned char nextc;
   int32_t c;
-  int i = 0;
-  int last_nonspace;
-  int len;
-  int k = renderer->buffer->size - 1;
+  bufsize_t i = 0;
+  bufsize_t last_nonspace;
+  bufsize_t len;
+  bufsize_t chars;
+  bool digits;
+  bufsize_t breakable;
+  bufsize_t k = renderer->buffer->size - 1;
 
   wrap = wrap && !renderer->no_linebreaks;
 
@@ -58,11 +151,25 @@ static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
       renderer->column = renderer->prefix->size;
     }
 
+    len = S_plain_run(renderer, (const uint8_t *)source + i, length - i, wrap,
+                      escape, &chars, &digits, &breakable);
+    if (len > 0) {
+      if (breakable >= 0) {
+        renderer->last_breakable = renderer->buffer->size + breakable;
+      }
+      cmark_strbuf_put(renderer->buffer, (const uint8_t *)source + i, len);
+      renderer->column += chars;
+      renderer->begin_line = false;
+      renderer->begin_content = renderer->begin_content && digits;
+      i += len;
+      continue;
+    }
+
     len = cmark_utf8proc_iterate((const uint8_t *)source + i, length - i, &c);
     if (len == -1) { // error condition
       return;        // return without rendering rest of string
     }
-    nextc = source[i + len];
+    nextc = i + len < length ? source[i + len] : 0;
     if (c == 32 && wrap) {
       if (!renderer->begin_line) {
         last_nonspace = renderer->buffer->size;
@@ -71,12 +178,12 @@ static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
         renderer->begin_line = false;
         renderer->begin_content = false;
         // skip following spaces
-        while (source[i + 1] == ' ') {
+        while (i + 1 < length && source[i + 1] == ' ') {
           i++;
         }
         // We don't allow breaks that make a digit the first character
         // because this causes problems with commonmark output.
-        if (!cmark_isdigit(source[i + 1])) {
+        if (i + 1 == length || !cmark_isdigit(source[i + 1])) {
           renderer->last_breakable = last_nonspace;
         }
       }
@@ -109,24 +216,7 @@ static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
     // earlier place where the line could be broken:
     if (renderer->width > 0 && renderer->column > renderer->width &&
         !renderer->begin_line && renderer->last_breakable > 0) {
-
-      // copy from last_breakable to remainder
-      unsigned char *src = renderer->buffer->ptr +
-                           renderer->last_breakable + 1;
-      bufsize_t remainder_len = renderer->buffer->size -
-                                renderer->last_breakable - 1;
-      unsigned char *remainder =
-          (unsigned char *)renderer->mem->realloc(NULL, remainder_len);
-      memcpy(remainder, src, remainder_len);
-      // truncate at last_breakable
-      cmark_strbuf_truncate(renderer->buffer, renderer->last_breakable);
-      // add newline, prefix, and remainder
-      cmark_strbuf_putc(renderer->buffer, '\n');
-      cmark_strbuf_put(renderer->buffer, renderer->prefix->ptr,
-                       renderer->prefix->size);
-      cmark_strbuf_put(renderer->buffer, remainder, remainder_len);
-      renderer->column = renderer->prefix->size + remainder_len;
-      renderer->mem->free(remainder);
+      S_break_line(renderer);
       renderer->last_breakable = 0;
       renderer->begin_line = false;
       renderer->begin_content = false;
@@ -138,7 +228,7 @@ static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
 
 // Assumes no newlines, assumes ascii content:
 void cmark_render_ascii(cmark_renderer *renderer, const char *s) {
-  int origsize = renderer->buffer->size;
+  bufsize_t origsize = renderer->buffer->size;
   cmark_strbuf_puts(renderer->buffer, s);
   renderer->column += renderer->buffer->size - origsize;
 }
@@ -148,45 +238,96 @@ void cmark_render_code_point(cmark_renderer *renderer, uint32_t c) {
   renderer->column += 1;
 }
 
-char *cmark_render(cmark_node *root, int options, int width,
-                   void (*outc)(cmark_renderer *, cmark_escaping, int32_t,
-                                unsigned char),
-                   int (*render_node)(cmark_renderer *renderer,
-                                      cmark_node *node,
-                                      cmark_event_type ev_type, int options)) {
+// Render 'root' into 'buf'.  With a sink, the output is passed on to it
+// between nodes, keeping the last two bytes, which S_out looks back at,
+// and when wrapping, the end of the current line, which may yet be
+// wrapped.  Returns 0 if the sink failed.
+static int S_render(cmark_node *root, int options, int width,
+                    void (*outc)(cmark_renderer *, cmark_escaping, int32_t,
+                                 unsigned char),
+                    const unsigned char *plain_chars,
+                    int (*render_node)(cmark_renderer *renderer,
+                                       cmark_node *node,
+                                       cmark_event_type ev_type, int options),
+                    cmark_strbuf *buf, cmark_sink *sink) {
   cmark_mem *mem = root->mem;
   cmark_strbuf pref = CMARK_BUF_INIT(mem);
-  cmark_strbuf buf = CMARK_BUF_INIT(mem);
   cmark_node *cur;
   cmark_event_type ev_type;
-  char *result;
-  cmark_iter *iter = cmark_iter_new(root);
+  cmark_iter iter;
+  bufsize_t flush;
+  int ok = 1;
 
-  cmark_renderer renderer = {options,
-	                     mem,   &buf, &pref, 0,           width,
-                             0,     0,    true,  true,        false,
-                             false, outc, S_cr,  S_blankline, S_out};
+  cmark_renderer renderer = {options, mem,   buf,  &pref, 0,           width,
+                             0,       0,     true, true,  false,       false,
+                             plain_chars,   outc, S_cr,  S_blankline, S_out};
 
-  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
-    cur = cmark_iter_get_node(iter);
+  cmark_node_parse_pending_inlines(root);
+  cmark_iter_init(&iter, root);
+  while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+    cur = iter.cur.node;
     if (!render_node(&renderer, cur, ev_type, options)) {
       // a false value causes us to skip processing
       // the node's contents.  this is used for
       // autolinks.
-      cmark_iter_reset(iter, cur, CMARK_EVENT_EXIT);
+      cmark_iter_reset(&iter, cur, CMARK_EVENT_EXIT);
+    }
+    if (sink != NULL && (size_t)buf->size >= sink->flush_size) {
+      flush = buf->size - 2;
+      if (width > 0 && renderer.last_breakable > 0 &&
+          renderer.last_breakable <= flush) {
+        flush = renderer.last_breakable - 1;
+      }
+      if (!cmark_strbuf_drain(buf, flush, sink)) {
+        ok = 0;
+        break;
+      }
+      if (flush > 0) {
+        renderer.last_breakable = renderer.last_breakable > flush
+                                      ? renderer.last_breakable - flush
+                                      : 0;
+      }
     }
   }
 
   // ensure final newline
-  if (renderer.buffer->size == 0 || renderer.buffer->ptr[renderer.buffer->size - 1] != '\n') {
+  if (ok && (renderer.buffer->size == 0 ||
+             renderer.buffer->ptr[renderer.buffer->size - 1] != '\n')) {
     cmark_strbuf_putc(renderer.buffer, '\n');
   }
 
-  result = (char *)cmark_strbuf_detach(renderer.buffer);
-
-  cmark_iter_free(iter);
   cmark_strbuf_free(renderer.prefix);
-  cmark_strbuf_free(renderer.buffer);
 
-  return result;
+  return ok;
+}
+
+char *cmark_render(cmark_node *root, int options, int width,
+                   void (*outc)(cmark_renderer *, cmark_escaping, int32_t,
+                                unsigned char),
+                   const unsigned char *plain_chars,
+                   int (*render_node)(cmark_renderer *renderer,
+                                      cmark_node *node,
+                                      cmark_event_type ev_type, int options)) {
+  cmark_strbuf buf = CMARK_BUF_INIT(root->mem);
+
+  S_render(root, options, width, outc, plain_chars, render_node, &buf, NULL);
+  return (char *)cmark_strbuf_detach(&buf);
+}
+
+int cmark_render_to_sink(cmark_node *root, int options, int width,
+                         void (*outc)(cmark_renderer *, cmark_escaping,
+                                      int32_t, unsigned char),
+                         const unsigned char *plain_chars,
+                         int (*render_node)(cmark_renderer *renderer,
+                                            cmark_node *node,
+                                            cmark_event_type ev_type,
+                                            int options),
+                         cmark_sink *sink) {
+  cmark_strbuf buf = CMARK_BUF_INIT(root->mem);
+  int ok = S_render(root, options, width, outc, plain_chars, render_node,
+                    &buf, sink) &&
+           cmark_strbuf_drain(&buf, buf.size, sink);
+
+  cmark_strbuf_free(&buf);
+  return ok;
 }
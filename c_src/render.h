@@ -15,7 +15,7 @@ struct cmark_renderer {
   cmark_mem *mem;
   cmark_strbuf *buffer;
   cmark_strbuf *prefix;
-  int column;
+  bufsize_t column;
   int width;
   int need_cr;
   bufsize_t last_breakable;
@@ -23,12 +23,42 @@ struct cmark_renderer {
   bool begin_content;
   bool no_linebreaks;
   bool in_tight_list_item;
+  // For each byte, bit (1 << escaping) is set if the format outputs it as
+  // it is, whatever surrounds it; a non-ASCII byte stands for the
+  // characters it starts.  LITERAL escaping passes everything but
+  // newlines.
+  const unsigned char *plain_chars;
   void (*outc)(struct cmark_renderer *, cmark_escaping, int32_t, unsigned char);
   void (*cr)(struct cmark_renderer *);
   void (*blankline)(struct cmark_renderer *);
-  void (*out)(struct cmark_renderer *, const char *, bool, cmark_escaping);
+  void (*out)(struct cmark_renderer *, const char *, bufsize_t, bool,
+              cmark_escaping);
 };
 
+// The plain_chars table of a format, from PLAIN(b), a constant expression
+// giving the bits of byte 'b'.
+#define CMARK_PLAIN_ROW(PLAIN, b)                                              \
+  PLAIN((b) + 0), PLAIN((b) + 1), PLAIN((b) + 2), PLAIN((b) + 3),              \
+      PLAIN((b) + 4), PLAIN((b) + 5), PLAIN((b) + 6), PLAIN((b) + 7),          \
+      PLAIN((b) + 8), PLAIN((b) + 9), PLAIN((b) + 10), PLAIN((b) + 11),        \
+      PLAIN((b) + 12), PLAIN((b) + 13), PLAIN((b) + 14), PLAIN((b) + 15)
+#define CMARK_PLAIN_CHARS(PLAIN)                                               \
+  {                                                                            \
+    CMARK_PLAIN_ROW(PLAIN, 0x00), CMARK_PLAIN_ROW(PLAIN, 0x10),                \
+        CMARK_PLAIN_ROW(PLAIN, 0x20), CMARK_PLAIN_ROW(PLAIN, 0x30),            \
+        CMARK_PLAIN_ROW(PLAIN, 0x40), CMARK_PLAIN_ROW(PLAIN, 0x50),            \
+        CMARK_PLAIN_ROW(PLAIN, 0x60), CMARK_PLAIN_ROW(PLAIN, 0x70),            \
+        CMARK_PLAIN_ROW(PLAIN, 0x80), CMARK_PLAIN_ROW(PLAIN, 0x90),            \
+        CMARK_PLAIN_ROW(PLAIN, 0xA0), CMARK_PLAIN_ROW(PLAIN, 0xB0),            \
+        CMARK_PLAIN_ROW(PLAIN, 0xC0), CMARK_PLAIN_ROW(PLAIN, 0xD0),            \
+        CMARK_PLAIN_ROW(PLAIN, 0xE0), CMARK_PLAIN_ROW(PLAIN, 0xF0)             \
+  }
+// The bits of a byte from whether it's plain in each kind of escaping but
+// LITERAL.
+#define CMARK_PLAIN_BITS(normal, title, url)                                   \
+  (((normal) ? 1 << NORMAL : 0) | ((title) ? 1 << TITLE : 0) |                 \
+   ((url) ? 1 << URL : 0))
+
 typedef struct cmark_renderer cmark_renderer;
 
 void cmark_render_ascii(cmark_renderer *renderer, const char *s);
@@ -38,10 +68,41 @@ void cmark_render_code_point(cmark_renderer *renderer, uint32_t c);
 char *cmark_render(cmark_node *root, int options, int width,
                    void (*outc)(cmark_renderer *, cmark_escaping, int32_t,
                                 unsigned char),
+                   const unsigned char *plain_chars,
                    int (*render_node)(cmark_renderer *renderer,
                                       cmark_node *node,
                                       cmark_event_type ev_type, int options));
 
+// Like cmark_render, sending the output to 'sink'.  Returns 0 if the sink
+// failed.
+int cmark_render_to_sink(cmark_node *root, int options, int width,
+                         void (*outc)(cmark_renderer *, cmark_escaping,
+                                      int32_t, unsigned char),
+                         const unsigned char *plain_chars,
+                         int (*render_node)(cmark_renderer *renderer,
+                                            cmark_node *node,
+                                            cmark_event_type ev_type,
+                                            int options),
+                         cmark_sink *sink);
+
+// Renders the blocks of a document as HTML one after another, as
+// cmark_render_html_to_sink would the document, keeping what they share
+// (the ids given to headings) from one block to the next (see
+// pipeline.c).
+typedef struct cmark_html_stream cmark_html_stream;
+
+cmark_html_stream *cmark_html_stream_new(cmark_mem *mem, int options,
+                                         const cmark_url_map *urls,
+                                         cmark_sink *sink);
+
+// Render 'block' and the blocks below it.  Returns 0 if the sink failed.
+int cmark_html_stream_render(cmark_html_stream *stream, cmark_node *block);
+
+// Pass the rest of the output on to the sink.  Returns 0 if it failed.
+int cmark_html_stream_finish(cmark_html_stream *stream);
+
+void cmark_html_stream_free(cmark_html_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+
+#include "config.h"
+#include "cmark.h"
+#include "node.h"
+#include "iterator.h"
+#include "buffer.h"
+
+#define DEFAULT_SEPARATOR "\n\n"
+
+// Functions to convert cmark_nodes to plain text.
+
+struct render_state {
+  cmark_strbuf *text;
+  const char *separator;
+  // a block has begun whose text isn't separated from earlier text yet
+  bool new_block;
+};
+
+static void S_put(struct render_state *state, const unsigned char *data,
+                  bufsize_t len) {
+  if (len == 0) {
+    return;
+  }
+  if (state->new_block) {
+    if (state->text->size > 0) {
+      cmark_strbuf_puts(state->text, state->separator);
+    }
+    state->new_block = false;
+  }
+  cmark_strbuf_put(state->text, data, len);
+}
+
+static void S_render_node(cmark_node *node, cmark_event_type ev_type,
+                          struct render_state *state, int options) {
+  bufsize_t len;
+
+  if (ev_type != CMARK_EVENT_ENTER) {
+    return;
+  }
+
+  switch (node->type) {
+  case CMARK_NODE_PARAGRAPH:
+  case CMARK_NODE_HEADING:
+    state->new_block = true;
+    break;
+
+  case CMARK_NODE_CODE_BLOCK:
+    // without the newline ending the last line
+    len = node->len;
+    if (len > 0 && node->data[len - 1] == '\n') {
+      len--;
+    }
+    state->new_block = true;
+    S_put(state, node->data, len);
+    break;
+
+  case CMARK_NODE_TEXT:
+  case CMARK_NODE_CODE:
+    S_put(state, node->data, node->len);
+    break;
+
+  case CMARK_NODE_LINEBREAK:
+    S_put(state, (const unsigned char *)"\n", 1);
+    break;
+
+  case CMARK_NODE_SOFTBREAK:
+    if (options & CMARK_OPT_NOBREAKS) {
+      S_put(state, (const unsigned char *)" ", 1);
+    } else {
+      S_put(state, (const unsigned char *)"\n", 1);
+    }
+    break;
+
+  default:
+    // Raw HTML, custom output, link destinations and titles are left out;
+    // the text inside links, images and custom nodes is kept.
+    break;
+  }
+}
+
+// Render 'root' into 'text', passing the output on to 'sink' between
+// nodes if there is one, but for the last byte, so that the text is
+// still known not to be empty.  Returns 0 if the sink failed.
+static int S_render_text(cmark_node *root, int options, const char *separator,
+                         cmark_strbuf *text, cmark_sink *sink) {
+  cmark_event_type ev_type;
+  cmark_node *cur;
+  struct render_state state = {text, separator, false};
+  cmark_iter iter;
+
+  if (state.separator == NULL) {
+    state.separator = DEFAULT_SEPARATOR;
+  }
+
+  cmark_node_parse_pending_inlines(root);
+  cmark_iter_init(&iter, root);
+  while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+    cur = iter.cur.node;
+    S_render_node(cur, ev_type, &state, options);
+    if (sink != NULL && (size_t)text->size >= sink->flush_size &&
+        !cmark_strbuf_drain(text, text->size - 1, sink)) {
+      return 0;
+    }
+  }
+  if (text->size > 0) {
+    cmark_strbuf_putc(text, '\n');
+  }
+
+  return 1;
+}
+
+char *cmark_render_text(cmark_node *root, int options, const char *separator) {
+  cmark_strbuf text = CMARK_BUF_INIT(root->mem);
+
+  S_render_text(root, options, separator, &text, NULL);
+  return (char *)cmark_strbuf_detach(&text);
+}
+
+int cmark_render_text_to_sink(cmark_node *root, int options,
+                              const char *separator, cmark_sink *sink) {
+  cmark_strbuf text = CMARK_BUF_INIT(root->mem);
+  int ok = S_render_text(root, options, separator, &text, sink) &&
+           cmark_strbuf_drain(&text, text.size, sink);
+
+  cmark_strbuf_free(&text);
+  return ok;
+}
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "cmark.h"
+#include "url_map.h"
+
+#define URL_MAP_MIN_CAPACITY 16
+
+// 64-bit FNV-1a of a URL or prefix, apart for the two kinds.
+static uint64_t S_key_hash(const unsigned char *data, bufsize_t len,
+                           bool prefix) {
+  uint64_t hash = 14695981039346656037ULL;
+  bufsize_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  hash ^= prefix ? 1 : 2;
+  hash *= 1099511628211ULL;
+  return hash;
+}
+
+// The contribution of 'rewrite' to the hash of the whole map.
+static uint64_t S_rewrite_hash(const cmark_url_rewrite *rewrite) {
+  uint64_t hash = rewrite->hash;
+  bufsize_t i;
+
+  for (i = 0; i < rewrite->to_len; i++) {
+    hash ^= rewrite->to[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static cmark_url_rewrite *S_slot(const cmark_url_map *map,
+                                 const unsigned char *key, bufsize_t len,
+                                 bool prefix, uint64_t hash) {
+  size_t mask = map->capacity - 1;
+  size_t i = (size_t)hash & mask;
+  cmark_url_rewrite *slot;
+
+  for (;; i = (i + 1) & mask) {
+    slot = &map->table[i];
+    if (slot->from == NULL ||
+        (slot->hash == hash && slot->prefix == prefix &&
+         slot->from_len == len && memcmp(slot->from, key, len) == 0)) {
+      return slot;
+    }
+  }
+}
+
+static void S_grow(cmark_url_map *map) {
+  cmark_url_rewrite *old = map->table;
+  size_t old_capacity = map->capacity, i;
+
+  map->capacity = old_capacity ? old_capacity * 2 : URL_MAP_MIN_CAPACITY;
+  map->table = (cmark_url_rewrite *)map->mem->calloc(
+      map->capacity, sizeof(cmark_url_rewrite));
+  for (i = 0; i < old_capacity; i++) {
+    if (old[i].from != NULL) {
+      *S_slot(map, old[i].from, old[i].from_len, old[i].prefix,
+              old[i].hash) = old[i];
+    }
+  }
+  map->mem->free(old);
+}
+
+static unsigned char *S_copy(cmark_mem *mem, const char *data,
+                             bufsize_t len) {
+  unsigned char *copy = (unsigned char *)mem->calloc(len + 1, 1);
+
+  if (len > 0) {
+    memcpy(copy, data, len);
+  }
+  return copy;
+}
+
+// Record a new prefix length, keeping the list longest first.
+static void S_add_prefix_length(cmark_url_map *map, bufsize_t len) {
+  size_t i = 0;
+
+  while (i < map->prefix_count && map->prefix_lengths[i] > len) {
+    i++;
+  }
+  if (i < map->prefix_count && map->prefix_lengths[i] == len) {
+    return;
+  }
+  map->prefix_lengths = (bufsize_t *)map->mem->realloc(
+      map->prefix_lengths, (map->prefix_count + 1) * sizeof(bufsize_t));
+  memmove(map->prefix_lengths + i + 1, map->prefix_lengths + i,
+          (map->prefix_count - i) * sizeof(bufsize_t));
+  map->prefix_lengths[i] = len;
+  map->prefix_count++;
+}
+
+static int S_add(cmark_url_map *map, const char *from, size_t from_len,
+                 const char *to, size_t to_len, bool prefix) {
+  cmark_url_rewrite *slot;
+  uint64_t hash;
+
+  if (from_len > (size_t)(BUFSIZE_MAX / 2) || to_len > (size_t)(BUFSIZE_MAX / 2) ||
+      (from_len > 0 && memchr(from, 0, from_len) != NULL) ||
+      (to_len > 0 && memchr(to, 0, to_len) != NULL)) {
+    return 0;
+  }
+  if ((map->count + 1) * 2 > map->capacity) {
+    S_grow(map);
+  }
+
+  hash = S_key_hash((const unsigned char *)from, (bufsize_t)from_len, prefix);
+  slot = S_slot(map, (const unsigned char *)from, (bufsize_t)from_len, prefix,
+                hash);
+  if (slot->from != NULL) {
+    // a later rewrite of the same URL or prefix replaces the earlier one
+    map->hash -= S_rewrite_hash(slot);
+    map->mem->free(slot->to);
+  } else {
+    slot->from = S_copy(map->mem, from, (bufsize_t)from_len);
+    slot->from_len = (bufsize_t)from_len;
+    slot->prefix = prefix;
+    slot->hash = hash;
+    map->count++;
+    if (prefix) {
+      S_add_prefix_length(map, (bufsize_t)from_len);
+    }
+  }
+  slot->to = S_copy(map->mem, to, (bufsize_t)to_len);
+  slot->to_len = (bufsize_t)to_len;
+  map->hash += S_rewrite_hash(slot);
+  return 1;
+}
+
+cmark_url_map *cmark_url_map_new(void) {
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  cmark_url_map *map = (cmark_url_map *)mem->calloc(1, sizeof(cmark_url_map));
+
+  map->mem = mem;
+  return map;
+}
+
+int cmark_url_map_add_exact(cmark_url_map *map, const char *url,
+                            size_t url_len, const char *replacement,
+                            size_t replacement_len) {
+  return S_add(map, url, url_len, replacement, replacement_len, false);
+}
+
+int cmark_url_map_add_prefix(cmark_url_map *map, const char *prefix,
+                             size_t prefix_len, const char *replacement,
+                             size_t replacement_len) {
+  return S_add(map, prefix, prefix_len, replacement, replacement_len, true);
+}
+
+const cmark_url_rewrite *cmark_url_map_lookup(const cmark_url_map *map,
+                                              const unsigned char *url,
+                                              bufsize_t len) {
+  cmark_url_rewrite *slot;
+  size_t i;
+
+  if (map->count == 0) {
+    return NULL;
+  }
+  slot = S_slot(map, url, len, false, S_key_hash(url, len, false));
+  if (slot->from != NULL) {
+    return slot;
+  }
+  for (i = 0; i < map->prefix_count; i++) {
+    if (map->prefix_lengths[i] > len) {
+      continue;
+    }
+    slot = S_slot(map, url, map->prefix_lengths[i], true,
+                  S_key_hash(url, map->prefix_lengths[i], true));
+    if (slot->from != NULL) {
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+void cmark_url_map_free(cmark_url_map *map) {
+  size_t i;
+
+  if (map == NULL) {
+    return;
+  }
+  for (i = 0; i < map->capacity; i++) {
+    if (map->table[i].from != NULL) {
+      map->mem->free(map->table[i].from);
+      map->mem->free(map->table[i].to);
+    }
+  }
+  map->mem->free(map->table);
+  map->mem->free(map->prefix_lengths);
+  map->mem->free(map);
+}
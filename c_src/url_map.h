@@ -0,0 +1,51 @@
+#ifndef CMARK_URL_MAP_H
+#define CMARK_URL_MAP_H
+
+#include <stdint.h>
+
+#include "cmark.h"
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cmark_url_rewrite {
+  // NULL in an empty slot
+  unsigned char *from;
+  unsigned char *to;
+  bufsize_t from_len;
+  bufsize_t to_len;
+  bool prefix;
+  uint64_t hash;
+} cmark_url_rewrite;
+
+// Open-addressing hash table of the rewrites, exact and prefix ones
+// alike, keyed by the URL or prefix they replace.  `table` has `capacity`
+// slots (a power of two, or zero before the first rewrite) and is kept
+// at most half full.  `prefix_lengths` lists the distinct lengths of the
+// prefixes, longest first, so that a lookup tries each at most once.
+// `hash` combines all rewrites regardless of the order they were added
+// in, for caches of rendered HTML to key on.
+struct cmark_url_map {
+  cmark_mem *mem;
+  cmark_url_rewrite *table;
+  size_t capacity;
+  size_t count;
+  bufsize_t *prefix_lengths;
+  size_t prefix_count;
+  uint64_t hash;
+};
+
+// The rewrite of the 'len' bytes of 'url': the exact one if there is
+// one, or else the one of the longest prefix of 'url'.  NULL if none
+// applies.
+const cmark_url_rewrite *cmark_url_map_lookup(const cmark_url_map *map,
+                                              const unsigned char *url,
+                                              bufsize_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #include "cmark_ctype.h"
@@ -224,6 +225,25 @@ void cmark_utf8proc_encode_char(int32_t uc, cmark_strbuf *buf) {
   cmark_strbuf_put(buf, dst, len);
 }
 
+// Returns the length of the leading run of ASCII bytes in 'str',
+// testing eight bytes at a time.
+static bufsize_t S_ascii_run(const uint8_t *str, bufsize_t len) {
+  bufsize_t i = 0;
+  uint64_t word;
+
+  while (i + 8 <= len) {
+    memcpy(&word, str + i, 8);
+    if (word & UINT64_C(0x8080808080808080))
+      break;
+    i += 8;
+  }
+
+  while (i < len && str[i] < 0x80)
+    i++;
+
+  return i;
+}
+
 void cmark_utf8proc_case_fold(cmark_strbuf *dest, const uint8_t *str,
                               bufsize_t len) {
   int32_t c;
@@ -231,6 +251,24 @@ void cmark_utf8proc_case_fold(cmark_strbuf *dest, const uint8_t *str,
 #define bufpush(x) cmark_utf8proc_encode_char(x, dest)
 
   while (len > 0) {
+    // ASCII only folds A-Z, so copy runs of it and lower-case in place
+    // instead of decoding every code point.
+    bufsize_t ascii_len = S_ascii_run(str, len);
+
+    if (ascii_len > 0) {
+      bufsize_t i, start = dest->size;
+
+      cmark_strbuf_put(dest, str, ascii_len);
+      for (i = start; i < dest->size; i++) {
+        if (dest->ptr[i] >= 'A' && dest->ptr[i] <= 'Z')
+          dest->ptr[i] |= 0x20;
+      }
+
+      str += ascii_len;
+      len -= ascii_len;
+      continue;
+    }
+
     bufsize_t char_len = cmark_utf8proc_iterate(str, len, &c);
 
     if (char_len >= 0) {
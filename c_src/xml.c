@@ -6,6 +6,7 @@
 #include "config.h"
 #include "cmark.h"
 #include "node.h"
+#include "iterator.h"
 #include "buffer.h"
 #include "houdini.h"
 
@@ -153,24 +154,45 @@ static int S_render_node(cmark_node *node, cmark_event_type ev_type,
   return 1;
 }
 
-char *cmark_render_xml(cmark_node *root, int options) {
-  char *result;
-  cmark_strbuf xml = CMARK_BUF_INIT(root->mem);
+// Render 'root' into 'xml', passing the output on to 'sink' between nodes
+// if there is one.  Returns 0 if the sink failed.
+static int S_render_xml(cmark_node *root, int options, cmark_strbuf *xml,
+                        cmark_sink *sink) {
   cmark_event_type ev_type;
   cmark_node *cur;
-  struct render_state state = {&xml, 0};
+  struct render_state state = {xml, 0};
 
-  cmark_iter *iter = cmark_iter_new(root);
+  cmark_iter iter;
 
+  cmark_node_parse_pending_inlines(root);
+  cmark_iter_init(&iter, root);
   cmark_strbuf_puts(state.xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
   cmark_strbuf_puts(state.xml,
                     "<!DOCTYPE document SYSTEM \"CommonMark.dtd\">\n");
-  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
-    cur = cmark_iter_get_node(iter);
+  while ((ev_type = cmark_iter_step(&iter)) != CMARK_EVENT_DONE) {
+    cur = iter.cur.node;
     S_render_node(cur, ev_type, &state, options);
+    if (sink != NULL && (size_t)xml->size >= sink->flush_size &&
+        !cmark_strbuf_drain(xml, xml->size, sink)) {
+      return 0;
+    }
   }
-  result = (char *)cmark_strbuf_detach(&xml);
 
-  cmark_iter_free(iter);
-  return result;
+  return 1;
+}
+
+char *cmark_render_xml(cmark_node *root, int options) {
+  cmark_strbuf xml = CMARK_BUF_INIT(root->mem);
+
+  S_render_xml(root, options, &xml, NULL);
+  return (char *)cmark_strbuf_detach(&xml);
+}
+
+int cmark_render_xml_to_sink(cmark_node *root, int options, cmark_sink *sink) {
+  cmark_strbuf xml = CMARK_BUF_INIT(root->mem);
+  int ok = S_render_xml(root, options, &xml, sink) &&
+           cmark_strbuf_drain(&xml, xml.size, sink);
+
+  cmark_strbuf_free(&xml);
+  return ok;
 }
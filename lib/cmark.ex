@@ -10,6 +10,9 @@ defmodule Cmark do
       Render `softbreak` elements as hard line breaks.
     - `:nobreaks`
       Render `softbreak` elements as spaces.
+    - `:heading_ids`
+      Give each heading in the HTML an `id` made from its text, for
+      linking to it (`live/2` raises `ArgumentError` on it).
     - `:normalize`
       Normalize tree by consolidating adjacent text nodes.
     - `:smart`
@@ -17,11 +20,42 @@ defmodule Cmark do
     - `:validate_utf8`
       Validate UTF-8 in the input before parsing, replacing
       illegal sequences with the replacement character U+FFFD.
+    - `:lazy_inlines` -
+      Parse the inline content of paragraphs and headings as it is
+      rendered rather than before. The output is the same, but
+      `stream/3` sends its first chunk sooner and skips the rest of the
+      inline parsing when halted early. Inlines are then parsed on one
+      thread whatever `:threads` says.
     - `:unsafe`
       Allow raw HTML and unsafe links (`javascript:`, `vbscript:`, `file:`, and
       `data:`, except for `image/png`, `image/gif`, `image/jpeg`, or `image/webp`
       mime types). The default is to treat everything as unsafe, which replaces
       invalid nodes by a placeholder HTML comment and unsafe links by empty strings.
+    - `references: references` -
+      Resolve link references the document does not define itself from a
+      dictionary built once with `references/2`.
+    - `threads: count` -
+      Parse on up to `count` threads, which pays off for documents of a
+      few megabytes.  The result is the same as on a single thread, which
+      is the default.
+    - `cache: cache` -
+      Reuse the HTML of top-level blocks rendered before with a cache
+      built by `cache/1` (`to_html/2` only).
+    - `urls: url_map` -
+      Rewrite the URLs of links and images with a map built by
+      `url_map/1` as they are rendered (`to_html/2` only).
+    - `separator: separator` -
+      Put `separator` between blocks instead of a blank line (`to_text/2`
+      only).
+    - `chunk_size: bytes` -
+      Send the output in chunks of about `bytes` bytes, 64 KB by default
+      (`stream/3` only).
+    - `pipeline: true` -
+      Parse and render a top-level block at a time, letting go of each
+      block once it is rendered, so that memory follows the largest block
+      rather than the whole document.  Links can then only use the link
+      reference definitions that come before them (`stream/3` with
+      `:html` only).
 
   """
 
@@ -30,6 +64,22 @@ defmodule Cmark do
   @man_id 3
   @commonmark_id 4
   @latex_id 5
+  @text_id 6
+
+  @formats %{
+    html: @html_id,
+    xml: @xml_id,
+    man: @man_id,
+    commonmark: @commonmark_id,
+    latex: @latex_id,
+    text: @text_id
+  }
+
+  # Options given as {option, value} rather than as a flag.
+  @keyword_options [:references, :threads, :cache, :urls, :separator, :chunk_size, :pipeline]
+
+  # Chunks stream/3 renders ahead of the consumer.
+  @stream_window 4
 
   # c_src/cmark.h -> CMARK_OPT_*
   @flags %{
@@ -45,13 +95,52 @@ defmodule Cmark do
     validate_utf8: 512,
     # (1 <<< 10)
     smart: 1024,
+    # (1 <<< 11)
+    lazy_inlines: 2048,
+    # (1 <<< 12)
+    heading_ids: 4096,
     # (1 <<< 17)
     unsafe: 131_072
   }
 
+  @typedoc "A reference dictionary built by `references/2`"
+  @opaque references :: reference
+
+  @typedoc "A cache of rendered blocks built by `cache/1`"
+  @opaque cache :: reference
+
+  @typedoc "A map of URL rewrites built by `url_map/1`"
+  @opaque url_map :: reference
+
+  @typedoc "A document being edited, built by `live/2`"
+  @opaque live :: reference
+
+  @typedoc "A parsed document kept for rendering, built by `compact/2`"
+  @opaque compact :: reference
+
   @typedoc "A list of atoms describing the options to use (see module docs)"
   @type options_list ::
-          [:sourcepos | :hardbreaks | :nobreaks | :normalize | :validate_utf8 | :smart | :unsafe]
+          [
+            :sourcepos
+            | :hardbreaks
+            | :nobreaks
+            | :normalize
+            | :validate_utf8
+            | :smart
+            | :heading_ids
+            | :lazy_inlines
+            | :unsafe
+            | {:references, references}
+            | {:threads, pos_integer}
+            | {:cache, cache}
+            | {:urls, url_map}
+            | {:separator, String.t()}
+            | {:chunk_size, pos_integer}
+            | {:pipeline, boolean}
+          ]
+
+  @typedoc "An output format for `stream/3`"
+  @type format :: :html | :xml | :man | :commonmark | :latex | :text
 
   @doc ~S"""
   Converts the Markdown document to HTML.
@@ -67,7 +156,88 @@ defmodule Cmark do
   @spec to_html(String.t(), options_list) :: String.t()
   def to_html(document, options_list \\ [])
       when is_binary(document) and is_list(options_list) do
-    convert(document, options_list, @html_id)
+    case {List.keyfind(options_list, :cache, 0), List.keyfind(options_list, :urls, 0)} do
+      {nil, nil} ->
+        convert(document, options_list, @html_id)
+
+      {cache, urls} ->
+        Cmark.Nif.render_html(
+          document,
+          bitflag(options_list),
+          references_option(options_list),
+          threads_option(options_list),
+          with({:cache, cache} <- cache, do: cache),
+          with({:urls, urls} <- urls, do: urls)
+        )
+    end
+  end
+
+  @doc ~S"""
+  Converts the Markdown document to HTML one top-level block at a time.
+
+  Returns a `{lines, key, html}` tuple for each block, where `lines` is
+  the range of source lines the block spans and `key` a 64-bit hash of
+  its source, the options and the link reference definitions it may
+  refer to, taken before it is rendered. Joined, the fragments equal
+  `to_html/2` of the document, so a preview can compare keys with those
+  of the previous render and only replace the blocks that changed.
+
+  See `Cmark` module docs for all options.
+
+  ## Examples
+
+      iex> [{1..1, _key, "<h1>Title</h1>\n"}, {3..4, _, paragraph}] =
+      ...>   Cmark.to_html_blocks("# Title\n\nSome *text*\nover two lines")
+      iex> paragraph
+      "<p>Some <em>text</em>\nover two lines</p>\n"
+
+  """
+  @spec to_html_blocks(String.t(), options_list) ::
+          [{Range.t(), non_neg_integer, String.t()}]
+  def to_html_blocks(document, options_list \\ [])
+      when is_binary(document) and is_list(options_list) do
+    document
+    |> Cmark.Nif.render_blocks(
+      bitflag(options_list),
+      references_option(options_list),
+      threads_option(options_list)
+    )
+    |> Enum.map(fn {first, last, hash, html} -> {first..last, hash, html} end)
+  end
+
+  @doc ~S"""
+  Converts the beginning of the Markdown document to HTML, for previews.
+
+  `limits` is a keyword list with `:blocks`, the number of top-level
+  blocks to keep, and `:chars`, the number of characters of text to keep
+  in them. Text beyond `:chars` is cut at the end of the last word before
+  it and followed by an ellipsis, and the elements it was in are closed.
+  With `:unsafe`, the text of the last block is also cut before any raw
+  inline HTML, whose elements might otherwise be left open. Only as much
+  of the document is parsed as the excerpt needs.
+
+  See `Cmark` module docs for all options except `:threads` and `:cache`.
+
+  ## Examples
+
+      iex> Cmark.to_html_excerpt("# Title\n\nSome *text*.\n\nMore.", blocks: 2)
+      "<h1>Title</h1>\n<p>Some <em>text</em>.</p>\n"
+
+      iex> Cmark.to_html_excerpt("# Title\n\nFirst paragraph.", chars: 12)
+      "<h1>Title</h1>\n<p>First…</p>\n"
+
+  """
+  @spec to_html_excerpt(String.t(), [blocks: pos_integer, chars: pos_integer], options_list) ::
+          String.t()
+  def to_html_excerpt(document, limits, options_list \\ [])
+      when is_binary(document) and is_list(limits) and is_list(options_list) do
+    Cmark.Nif.render_excerpt(
+      document,
+      bitflag(options_list),
+      references_option(options_list),
+      Keyword.get(limits, :blocks, 0),
+      Keyword.get(limits, :chars, 0)
+    )
   end
 
   @doc ~S"""
@@ -87,6 +257,41 @@ defmodule Cmark do
     convert(document, options_list, @xml_id)
   end
 
+  @doc ~S"""
+  Converts the Markdown document to HTML with an `id` on each heading,
+  and lists the headings for a table of contents in the same pass.
+
+  Ids are made from the text of headings: letters are lowercased,
+  spaces become dashes and punctuation is dropped. An id used before in
+  the document gets a `-1`, `-2`, ... suffix.
+
+  Returns `{html, toc}`, where `toc` holds a
+  `%{level: level, id: id, text: text}` map for each heading.
+
+  See `Cmark` module docs for all options except `:cache`.
+
+  ## Examples
+
+      iex> Cmark.to_html_toc("# Intro\n\n## Intro")
+      {"<h1 id=\"intro\">Intro</h1>\n<h2 id=\"intro-1\">Intro</h2>\n",
+       [%{level: 1, id: "intro", text: "Intro"}, %{level: 2, id: "intro-1", text: "Intro"}]}
+
+  """
+  @spec to_html_toc(String.t(), options_list) ::
+          {String.t(), [%{level: 1..6, id: String.t(), text: String.t()}]}
+  def to_html_toc(document, options_list \\ [])
+      when is_binary(document) and is_list(options_list) do
+    {html, toc} =
+      Cmark.Nif.render_toc(
+        document,
+        bitflag(options_list),
+        references_option(options_list),
+        threads_option(options_list)
+      )
+
+    {html, Enum.map(toc, fn {level, id, text} -> %{level: level, id: id, text: text} end)}
+  end
+
   @doc ~S"""
   Converts the Markdown document to Manpage.
 
@@ -138,8 +343,461 @@ defmodule Cmark do
     convert(document, options_list, @latex_id)
   end
 
+  @doc ~S"""
+  Converts the Markdown document to plain text, for instance to index it
+  for search.
+
+  Only the text of paragraphs, headings and code blocks is kept: links
+  and images are reduced to their text and raw HTML is left out. Blocks
+  are separated by a blank line, or by the `:separator` option, which
+  must be a string.
+
+  See `Cmark` module docs for all options.
+
+  ## Examples
+
+      iex> Cmark.to_text("# Title\n\nSee [the docs](https://example.com) <b>now</b>")
+      "Title\n\nSee the docs now\n"
+
+      iex> Cmark.to_text("- one\n- two", separator: "\n")
+      "one\ntwo\n"
+
+  """
+  @spec to_text(String.t(), options_list) :: String.t()
+  def to_text(document, options_list \\ [])
+      when is_binary(document) and is_list(options_list) do
+    case List.keyfind(options_list, :separator, 0) do
+      nil ->
+        convert(document, options_list, @text_id)
+
+      {:separator, separator} when is_binary(separator) ->
+        Cmark.Nif.render_text(
+          document,
+          bitflag(options_list),
+          references_option(options_list),
+          threads_option(options_list),
+          separator
+        )
+
+      {:separator, separator} ->
+        raise ArgumentError, "expected :separator to be a string, got: #{inspect(separator)}"
+    end
+  end
+
+  @doc ~S"""
+  Converts the Markdown document to `format`, returning a stream of
+  chunks of the output rather than the output as a whole.
+
+  The document is rendered on a thread of its own, which sends each
+  chunk as soon as it is produced but stays at most a few chunks ahead
+  of the consumer, so the whole output never has to be held in memory,
+  however slowly it is consumed. Together with `Stream.into/2`, the output can be
+  written to a file as it is rendered:
+
+      document
+      |> Cmark.stream(:html)
+      |> Stream.into(File.stream!("doc.html"))
+      |> Stream.run()
+
+  Halting the stream early stops the rendering.
+
+  With `pipeline: true`, the tree of the document is never built whole
+  either: each top-level block is rendered as soon as it ends and then
+  freed, which keeps the memory used by huge documents (logs,
+  concatenated archives) small. The output is the same as without it as
+  long as link reference definitions come before the links using them.
+  Only the `:html` format can be pipelined.
+
+  See `Cmark` module docs for all options except `:cache` and
+  `:separator`.
+
+  ## Examples
+
+      iex> Cmark.stream("# Title\n\nText", :html) |> Enum.join()
+      "<h1>Title</h1>\n<p>Text</p>\n"
+
+  """
+  @spec stream(String.t(), format, options_list) :: Enumerable.t()
+  def stream(document, format \\ :html, options_list \\ [])
+      when is_binary(document) and is_list(options_list) do
+    format_id =
+      case Map.fetch(@formats, format) do
+        {:ok, format_id} -> format_id
+        :error -> raise ArgumentError, "unknown format: #{inspect(format)}"
+      end
+
+    bitflag = bitflag(options_list)
+    references = references_option(options_list)
+    threads = threads_option(options_list)
+    urls = with {:urls, urls} <- List.keyfind(options_list, :urls, 0), do: urls
+
+    chunk_size =
+      case List.keyfind(options_list, :chunk_size, 0) do
+        nil -> 65_536
+        {:chunk_size, size} when is_integer(size) and size > 0 -> size
+        {:chunk_size, size} ->
+          raise ArgumentError,
+                "expected :chunk_size to be a positive integer, got: #{inspect(size)}"
+      end
+
+    pipeline =
+      case List.keyfind(options_list, :pipeline, 0) do
+        nil -> false
+        {:pipeline, false} -> false
+        {:pipeline, true} when format == :html -> true
+        {:pipeline, true} -> raise ArgumentError, "pipeline: true needs the :html format"
+        {:pipeline, value} ->
+          raise ArgumentError, "expected :pipeline to be a boolean, got: #{inspect(value)}"
+      end
+
+    Stream.resource(
+      fn ->
+        ref = make_ref()
+
+        stream =
+          if pipeline do
+            Cmark.Nif.render_pipeline(
+              document,
+              bitflag,
+              references,
+              urls,
+              ref,
+              chunk_size,
+              @stream_window
+            )
+          else
+            Cmark.Nif.render_stream(
+              document,
+              bitflag,
+              format_id,
+              references,
+              threads,
+              urls,
+              ref,
+              chunk_size,
+              @stream_window
+            )
+          end
+
+        {ref, stream}
+      end,
+      fn {ref, stream} ->
+        receive do
+          {^ref, :done} ->
+            {:halt, :done}
+
+          {^ref, chunk} ->
+            :ok = Cmark.Nif.stream_ack(stream)
+            {[chunk], {ref, stream}}
+        end
+      end,
+      fn
+        :done ->
+          :ok
+
+        {ref, stream} ->
+          :ok = Cmark.Nif.stream_cancel(stream)
+          await_done(ref)
+      end
+    )
+  end
+
+  @doc ~S"""
+  Collects metadata about the Markdown document in one pass over its
+  tree, without rendering it.
+
+  Returns a map with:
+
+    - `:headings` -
+      A `%{level: level, text: text, lines: lines}` map for each heading,
+      where `text` is its plain text and `lines` the range of source
+      lines it spans.
+    - `:links` and `:images` -
+      A `%{url: url, title: title}` map for each link or image.
+    - `:code_blocks` -
+      The info string of each code block, empty for indented ones.
+    - `:words` -
+      The number of words in the text of the document.
+
+  See `Cmark` module docs for all options except `:cache`.
+
+  ## Examples
+
+      iex> Cmark.metadata("# Intro\n\nSee [docs](/docs \"Docs\") and ![logo](/logo.png).\n\n```elixir\nIO.puts(1)\n```")
+      %{
+        headings: [%{level: 1, text: "Intro", lines: 1..1}],
+        links: [%{url: "/docs", title: "Docs"}],
+        images: [%{url: "/logo.png", title: ""}],
+        code_blocks: ["elixir"],
+        words: 5
+      }
+
+  """
+  @spec metadata(String.t(), options_list) :: %{
+          headings: [%{level: 1..6, text: String.t(), lines: Range.t()}],
+          links: [%{url: String.t(), title: String.t()}],
+          images: [%{url: String.t(), title: String.t()}],
+          code_blocks: [String.t()],
+          words: non_neg_integer
+        }
+  def metadata(document, options_list \\ [])
+      when is_binary(document) and is_list(options_list) do
+    {headings, links, images, code_blocks, words} =
+      Cmark.Nif.metadata(
+        document,
+        bitflag(options_list),
+        references_option(options_list),
+        threads_option(options_list)
+      )
+
+    %{
+      headings:
+        Enum.map(headings, fn {level, text, first, last} ->
+          %{level: level, text: text, lines: first..last}
+        end),
+      links: Enum.map(links, fn {url, title} -> %{url: url, title: title} end),
+      images: Enum.map(images, fn {url, title} -> %{url: url, title: title} end),
+      code_blocks: code_blocks,
+      words: words
+    }
+  end
+
+  @doc ~S"""
+  Builds a reference dictionary from the link reference definitions in
+  `document`; everything else in the document is ignored.
+
+  The dictionary is parsed once and can be passed to any of the `to_*`
+  functions with the `:references` option, from any process. Links the
+  rendered document defines itself take precedence over the dictionary.
+
+  ## Examples
+
+      iex> refs = Cmark.references("[home]: https://example.com")
+      iex> Cmark.to_html("[home]", references: refs)
+      "<p><a href=\"https://example.com\">home</a></p>\n"
+
+  """
+  @spec references(String.t(), options_list) :: references
+  def references(document, options_list \\ [])
+      when is_binary(document) and is_list(options_list) do
+    Cmark.Nif.parse_references(document, bitflag(options_list))
+  end
+
+  @doc ~S"""
+  Builds a cache of rendered blocks holding up to about `max_bytes`.
+
+  Passed to `to_html/2` with the `:cache` option, the cache keeps the
+  HTML of each top-level block, keyed by the block's source, the options
+  and the link reference definitions of the document, and serves it
+  whenever the same block is rendered again. The block structure of the
+  document is still parsed every time; the inlines are parsed and
+  rendered only for blocks not found. The least recently used blocks
+  are dropped to stay within `max_bytes`. The cache can be shared by any
+  number of processes.
+
+  ## Examples
+
+      iex> cache = Cmark.cache(1_000_000)
+      iex> Cmark.to_html("# Title\n\nText", cache: cache)
+      "<h1>Title</h1>\n<p>Text</p>\n"
+      iex> Cmark.to_html("# Title\n\nMore text", cache: cache)
+      "<h1>Title</h1>\n<p>More text</p>\n"
+      iex> Cmark.cache_stats(cache).hits
+      1
+
+  """
+  @spec cache(pos_integer) :: cache
+  def cache(max_bytes) when is_integer(max_bytes) and max_bytes > 0 do
+    Cmark.Nif.cache_new(max_bytes)
+  end
+
+  @doc """
+  Reports how a cache built by `cache/1` has been used: the number of
+  blocks found and not found, the share of lookups that found a block,
+  and the number and total size of the blocks held.
+  """
+  @spec cache_stats(cache) :: %{
+          hits: non_neg_integer,
+          misses: non_neg_integer,
+          hit_rate: float,
+          entries: non_neg_integer,
+          bytes: non_neg_integer
+        }
+  def cache_stats(cache) do
+    {hits, misses, entries, bytes} = Cmark.Nif.cache_stats(cache)
+    lookups = hits + misses
+    hit_rate = if lookups > 0, do: hits / lookups, else: 0.0
+    %{hits: hits, misses: misses, hit_rate: hit_rate, entries: entries, bytes: bytes}
+  end
+
+  @doc ~S"""
+  Builds a map of rewrites for the URLs of links and images, applied
+  by `to_html/2` with the `:urls` option as the HTML is rendered.
+
+  `rewrites` is a keyword list with:
+
+    - `:exact` -
+      A map or list of `{url, replacement}` pairs replacing whole URLs.
+    - `:prefixes` -
+      A map or list of `{prefix, replacement}` pairs replacing the
+      beginning of URLs that start with `prefix`.
+
+  The exact rewrite of a URL takes precedence, then that of its longest
+  prefix. The result is checked like any other URL, so rewriting to a
+  `javascript:` URL yields an empty one unless `:unsafe` is given. The
+  map can be shared by any number of processes.
+
+  ## Examples
+
+      iex> urls = Cmark.url_map(exact: %{"/old" => "/new"}, prefixes: [{"/img/", "https://cdn.example.com/"}])
+      iex> Cmark.to_html("[Moved](/old) ![Logo](/img/logo.png)", urls: urls)
+      "<p><a href=\"/new\">Moved</a> <img src=\"https://cdn.example.com/logo.png\" alt=\"Logo\" /></p>\n"
+
+  """
+  @spec url_map([exact: Enumerable.t(), prefixes: Enumerable.t()]) :: url_map
+  def url_map(rewrites) when is_list(rewrites) do
+    Cmark.Nif.url_map_new(
+      rewrites |> Keyword.get(:exact, []) |> Enum.to_list(),
+      rewrites |> Keyword.get(:prefixes, []) |> Enum.to_list()
+    )
+  end
+
+  @doc ~S"""
+  Parses `document` for editing, as in a live preview.
+
+  Edits made with `edit/3` re-parse only the top-level blocks around the
+  changed text, which makes them much cheaper than parsing the whole
+  document, though the source is still copied on each edit. The options
+  apply to both parsing and rendering; `:references` and `:threads` are
+  ignored. `:heading_ids` raises `ArgumentError`, as ids made unique
+  across the document would change in blocks an edit does not touch.
+
+  ## Examples
+
+      iex> doc = Cmark.live("# Title\n\nFirst paragraph\n\nSecond")
+      iex> Cmark.live_html(doc)
+      "<h1>Title</h1>\n<p>First paragraph</p>\n<p>Second</p>\n"
+
+  """
+  @spec live(String.t(), options_list) :: live
+  def live(document, options_list \\ [])
+      when is_binary(document) and is_list(options_list) do
+    if :heading_ids in options_list do
+      raise ArgumentError, ":heading_ids is not supported by live documents"
+    end
+
+    Cmark.Nif.live_new(document, bitflag(options_list))
+  end
+
+  @doc ~S"""
+  Replaces the `length` bytes of the source of `live` starting at byte
+  `offset` with `replacement`.
+
+  Returns `{index, removed, fragments}`: the `removed` top-level blocks
+  starting at `index` were replaced with the blocks whose HTML is listed
+  in `fragments`, which lets a preview patch its output instead of
+  rendering the whole document. The result always matches `to_html/2`
+  of the edited source. With `:sourcepos`, an edit adding or removing
+  lines also replaces all the blocks after it, whose positions move.
+  Raises `ArgumentError` if the range does not lie within the source.
+
+  ## Examples
+
+      iex> doc = Cmark.live("# Title\n\nFirst paragraph\n\nSecond")
+      iex> Cmark.edit(doc, {9, 5}, "Opening")
+      {0, 2, ["<h1>Title</h1>\n", "<p>Opening paragraph</p>\n"]}
+      iex> Cmark.live_html(doc)
+      "<h1>Title</h1>\n<p>Opening paragraph</p>\n<p>Second</p>\n"
+
+  """
+  @spec edit(live, {non_neg_integer, non_neg_integer}, String.t()) ::
+          {non_neg_integer, non_neg_integer, [String.t()]}
+  def edit(live, {offset, length}, replacement)
+      when is_integer(offset) and offset >= 0 and is_integer(length) and length >= 0 and
+             is_binary(replacement) do
+    Cmark.Nif.live_edit(live, offset, length, replacement)
+  end
+
+  @doc """
+  Renders the current state of `live` as HTML.
+  """
+  @spec live_html(live) :: String.t()
+  def live_html(live) do
+    Cmark.Nif.live_render(live)
+  end
+
+  @doc ~S"""
+  Parses `document` into a compact tree, for documents that are kept
+  around to be rendered again and again.
+
+  The tree takes a fraction of the memory of a parsed document and
+  renders faster; rendering it with `compact_html/1` gives the same
+  output as `to_html/2`. The options apply to both parsing and
+  rendering; `:cache` and `:urls` are ignored.
+
+  ## Examples
+
+      iex> doc = Cmark.compact("# Title\n\nSome *text*")
+      iex> Cmark.compact_html(doc)
+      "<h1>Title</h1>\n<p>Some <em>text</em></p>\n"
+
+  """
+  @spec compact(String.t(), options_list) :: compact
+  def compact(document, options_list \\ [])
+      when is_binary(document) and is_list(options_list) do
+    Cmark.Nif.compact_new(
+      document,
+      bitflag(options_list),
+      references_option(options_list),
+      threads_option(options_list)
+    )
+  end
+
+  @doc """
+  Renders a compact tree built by `compact/2` as HTML.
+  """
+  @spec compact_html(compact) :: String.t()
+  def compact_html(compact) do
+    Cmark.Nif.compact_render(compact)
+  end
+
   defp convert(document, options_list, format_id) when is_integer(format_id) do
-    bitflag = Enum.reduce(options_list, 0, fn flag, acc -> Map.fetch!(@flags, flag) + acc end)
-    Cmark.Nif.render(document, bitflag, format_id)
+    Cmark.Nif.render(
+      document,
+      bitflag(options_list),
+      format_id,
+      references_option(options_list),
+      threads_option(options_list)
+    )
+  end
+
+  defp await_done(ref) do
+    receive do
+      {^ref, :done} -> :ok
+      {^ref, _chunk} -> await_done(ref)
+    end
+  end
+
+  defp references_option(options_list) do
+    with {:references, references} <- List.keyfind(options_list, :references, 0),
+         do: references
+  end
+
+  defp threads_option(options_list) do
+    case List.keyfind(options_list, :threads, 0) do
+      nil -> 1
+      {:threads, threads} when is_integer(threads) and threads > 0 -> threads
+      {:threads, threads} ->
+        raise ArgumentError,
+              "expected :threads to be a positive integer, got: #{inspect(threads)}"
+    end
+  end
+
+  defp bitflag(options_list) do
+    Enum.reduce(options_list, 0, fn
+      {option, _value}, acc when option in @keyword_options -> acc
+      {option, _value}, _acc -> raise ArgumentError, "unknown option: #{inspect(option)}"
+      flag, acc -> Map.fetch!(@flags, flag) + acc
+    end)
   end
 end
@@ -13,4 +13,152 @@ defmodule Cmark.Nif do
   @spec render(String.t(), integer, integer) :: String.t()
   def render(_data, _options, _format),
     do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec render(String.t(), integer, integer, reference) :: String.t()
+  def render(_data, _options, _format, _references),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec render(String.t(), integer, integer, reference | nil, pos_integer) :: String.t()
+  def render(_data, _options, _format, _references, _threads),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec render_stream(
+          String.t(),
+          integer,
+          integer,
+          reference | nil,
+          pos_integer,
+          reference | nil,
+          reference,
+          pos_integer,
+          pos_integer
+        ) :: reference
+  def render_stream(
+        _data,
+        _options,
+        _format,
+        _references,
+        _threads,
+        _urls,
+        _ref,
+        _chunk_size,
+        _window
+      ),
+      do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec render_pipeline(
+          String.t(),
+          integer,
+          reference | nil,
+          reference | nil,
+          reference,
+          pos_integer,
+          pos_integer
+        ) :: reference
+  def render_pipeline(_data, _options, _references, _urls, _ref, _chunk_size, _window),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec stream_ack(reference) :: :ok
+  def stream_ack(_stream),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec stream_cancel(reference) :: :ok
+  def stream_cancel(_stream),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec render_blocks(String.t(), integer, reference | nil, pos_integer) ::
+          [{pos_integer, pos_integer, non_neg_integer, String.t()}]
+  def render_blocks(_data, _options, _references, _threads),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec render_excerpt(String.t(), integer, reference | nil, non_neg_integer, non_neg_integer) ::
+          String.t()
+  def render_excerpt(_data, _options, _references, _max_blocks, _max_chars),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec render_toc(String.t(), integer, reference | nil, pos_integer) ::
+          {String.t(), [{pos_integer, String.t(), String.t()}]}
+  def render_toc(_data, _options, _references, _threads),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec render_text(String.t(), integer, reference | nil, pos_integer, String.t()) ::
+          String.t()
+  def render_text(_data, _options, _references, _threads, _separator),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec metadata(String.t(), integer, reference | nil, pos_integer) ::
+          {[{pos_integer, String.t(), pos_integer, pos_integer}], [{String.t(), String.t()}],
+           [{String.t(), String.t()}], [String.t()], non_neg_integer}
+  def metadata(_data, _options, _references, _threads),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec render_html(
+          String.t(),
+          integer,
+          reference | nil,
+          pos_integer,
+          reference | nil,
+          reference | nil
+        ) :: String.t()
+  def render_html(_data, _options, _references, _threads, _cache, _urls),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec cache_new(pos_integer) :: reference
+  def cache_new(_max_size),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec cache_stats(reference) ::
+          {non_neg_integer, non_neg_integer, non_neg_integer, non_neg_integer}
+  def cache_stats(_cache),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec parse_references(String.t(), integer) :: reference
+  def parse_references(_data, _options),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec url_map_new([{String.t(), String.t()}], [{String.t(), String.t()}]) :: reference
+  def url_map_new(_exact, _prefixes),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec live_new(String.t(), integer) :: reference
+  def live_new(_data, _options),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec live_edit(reference, non_neg_integer, non_neg_integer, String.t()) ::
+          {non_neg_integer, non_neg_integer, [String.t()]}
+  def live_edit(_live, _offset, _length, _replacement),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec live_render(reference) :: String.t()
+  def live_render(_live),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec compact_new(String.t(), integer, reference | nil, pos_integer) :: reference
+  def compact_new(_data, _options, _references, _threads),
+    do: exit(:nif_library_not_loaded)
+
+  @doc false
+  @spec compact_render(reference) :: String.t()
+  def compact_render(_compact),
+    do: exit(:nif_library_not_loaded)
 end
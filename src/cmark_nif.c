@@ -13,6 +13,126 @@
 #define FORMAT_MAN 3
 #define FORMAT_COMMONMARK 4
 #define FORMAT_LATEX 5
+#define FORMAT_TEXT 6
+
+static ErlNifResourceType *REFERENCES_RESOURCE_TYPE = NULL;
+static ErlNifResourceType *LIVE_DOCUMENT_RESOURCE_TYPE = NULL;
+static ErlNifResourceType *BLOCK_CACHE_RESOURCE_TYPE = NULL;
+static ErlNifResourceType *URL_MAP_RESOURCE_TYPE = NULL;
+static ErlNifResourceType *STREAM_RESOURCE_TYPE = NULL;
+static ErlNifResourceType *COMPACT_RESOURCE_TYPE = NULL;
+
+typedef struct {
+  cmark_reference_map *map;
+} references_resource;
+
+typedef struct {
+  cmark_block_cache *cache;
+} block_cache_resource;
+
+typedef struct {
+  cmark_url_map *map;
+} url_map_resource;
+
+// A streaming render.  It runs on a thread of its own, which can wait
+// for the consumer between chunks without holding up a scheduler, and
+// sends the chunks to the process that started it.  The state is shared
+// by that thread and the stream resource held by the consumer, and freed
+// by whichever lets go of it last.
+typedef struct stream_state {
+  ErlNifMutex  *lock;
+  ErlNifCond   *acked;
+  // chunks that may still be sent before the consumer takes one
+  unsigned long credit;
+  int           cancelled;
+  // guarded by STREAMS_LOCK
+  int           refs;
+  int           finished;
+  struct stream_state *next;
+  ErlNifTid     tid;
+  ErlNifPid     pid;
+  // holds the document, the tag and the chunk being sent
+  ErlNifEnv    *env;
+  ErlNifEnv    *msg_env;
+  ERL_NIF_TERM  ref;
+  ErlNifBinary  markdown;
+  int           options;
+  // as for render/3, or 0 for the HTML pipeline
+  int           format;
+  int           threads;
+  unsigned long chunk_size;
+  references_resource *references;
+  url_map_resource    *urls;
+} stream_state;
+
+typedef struct {
+  stream_state *state;
+} stream_resource;
+
+typedef struct {
+  cmark_compact *tree;
+  int options;
+} compact_resource;
+
+typedef struct {
+  cmark_live_document *doc;
+  ErlNifMutex *lock;
+  int options;
+} live_document_resource;
+
+// Parser threads are started through the VM, which then knows of them.
+static char PARSE_THREAD_NAME[] = "cmark_parse";
+
+static int nif_thread_create(void **thread, void *(*start)(void *),
+                             void *arg) {
+  ErlNifTid tid;
+
+  if (enif_thread_create(PARSE_THREAD_NAME, &tid, start, arg, NULL) != 0) {
+    return -1;
+  }
+  *thread = (void *)tid;
+  return 0;
+}
+
+static void nif_thread_join(void *thread) {
+  enif_thread_join((ErlNifTid)thread, NULL);
+}
+
+static const cmark_thread_functions NIF_THREAD_FUNCTIONS = {
+  nif_thread_create, nif_thread_join
+};
+
+// Set up a parser for a document, on as many threads as given.
+static cmark_parser *new_parser(int options, references_resource *references,
+                                int threads) {
+  cmark_parser *parser = cmark_parser_new(options);
+
+  cmark_parser_set_thread_functions(parser, &NIF_THREAD_FUNCTIONS);
+  if (references != NULL) {
+    cmark_parser_set_reference_dictionary(parser, references->map);
+  }
+  if (threads > 1) {
+    cmark_parser_set_threads(parser, threads);
+  }
+
+  return parser;
+}
+
+static cmark_node *parse(ErlNifBinary *markdown_binary, int options,
+                         references_resource *references, int threads) {
+  cmark_parser *parser;
+  cmark_node   *doc;
+
+  parser = new_parser(options, references, threads);
+  doc = cmark_parser_parse_document(
+    parser,
+    (const char *)markdown_binary->data,
+    markdown_binary->size
+  );
+  cmark_parser_free(parser);
+
+  return doc;
+}
 
 /*
  * Expose cmark parsers to Elixir via NIF
@@ -23,6 +143,13 @@
  * 2. formatting options (int)
  * 3. writer to use (int)
  *
+ * An optional 4th argument is a reference dictionary (resource) created
+ * by parse_references/2, used for labels the document does not define,
+ * or nil.
+ *
+ * An optional 5th argument is the number of threads the parser may use
+ * (int), 1 by default.
+ *
  */
 static ERL_NIF_TERM render(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
   ErlNifBinary  markdown_binary;
@@ -32,8 +159,10 @@ static ERL_NIF_TERM render(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
   size_t        output_len;
   int           options = 0;
   int           format = 1;
+  int           threads = 1;
+  references_resource *references = NULL;
 
-  if (argc != 3) {
+  if (argc < 3 || argc > 5) {
     return enif_make_badarg(env);
   }
 
@@ -45,15 +174,21 @@ static ERL_NIF_TERM render(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
   enif_get_int(env, argv[2], &format);
 
   // Ensure we are not outside of the expected range of formats
-  if(format < 1 || format > 5){
+  if(format < 1 || format > 6){
     return enif_make_badarg(env);
   }
 
-  doc = cmark_parse_document(
-    (const char *)markdown_binary.data,
-    markdown_binary.size,
-    options
-  );
+  if(argc >= 4 && !enif_is_identical(argv[3], enif_make_atom(env, "nil")) &&
+     !enif_get_resource(env, argv[3], REFERENCES_RESOURCE_TYPE,
+                        (void **)&references)){
+    return enif_make_badarg(env);
+  }
+
+  if(argc == 5 && (!enif_get_int(env, argv[4], &threads) || threads < 1)){
+    return enif_make_badarg(env);
+  }
+
+  doc = parse(&markdown_binary, options, references, threads);
 
   switch (format) {
     case FORMAT_HTML:
@@ -71,6 +206,9 @@ static ERL_NIF_TERM render(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
     case FORMAT_LATEX:
       output = cmark_render_latex(doc, options, 0);
       break;
+    case FORMAT_TEXT:
+      output = cmark_render_text(doc, options, NULL);
+      break;
     default: // fallback to something that works
       fprintf(stderr, "cmark_nif: unknown format %d\n", format);
       output = cmark_render_commonmark(doc, options, 0);
@@ -88,16 +226,1537 @@ static ERL_NIF_TERM render(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[])
   return enif_make_binary(env, &output_binary);
 };
 
-int reload(ErlNifEnv* _env, void** _priv_data, ERL_NIF_TERM _load_info) {
-  return 0;
+// Streams whose thread has not been joined yet.
+static ErlNifMutex  *STREAMS_LOCK = NULL;
+static stream_state *STREAMS = NULL;
+
+static void stream_release(stream_state *state) {
+  int last;
+
+  enif_mutex_lock(STREAMS_LOCK);
+  last = --state->refs == 0;
+  enif_mutex_unlock(STREAMS_LOCK);
+
+  if (last) {
+    if (state->references != NULL) {
+      enif_release_resource(state->references);
+    }
+    if (state->urls != NULL) {
+      enif_release_resource(state->urls);
+    }
+    enif_free_env(state->msg_env);
+    enif_free_env(state->env);
+    enif_cond_destroy(state->acked);
+    enif_mutex_destroy(state->lock);
+    enif_free(state);
+  }
+}
+
+// Stop a stream: the render waiting for credit, or asking for it next,
+// stops there.
+static void stream_stop(stream_state *state) {
+  enif_mutex_lock(state->lock);
+  state->cancelled = 1;
+  enif_cond_broadcast(state->acked);
+  enif_mutex_unlock(state->lock);
+}
+
+// Join the threads of the streams that are done rendering, or, with
+// 'all', stop every stream and join all of them.
+static void join_streams(int all) {
+  stream_state **link, *state, *done = NULL;
+
+  enif_mutex_lock(STREAMS_LOCK);
+  for (link = &STREAMS; (state = *link) != NULL;) {
+    if (all || state->finished) {
+      *link = state->next;
+      state->next = done;
+      done = state;
+    } else {
+      link = &state->next;
+    }
+  }
+  enif_mutex_unlock(STREAMS_LOCK);
+
+  while ((state = done) != NULL) {
+    done = state->next;
+    stream_stop(state);
+    enif_thread_join(state->tid, NULL);
+    stream_release(state);
+  }
+}
+
+// Wait until the consumer has credit for another chunk and take it.
+// Returns 0 if the stream was cancelled instead.
+static int take_credit(stream_state *state) {
+  int ok;
+
+  enif_mutex_lock(state->lock);
+  while (state->credit == 0 && !state->cancelled) {
+    enif_cond_wait(state->acked, state->lock);
+  }
+  ok = !state->cancelled;
+  if (ok) {
+    state->credit--;
+  }
+  enif_mutex_unlock(state->lock);
+
+  return ok;
+}
+
+// Send {ref, term} to the consumer, where 'term' was made in msg_env.
+static int stream_send(stream_state *state, ERL_NIF_TERM term) {
+  int sent = enif_send(
+    NULL,
+    &state->pid,
+    state->msg_env,
+    enif_make_tuple2(state->msg_env,
+                     enif_make_copy(state->msg_env, state->ref), term)
+  );
+  enif_clear_env(state->msg_env);
+
+  return sent;
+}
+
+static int send_chunk(void *opaque, const char *data, size_t len) {
+  stream_state  *state = (stream_state *)opaque;
+  ERL_NIF_TERM   chunk;
+  unsigned char *bytes;
+
+  if (!take_credit(state)) {
+    return 0;
+  }
+
+  bytes = enif_make_new_binary(state->msg_env, len, &chunk);
+  memcpy(bytes, data, len);
+
+  return stream_send(state, chunk);
+}
+
+static void *stream_run(void *arg) {
+  stream_state        *state = (stream_state *)arg;
+  cmark_url_map       *urls = state->urls ? state->urls->map : NULL;
+  cmark_sink           sink;
+  cmark_node          *doc;
+  cmark_parser        *parser;
+  cmark_html_pipeline *pipeline;
+
+  sink.write = send_chunk;
+  sink.opaque = state;
+  sink.flush_size = state->chunk_size;
+
+  if (state->format == 0) {
+    parser = cmark_parser_new(state->options);
+    if (state->references != NULL) {
+      cmark_parser_set_reference_dictionary(parser, state->references->map);
+    }
+    pipeline = cmark_html_pipeline_new(parser, urls, &sink);
+    if (cmark_html_pipeline_feed(pipeline, (const char *)state->markdown.data,
+                                 state->markdown.size)) {
+      cmark_html_pipeline_finish(pipeline);
+    }
+    cmark_html_pipeline_free(pipeline);
+    cmark_parser_free(parser);
+  } else {
+    doc = parse(&state->markdown, state->options, state->references,
+                state->threads);
+    switch (state->format) {
+      case FORMAT_HTML:
+        cmark_render_html_to_sink(doc, state->options, urls, &sink);
+        break;
+      case FORMAT_XML:
+        cmark_render_xml_to_sink(doc, state->options, &sink);
+        break;
+      case FORMAT_MAN:
+        cmark_render_man_to_sink(doc, state->options, 0, &sink);
+        break;
+      case FORMAT_COMMONMARK:
+        cmark_render_commonmark_to_sink(doc, state->options, 0, &sink);
+        break;
+      case FORMAT_LATEX:
+        cmark_render_latex_to_sink(doc, state->options, 0, &sink);
+        break;
+      default:
+        cmark_render_text_to_sink(doc, state->options, NULL, &sink);
+    }
+    cmark_node_free(doc);
+  }
+
+  stream_send(state, enif_make_atom(state->msg_env, "done"));
+
+  enif_mutex_lock(STREAMS_LOCK);
+  state->finished = 1;
+  enif_mutex_unlock(STREAMS_LOCK);
+
+  return NULL;
+}
+
+// Start rendering 'state' for the calling process on a thread of its own.
+// Returns the stream resource, or badarg if no thread could be started.
+static ERL_NIF_TERM stream_start(ErlNifEnv *env, stream_state *state,
+                                 ERL_NIF_TERM document, ERL_NIF_TERM ref,
+                                 unsigned long window) {
+  stream_resource *stream;
+  ERL_NIF_TERM     term;
+
+  join_streams(0);
+
+  state->lock = enif_mutex_create("cmark_stream");
+  state->acked = enif_cond_create("cmark_stream");
+  state->credit = window;
+  state->cancelled = 0;
+  state->refs = 2;
+  state->finished = 0;
+  state->env = enif_alloc_env();
+  state->msg_env = enif_alloc_env();
+  state->ref = enif_make_copy(state->env, ref);
+  enif_inspect_binary(state->env, enif_make_copy(state->env, document),
+                      &state->markdown);
+  enif_self(env, &state->pid);
+  if (state->references != NULL) {
+    enif_keep_resource(state->references);
+  }
+  if (state->urls != NULL) {
+    enif_keep_resource(state->urls);
+  }
+
+  stream = enif_alloc_resource(STREAM_RESOURCE_TYPE, sizeof(stream_resource));
+  stream->state = state;
+  term = enif_make_resource(env, stream);
+  enif_release_resource(stream);
+
+  // Stop when the consumer goes away without cancelling.
+  if (enif_monitor_process(env, stream, &state->pid, NULL) != 0) {
+    stream_stop(state);
+  }
+
+  if (enif_thread_create("cmark_stream", &state->tid, stream_run, state,
+                         NULL) != 0) {
+    stream_release(state);
+    return enif_make_badarg(env);
+  }
+  enif_mutex_lock(STREAMS_LOCK);
+  state->next = STREAMS;
+  STREAMS = state;
+  enif_mutex_unlock(STREAMS_LOCK);
+
+  return term;
+}
+
+/*
+ * Start rendering a document, sending the output to the calling process
+ * in chunks
+ *
+ * Requires 9 arguments:
+ *
+ * 1. markdown document (string)
+ * 2. formatting options (int)
+ * 3. writer to use (int), as for render/3
+ * 4. reference dictionary (resource) or nil, as for render/4
+ * 5. number of threads the parser may use (int)
+ * 6. URL map (resource) or nil, as for render_html/6 (HTML only)
+ * 7. term to tag the messages with
+ * 8. size of the chunks in bytes (int)
+ * 9. number of chunks that may be sent before the first is acked (int)
+ *
+ * Each chunk of about the given size is sent as {tag, chunk} once there
+ * is credit for it (see stream_ack/1), and {tag, done} follows the last
+ * one or a cancelled stream.  Returns the stream (resource).
+ *
+ */
+static ERL_NIF_TERM render_stream(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary  markdown_binary;
+  stream_state *state;
+  unsigned long chunk_size;
+  unsigned long window;
+  int           options = 0;
+  int           format = 1;
+  int           threads = 1;
+  references_resource *references = NULL;
+  url_map_resource    *urls = NULL;
+  ERL_NIF_TERM         nil;
+
+  if (argc != 9) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+  enif_get_int(env, argv[2], &format);
+  nil = enif_make_atom(env, "nil");
+
+  if(format < 1 || format > 6){
+    return enif_make_badarg(env);
+  }
+
+  if((!enif_is_identical(argv[3], nil) &&
+      !enif_get_resource(env, argv[3], REFERENCES_RESOURCE_TYPE,
+                         (void **)&references)) ||
+     !enif_get_int(env, argv[4], &threads) || threads < 1 ||
+     (!enif_is_identical(argv[5], nil) &&
+      !enif_get_resource(env, argv[5], URL_MAP_RESOURCE_TYPE,
+                         (void **)&urls))){
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_ulong(env, argv[7], &chunk_size) || chunk_size == 0 ||
+     !enif_get_ulong(env, argv[8], &window) || window == 0){
+    return enif_make_badarg(env);
+  }
+
+  state = enif_alloc(sizeof(stream_state));
+  state->options = options;
+  state->format = format;
+  state->threads = threads;
+  state->chunk_size = chunk_size;
+  state->references = references;
+  state->urls = urls;
+
+  return stream_start(env, state, argv[0], argv[6], window);
 };
 
-int upgrade(ErlNifEnv* _env, void** _priv_data, void** _old_priv_data, ERL_NIF_TERM _load_info) {
-  return 0;
+/*
+ * Start rendering a document as HTML a top-level block at a time,
+ * sending the output to the calling process in chunks
+ *
+ * Requires 7 arguments:
+ *
+ * 1. markdown document (string)
+ * 2. formatting options (int)
+ * 3. reference dictionary (resource) or nil, as for render/4
+ * 4. URL map (resource) or nil, as for render_html/6
+ * 5. term to tag the messages with
+ * 6. size of the chunks in bytes (int)
+ * 7. number of chunks that may be sent before the first is acked (int)
+ *
+ * Each block is freed once it is rendered, so links can only use link
+ * reference definitions that come before them.  Chunks are sent as for
+ * render_stream/9.  Returns the stream (resource).
+ *
+ */
+static ERL_NIF_TERM render_pipeline(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary  markdown_binary;
+  stream_state *state;
+  unsigned long chunk_size;
+  unsigned long window;
+  int           options = 0;
+  references_resource *references = NULL;
+  url_map_resource    *urls = NULL;
+  ERL_NIF_TERM         nil;
+
+  if (argc != 7) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+  nil = enif_make_atom(env, "nil");
+
+  if((!enif_is_identical(argv[2], nil) &&
+      !enif_get_resource(env, argv[2], REFERENCES_RESOURCE_TYPE,
+                         (void **)&references)) ||
+     (!enif_is_identical(argv[3], nil) &&
+      !enif_get_resource(env, argv[3], URL_MAP_RESOURCE_TYPE,
+                         (void **)&urls))){
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_ulong(env, argv[5], &chunk_size) || chunk_size == 0 ||
+     !enif_get_ulong(env, argv[6], &window) || window == 0){
+    return enif_make_badarg(env);
+  }
+
+  state = enif_alloc(sizeof(stream_state));
+  state->options = options;
+  state->format = 0;
+  state->threads = 1;
+  state->chunk_size = chunk_size;
+  state->references = references;
+  state->urls = urls;
+
+  return stream_start(env, state, argv[0], argv[4], window);
+};
+
+/*
+ * Give a stream credit for one more chunk, once one is taken
+ *
+ * Requires 1 argument:
+ *
+ * 1. stream (resource), from render_stream/9 or render_pipeline/7
+ *
+ */
+static ERL_NIF_TERM stream_ack(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  stream_resource *stream;
+
+  if (argc != 1) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_resource(env, argv[0], STREAM_RESOURCE_TYPE,
+                        (void **)&stream)){
+    return enif_make_badarg(env);
+  }
+
+  enif_mutex_lock(stream->state->lock);
+  stream->state->credit++;
+  enif_cond_signal(stream->state->acked);
+  enif_mutex_unlock(stream->state->lock);
+
+  return enif_make_atom(env, "ok");
+};
+
+/*
+ * Stop a stream: the render waiting for credit, or asking for it next,
+ * stops there and sends {tag, done}
+ *
+ * Requires 1 argument:
+ *
+ * 1. stream (resource)
+ *
+ */
+static ERL_NIF_TERM stream_cancel(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  stream_resource *stream;
+
+  if (argc != 1) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_resource(env, argv[0], STREAM_RESOURCE_TYPE,
+                        (void **)&stream)){
+    return enif_make_badarg(env);
+  }
+
+  stream_stop(stream->state);
+
+  return enif_make_atom(env, "ok");
+};
+
+static void stream_dtor(ErlNifEnv* _env, void* obj) {
+  stream_resource *stream = (stream_resource *)obj;
+  stream_stop(stream->state);
+  stream_release(stream->state);
+};
+
+static void stream_down(ErlNifEnv* _env, void* obj, ErlNifPid* _pid,
+                        ErlNifMonitor* _monitor) {
+  stream_stop(((stream_resource *)obj)->state);
+};
+
+/*
+ * Render a document as HTML one top-level block at a time
+ *
+ * Requires 4 arguments:
+ *
+ * 1. markdown document (string)
+ * 2. formatting options (int)
+ * 3. reference dictionary (resource) or nil, as for render/4
+ * 4. number of threads the parser may use (int)
+ *
+ * Returns a list with a {start_line, end_line, key, html} tuple for each
+ * top-level block, where the key is made from its source before it is
+ * rendered, as by cmark_parser_block_keys.
+ *
+ */
+static ERL_NIF_TERM render_blocks(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary  markdown_binary;
+  ErlNifBinary  fragment_binary;
+  cmark_parser *parser;
+  cmark_node   *doc;
+  cmark_node   *node;
+  char         *output;
+  size_t       *ends;
+  unsigned long long *keys;
+  size_t        count = 0, start, i;
+  int           options = 0;
+  int           threads = 1;
+  references_resource *references = NULL;
+  ERL_NIF_TERM  blocks, block[4];
+
+  if (argc != 4) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+
+  if(!enif_is_identical(argv[2], enif_make_atom(env, "nil")) &&
+     !enif_get_resource(env, argv[2], REFERENCES_RESOURCE_TYPE,
+                        (void **)&references)){
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_int(env, argv[3], &threads) || threads < 1){
+    return enif_make_badarg(env);
+  }
+
+  parser = new_parser(options, references, threads);
+  doc = cmark_parser_parse_document(
+    parser,
+    (const char *)markdown_binary.data,
+    markdown_binary.size
+  );
+
+  for (node = cmark_node_first_child(doc); node; node = cmark_node_next(node)) {
+    count++;
+  }
+  keys = enif_alloc((count ? count : 1) * sizeof(unsigned long long));
+  cmark_parser_block_keys(parser, doc, (const char *)markdown_binary.data,
+                          markdown_binary.size, keys);
+  cmark_parser_free(parser);
+
+  ends = enif_alloc((count ? count : 1) * sizeof(size_t));
+  output = cmark_render_html_blocks(doc, options, ends);
+
+  // Build the list from the last block on.
+  blocks = enif_make_list(env, 0);
+  node = cmark_node_last_child(doc);
+  for (i = count; i > 0; i--) {
+    start = i > 1 ? ends[i - 2] : 0;
+    enif_alloc_binary(ends[i - 1] - start, &fragment_binary);
+    memcpy(fragment_binary.data, output + start, ends[i - 1] - start);
+
+    block[0] = enif_make_int(env, cmark_node_get_start_line(node));
+    block[1] = enif_make_int(env, cmark_node_get_end_line(node));
+    block[2] = enif_make_uint64(env, (ErlNifUInt64)keys[i - 1]);
+    block[3] = enif_make_binary(env, &fragment_binary);
+    blocks = enif_make_list_cell(
+      env, enif_make_tuple_from_array(env, block, 4), blocks);
+    node = cmark_node_previous(node);
+  }
+
+  enif_free(keys);
+  enif_free(ends);
+  free(output);
+  cmark_node_free(doc);
+
+  return blocks;
+};
+
+/*
+ * Render the beginning of a document as HTML, parsing no more of it than
+ * needed
+ *
+ * Requires 5 arguments:
+ *
+ * 1. markdown document (string)
+ * 2. formatting options (int)
+ * 3. reference dictionary (resource) or nil, as for render/4
+ * 4. maximum number of top-level blocks (int), 0 for no limit
+ * 5. maximum number of characters of text (int), 0 for no limit
+ *
+ */
+static ERL_NIF_TERM render_excerpt(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary  markdown_binary;
+  ErlNifBinary  output_binary;
+  cmark_parser *parser;
+  cmark_node   *doc;
+  char         *output;
+  size_t        output_len;
+  int           options = 0;
+  int           max_blocks = 0;
+  int           max_chars = 0;
+  references_resource *references = NULL;
+
+  if (argc != 5) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+
+  if(!enif_is_identical(argv[2], enif_make_atom(env, "nil")) &&
+     !enif_get_resource(env, argv[2], REFERENCES_RESOURCE_TYPE,
+                        (void **)&references)){
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_int(env, argv[3], &max_blocks) || max_blocks < 0 ||
+     !enif_get_int(env, argv[4], &max_chars) || max_chars < 0){
+    return enif_make_badarg(env);
+  }
+
+  parser = new_parser(options, references, 1);
+  doc = cmark_parser_parse_excerpt(
+    parser,
+    (const char *)markdown_binary.data,
+    markdown_binary.size,
+    max_blocks,
+    max_chars
+  );
+  // the tree refers to the dictionary, not to the parser
+  cmark_parser_free(parser);
+
+  output = cmark_render_html_excerpt(doc, options, max_blocks, max_chars);
+  cmark_node_free(doc);
+
+  output_len = strlen(output);
+  enif_alloc_binary(output_len, &output_binary);
+  memcpy(output_binary.data, output, output_len);
+  free(output);
+
+  return enif_make_binary(env, &output_binary);
+};
+
+/*
+ * Render a document as plain text with a given block separator
+ *
+ * Requires 5 arguments:
+ *
+ * 1. markdown document (string)
+ * 2. formatting options (int)
+ * 3. reference dictionary (resource) or nil, as for render/4
+ * 4. number of threads the parser may use (int)
+ * 5. separator put between blocks (string)
+ *
+ */
+static ERL_NIF_TERM render_text(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary  markdown_binary;
+  ErlNifBinary  separator_binary;
+  ErlNifBinary  output_binary;
+  cmark_node   *doc;
+  char         *separator;
+  char         *output;
+  size_t        output_len;
+  int           options = 0;
+  int           threads = 1;
+  references_resource *references = NULL;
+
+  if (argc != 5) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+
+  if(!enif_is_identical(argv[2], enif_make_atom(env, "nil")) &&
+     !enif_get_resource(env, argv[2], REFERENCES_RESOURCE_TYPE,
+                        (void **)&references)){
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_int(env, argv[3], &threads) || threads < 1 ||
+     !enif_inspect_binary(env, argv[4], &separator_binary) ||
+     memchr(separator_binary.data, 0, separator_binary.size) != NULL){
+    return enif_make_badarg(env);
+  }
+
+  separator = malloc(separator_binary.size + 1);
+  memcpy(separator, separator_binary.data, separator_binary.size);
+  separator[separator_binary.size] = '\0';
+
+  doc = parse(&markdown_binary, options, references, threads);
+  output = cmark_render_text(doc, options, separator);
+  cmark_node_free(doc);
+  free(separator);
+
+  output_len = strlen(output);
+  enif_alloc_binary(output_len, &output_binary);
+  memcpy(output_binary.data, output, output_len);
+  free(output);
+
+  return enif_make_binary(env, &output_binary);
+};
+
+// Text gathered from nodes as the tree is walked.
+typedef struct {
+  char   *data;
+  size_t  size;
+  size_t  capacity;
+} text_buffer;
+
+static void text_append(text_buffer *text, const char *data, size_t len) {
+  if (text->size + len > text->capacity) {
+    text->capacity = (text->size + len) * 2;
+    text->data = text->data ? enif_realloc(text->data, text->capacity)
+                            : enif_alloc(text->capacity);
+  }
+  memcpy(text->data + text->size, data, len);
+  text->size += len;
+}
+
+static ERL_NIF_TERM make_string(ErlNifEnv* env, const char *data, size_t len) {
+  ErlNifBinary binary;
+
+  enif_alloc_binary(len, &binary);
+  if (len > 0) {
+    memcpy(binary.data, data, len);
+  }
+  return enif_make_binary(env, &binary);
+}
+
+static ERL_NIF_TERM make_cstring(ErlNifEnv* env, const char *data) {
+  return make_string(env, data, data ? strlen(data) : 0);
+}
+
+static int is_word_separator(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+         c == '\v';
+}
+
+/*
+ * Collect metadata about a document in a single walk of its tree, without
+ * rendering it
+ *
+ * Requires 4 arguments:
+ *
+ * 1. markdown document (string)
+ * 2. formatting options (int)
+ * 3. reference dictionary (resource) or nil, as for render/4
+ * 4. number of threads the parser may use (int)
+ *
+ * Returns {headings, links, images, code_blocks, words}, where headings
+ * is a list of {level, text, start_line, end_line} tuples, links and
+ * images lists of {url, title} tuples, code_blocks the list of info
+ * strings of code blocks and words the number of words in text nodes.
+ *
+ */
+static ERL_NIF_TERM metadata(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary      markdown_binary;
+  cmark_node       *doc;
+  cmark_node       *node;
+  cmark_node       *heading = NULL;
+  cmark_iter       *iter;
+  cmark_event_type  ev_type;
+  const char       *literal;
+  size_t            literal_len, i;
+  text_buffer       heading_text = {NULL, 0, 0};
+  unsigned long     words = 0;
+  int               in_word = 0;
+  int               options = 0;
+  int               threads = 1;
+  references_resource *references = NULL;
+  ERL_NIF_TERM      headings, links, images, code_blocks, entry[5];
+
+  if (argc != 4) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+
+  if(!enif_is_identical(argv[2], enif_make_atom(env, "nil")) &&
+     !enif_get_resource(env, argv[2], REFERENCES_RESOURCE_TYPE,
+                        (void **)&references)){
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_int(env, argv[3], &threads) || threads < 1){
+    return enif_make_badarg(env);
+  }
+
+  doc = parse(&markdown_binary, options, references, threads);
+
+  // The lists are built backwards and reversed at the end.
+  headings = enif_make_list(env, 0);
+  links = enif_make_list(env, 0);
+  images = enif_make_list(env, 0);
+  code_blocks = enif_make_list(env, 0);
+
+  iter = cmark_iter_new(doc);
+  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+    node = cmark_iter_get_node(iter);
+
+    switch (cmark_node_get_type(node)) {
+      case CMARK_NODE_TEXT:
+        literal = cmark_node_get_literal_chunk(node, &literal_len);
+        for (i = 0; i < literal_len; i++) {
+          if (is_word_separator(literal[i])) {
+            in_word = 0;
+          } else if (!in_word) {
+            words++;
+            in_word = 1;
+          }
+        }
+        if (heading != NULL) {
+          text_append(&heading_text, literal, literal_len);
+        }
+        break;
+      case CMARK_NODE_CODE:
+        if (heading != NULL) {
+          literal = cmark_node_get_literal_chunk(node, &literal_len);
+          text_append(&heading_text, literal, literal_len);
+        }
+        in_word = 0;
+        break;
+      case CMARK_NODE_SOFTBREAK:
+      case CMARK_NODE_LINEBREAK:
+        if (heading != NULL) {
+          text_append(&heading_text, " ", 1);
+        }
+        in_word = 0;
+        break;
+      case CMARK_NODE_EMPH:
+      case CMARK_NODE_STRONG:
+        // words go on across emphasis
+        break;
+      case CMARK_NODE_LINK:
+      case CMARK_NODE_IMAGE:
+        if (ev_type == CMARK_EVENT_ENTER) {
+          entry[0] = make_cstring(env, cmark_node_get_url(node));
+          entry[1] = make_cstring(env, cmark_node_get_title(node));
+          if (cmark_node_get_type(node) == CMARK_NODE_LINK) {
+            links = enif_make_list_cell(
+              env, enif_make_tuple_from_array(env, entry, 2), links);
+          } else {
+            images = enif_make_list_cell(
+              env, enif_make_tuple_from_array(env, entry, 2), images);
+          }
+        }
+        break;
+      case CMARK_NODE_HEADING:
+        if (ev_type == CMARK_EVENT_ENTER) {
+          heading = node;
+          heading_text.size = 0;
+        } else {
+          entry[0] = enif_make_int(env, cmark_node_get_heading_level(node));
+          entry[1] = make_string(env, heading_text.data, heading_text.size);
+          entry[2] = enif_make_int(env, cmark_node_get_start_line(node));
+          entry[3] = enif_make_int(env, cmark_node_get_end_line(node));
+          headings = enif_make_list_cell(
+            env, enif_make_tuple_from_array(env, entry, 4), headings);
+          heading = NULL;
+        }
+        in_word = 0;
+        break;
+      case CMARK_NODE_CODE_BLOCK:
+        code_blocks = enif_make_list_cell(
+          env, make_cstring(env, cmark_node_get_fence_info(node)),
+          code_blocks);
+        in_word = 0;
+        break;
+      default:
+        in_word = 0;
+    }
+  }
+  cmark_iter_free(iter);
+  cmark_node_free(doc);
+  if (heading_text.data) {
+    enif_free(heading_text.data);
+  }
+
+  enif_make_reverse_list(env, headings, &headings);
+  enif_make_reverse_list(env, links, &links);
+  enif_make_reverse_list(env, images, &images);
+  enif_make_reverse_list(env, code_blocks, &code_blocks);
+
+  entry[0] = headings;
+  entry[1] = links;
+  entry[2] = images;
+  entry[3] = code_blocks;
+  entry[4] = enif_make_uint64(env, words);
+  return enif_make_tuple_from_array(env, entry, 5);
+};
+
+/*
+ * Render a document as HTML with ids on its headings, and list them
+ *
+ * Requires 4 arguments:
+ *
+ * 1. markdown document (string)
+ * 2. formatting options (int)
+ * 3. reference dictionary (resource) or nil, as for render/4
+ * 4. number of threads the parser may use (int)
+ *
+ * Returns {html, headings}, where headings is a list of {level, id, text}
+ * tuples in document order.
+ *
+ */
+static ERL_NIF_TERM render_toc(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary     markdown_binary;
+  cmark_node      *doc;
+  cmark_toc_entry *toc;
+  size_t           toc_length, i;
+  char            *output;
+  int              options = 0;
+  int              threads = 1;
+  references_resource *references = NULL;
+  ERL_NIF_TERM     html, headings, entry[3];
+
+  if (argc != 4) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+
+  if(!enif_is_identical(argv[2], enif_make_atom(env, "nil")) &&
+     !enif_get_resource(env, argv[2], REFERENCES_RESOURCE_TYPE,
+                        (void **)&references)){
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_int(env, argv[3], &threads) || threads < 1){
+    return enif_make_badarg(env);
+  }
+
+  doc = parse(&markdown_binary, options, references, threads);
+  output = cmark_render_html_toc(doc, options, &toc, &toc_length);
+  cmark_node_free(doc);
+
+  html = make_cstring(env, output);
+  free(output);
+
+  headings = enif_make_list(env, 0);
+  for (i = toc_length; i > 0; i--) {
+    entry[0] = enif_make_int(env, toc[i - 1].level);
+    entry[1] = make_cstring(env, toc[i - 1].id);
+    entry[2] = make_cstring(env, toc[i - 1].text);
+    headings = enif_make_list_cell(
+      env, enif_make_tuple_from_array(env, entry, 3), headings);
+  }
+  cmark_toc_free(toc, toc_length);
+
+  return enif_make_tuple2(env, html, headings);
+};
+
+/*
+ * Render a document as HTML, reusing the HTML of blocks from a cache
+ * and rewriting the URLs of links and images
+ *
+ * Requires 6 arguments:
+ *
+ * 1. markdown document (string)
+ * 2. formatting options (int)
+ * 3. reference dictionary (resource) or nil, as for render/4
+ * 4. number of threads the parser may use (int)
+ * 5. block cache (resource) created by cache_new/1, or nil
+ * 6. URL map (resource) created by url_map_new/2, or nil
+ *
+ */
+static ERL_NIF_TERM render_html(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary  markdown_binary;
+  ErlNifBinary  output_binary;
+  cmark_parser *parser;
+  cmark_node   *doc;
+  char         *output;
+  size_t        output_len;
+  int           options = 0;
+  int           threads = 1;
+  references_resource  *references = NULL;
+  block_cache_resource *cache = NULL;
+  url_map_resource     *urls = NULL;
+  ERL_NIF_TERM          nil;
+
+  if (argc != 6) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+  nil = enif_make_atom(env, "nil");
+
+  if(!enif_is_identical(argv[2], nil) &&
+     !enif_get_resource(env, argv[2], REFERENCES_RESOURCE_TYPE,
+                        (void **)&references)){
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_int(env, argv[3], &threads) || threads < 1){
+    return enif_make_badarg(env);
+  }
+
+  if((!enif_is_identical(argv[4], nil) &&
+      !enif_get_resource(env, argv[4], BLOCK_CACHE_RESOURCE_TYPE,
+                         (void **)&cache)) ||
+     (!enif_is_identical(argv[5], nil) &&
+      !enif_get_resource(env, argv[5], URL_MAP_RESOURCE_TYPE,
+                         (void **)&urls))){
+    return enif_make_badarg(env);
+  }
+
+  parser = new_parser(options, references, threads);
+  if (cache != NULL) {
+    output = cmark_block_cache_render_html_with_url_map(
+      cache->cache,
+      parser,
+      (const char *)markdown_binary.data,
+      markdown_binary.size,
+      urls ? urls->map : NULL
+    );
+  } else {
+    doc = cmark_parser_parse_document(
+      parser,
+      (const char *)markdown_binary.data,
+      markdown_binary.size
+    );
+    output = cmark_render_html_with_url_map(doc, options,
+                                            urls ? urls->map : NULL);
+    cmark_node_free(doc);
+  }
+  cmark_parser_free(parser);
+
+  output_len = strlen(output);
+  enif_alloc_binary(output_len, &output_binary);
+  memcpy(output_binary.data, output, output_len);
+  free(output);
+
+  return enif_make_binary(env, &output_binary);
+};
+
+/*
+ * Create a cache of rendered blocks
+ *
+ * Requires 1 argument:
+ *
+ * 1. maximum size of the cache in bytes (int)
+ *
+ * Returns a resource that can be passed to render_html/6 from any
+ * process.
+ *
+ */
+static ERL_NIF_TERM cache_new(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  block_cache_resource *cache;
+  unsigned long         max_size;
+  ERL_NIF_TERM          term;
+
+  if (argc != 1 || !enif_get_ulong(env, argv[0], &max_size)) {
+    return enif_make_badarg(env);
+  }
+
+  cache = enif_alloc_resource(BLOCK_CACHE_RESOURCE_TYPE,
+                              sizeof(block_cache_resource));
+  cache->cache = cmark_block_cache_new(max_size);
+
+  term = enif_make_resource(env, cache);
+  enif_release_resource(cache);
+
+  return term;
+};
+
+/*
+ * Report the use of a cache of rendered blocks
+ *
+ * Requires 1 argument:
+ *
+ * 1. block cache (resource)
+ *
+ * Returns {hits, misses, entries, bytes}.
+ *
+ */
+static ERL_NIF_TERM cache_stats(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  block_cache_resource *cache;
+  size_t                hits, misses, entries, size;
+
+  if (argc != 1 ||
+      !enif_get_resource(env, argv[0], BLOCK_CACHE_RESOURCE_TYPE,
+                         (void **)&cache)) {
+    return enif_make_badarg(env);
+  }
+
+  cmark_block_cache_get_stats(cache->cache, &hits, &misses, &entries, &size);
+
+  return enif_make_tuple4(env, enif_make_uint64(env, hits),
+                          enif_make_uint64(env, misses),
+                          enif_make_uint64(env, entries),
+                          enif_make_uint64(env, size));
+};
+
+static void block_cache_dtor(ErlNifEnv* _env, void* obj) {
+  block_cache_resource *cache = (block_cache_resource *)obj;
+  cmark_block_cache_free(cache->cache);
+};
+
+/*
+ * Parse link reference definitions into an immutable dictionary
+ *
+ * Requires 2 arguments:
+ *
+ * 1. markdown document with the definitions (string)
+ * 2. parsing options (int)
+ *
+ * Returns a resource that can be passed to render/4 from any process.
+ *
+ */
+static ERL_NIF_TERM parse_references(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary         markdown_binary;
+  references_resource *references;
+  ERL_NIF_TERM         term;
+  int                  options = 0;
+
+  if (argc != 2) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+
+  references = enif_alloc_resource(REFERENCES_RESOURCE_TYPE,
+                                   sizeof(references_resource));
+  references->map = cmark_reference_map_parse(
+    (const char *)markdown_binary.data,
+    markdown_binary.size,
+    options
+  );
+
+  term = enif_make_resource(env, references);
+  enif_release_resource(references);
+
+  return term;
+};
+
+static void references_dtor(ErlNifEnv* _env, void* obj) {
+  references_resource *references = (references_resource *)obj;
+  cmark_reference_map_free(references->map);
+};
+
+// Add the {from, replacement} tuples of 'list' to 'map'.
+static int add_url_rewrites(ErlNifEnv* env, cmark_url_map *map,
+                            ERL_NIF_TERM list, int prefix) {
+  ERL_NIF_TERM         head;
+  const ERL_NIF_TERM  *pair;
+  int                  arity;
+  ErlNifBinary         from, to;
+
+  while (enif_get_list_cell(env, list, &head, &list)) {
+    if (!enif_get_tuple(env, head, &arity, &pair) || arity != 2 ||
+        !enif_inspect_binary(env, pair[0], &from) ||
+        !enif_inspect_binary(env, pair[1], &to)) {
+      return 0;
+    }
+    if (prefix ? !cmark_url_map_add_prefix(map, (const char *)from.data,
+                                           from.size, (const char *)to.data,
+                                           to.size)
+               : !cmark_url_map_add_exact(map, (const char *)from.data,
+                                          from.size, (const char *)to.data,
+                                          to.size)) {
+      return 0;
+    }
+  }
+  return enif_is_empty_list(env, list);
+}
+
+/*
+ * Build a map of rewrites for the URLs of links and images
+ *
+ * Requires 2 arguments:
+ *
+ * 1. exact rewrites, a list of {url, replacement} tuples of strings
+ * 2. prefix rewrites, a list of {prefix, replacement} tuples of strings
+ *
+ * Later rewrites of the same URL or prefix replace earlier ones.
+ * Returns a resource that can be passed to render_html/6 from any
+ * process.
+ *
+ */
+static ERL_NIF_TERM url_map_new(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  cmark_url_map    *map;
+  url_map_resource *urls;
+  ERL_NIF_TERM      term;
+
+  if (argc != 2) {
+    return enif_make_badarg(env);
+  }
+
+  map = cmark_url_map_new();
+  if (!add_url_rewrites(env, map, argv[0], 0) ||
+      !add_url_rewrites(env, map, argv[1], 1)) {
+    cmark_url_map_free(map);
+    return enif_make_badarg(env);
+  }
+
+  urls = enif_alloc_resource(URL_MAP_RESOURCE_TYPE, sizeof(url_map_resource));
+  urls->map = map;
+
+  term = enif_make_resource(env, urls);
+  enif_release_resource(urls);
+
+  return term;
+};
+
+static void url_map_dtor(ErlNifEnv* _env, void* obj) {
+  url_map_resource *urls = (url_map_resource *)obj;
+  cmark_url_map_free(urls->map);
+};
+
+static ERL_NIF_TERM make_html(ErlNifEnv* env, cmark_node *node, int options) {
+  ErlNifBinary output_binary;
+  char        *output = cmark_render_html(node, options);
+  size_t       output_len = strlen(output);
+
+  enif_alloc_binary(output_len, &output_binary);
+  memcpy(output_binary.data, output, output_len);
+  free(output);
+
+  return enif_make_binary(env, &output_binary);
+}
+
+/*
+ * Parse a document that is going to be edited, as in a live preview
+ *
+ * Requires 2 arguments:
+ *
+ * 1. markdown document (string)
+ * 2. formatting options (int)
+ *
+ * Returns a resource for live_edit/4 and live_render/1.
+ *
+ */
+static ERL_NIF_TERM live_new(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary            markdown_binary;
+  live_document_resource *live;
+  cmark_live_document    *doc;
+  ERL_NIF_TERM            term;
+  int                     options = 0;
+
+  if (argc != 2) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+
+  doc = cmark_live_document_new(
+    (const char *)markdown_binary.data,
+    markdown_binary.size,
+    options
+  );
+  if (doc == NULL) {
+    return enif_make_badarg(env);
+  }
+
+  live = enif_alloc_resource(LIVE_DOCUMENT_RESOURCE_TYPE,
+                             sizeof(live_document_resource));
+  live->doc = doc;
+  live->lock = enif_mutex_create("cmark_live_document");
+  // Fragments are rendered a block at a time, while heading ids depend on
+  // the headings before.
+  live->options = options & ~CMARK_OPT_HEADING_IDS;
+
+  term = enif_make_resource(env, live);
+  enif_release_resource(live);
+
+  return term;
+};
+
+/*
+ * Replace part of the source of a live document
+ *
+ * Requires 4 arguments:
+ *
+ * 1. live document (resource)
+ * 2. byte offset of the replaced text (int)
+ * 3. byte length of the replaced text (int)
+ * 4. replacement (string)
+ *
+ * Returns {index, removed, fragments}: the top-level blocks from index
+ * on lost removed blocks to the blocks rendered as HTML in fragments.
+ *
+ */
+static ERL_NIF_TERM live_edit(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  live_document_resource *live;
+  ErlNifBinary            text_binary;
+  unsigned long           offset, length;
+  size_t                  index, removed, added, blocks, i;
+  int                     end_line;
+  cmark_node             *node;
+  ERL_NIF_TERM            fragments;
+
+  if (argc != 4) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_resource(env, argv[0], LIVE_DOCUMENT_RESOURCE_TYPE,
+                        (void **)&live) ||
+     !enif_get_ulong(env, argv[1], &offset) ||
+     !enif_get_ulong(env, argv[2], &length) ||
+     !enif_inspect_binary(env, argv[3], &text_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_mutex_lock(live->lock);
+  node = cmark_live_document_root(live->doc);
+  end_line = cmark_node_get_end_line(node);
+  for (blocks = 0, node = cmark_node_first_child(node); node != NULL;
+       node = cmark_node_next(node)) {
+    blocks++;
+  }
+  if (!cmark_live_document_edit(live->doc, offset, length,
+                                (const char *)text_binary.data,
+                                text_binary.size, &index, &removed, &added)) {
+    enif_mutex_unlock(live->lock);
+    return enif_make_badarg(env);
+  }
+
+  // The source positions of the blocks after the edit move with the lines
+  // it adds or removes, so their HTML changes too.
+  if ((live->options & CMARK_OPT_SOURCEPOS) &&
+      cmark_node_get_end_line(cmark_live_document_root(live->doc)) !=
+          end_line) {
+    added += blocks - index - removed;
+    removed = blocks - index;
+  }
+
+  // Render the new blocks last to first, consing up the list.
+  node = cmark_node_first_child(cmark_live_document_root(live->doc));
+  for (i = 0; i + 1 < index + added; i++) {
+    node = cmark_node_next(node);
+  }
+  fragments = enif_make_list(env, 0);
+  for (i = 0; i < added; i++) {
+    fragments = enif_make_list_cell(
+      env, make_html(env, node, live->options), fragments);
+    node = cmark_node_previous(node);
+  }
+  enif_mutex_unlock(live->lock);
+
+  return enif_make_tuple3(env, enif_make_uint64(env, index),
+                          enif_make_uint64(env, removed), fragments);
+};
+
+/*
+ * Render a live document as HTML
+ *
+ * Requires 1 argument:
+ *
+ * 1. live document (resource)
+ *
+ */
+static ERL_NIF_TERM live_render(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  live_document_resource *live;
+  ERL_NIF_TERM            term;
+
+  if (argc != 1) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_resource(env, argv[0], LIVE_DOCUMENT_RESOURCE_TYPE,
+                        (void **)&live)){
+    return enif_make_badarg(env);
+  }
+
+  enif_mutex_lock(live->lock);
+  term = make_html(env, cmark_live_document_root(live->doc), live->options);
+  enif_mutex_unlock(live->lock);
+
+  return term;
+};
+
+static void live_document_dtor(ErlNifEnv* _env, void* obj) {
+  live_document_resource *live = (live_document_resource *)obj;
+  cmark_live_document_free(live->doc);
+  enif_mutex_destroy(live->lock);
+};
+
+/*
+ * Parse a document into a compact tree, to be rendered repeatedly
+ *
+ * Requires 4 arguments:
+ *
+ * 1. markdown document (string)
+ * 2. formatting options (int), for both parsing and rendering
+ * 3. reference dictionary (resource) or nil, as for render/4
+ * 4. number of threads the parser may use (int)
+ *
+ * Returns a resource that can be passed to compact_render/1 from any
+ * process.
+ *
+ */
+static ERL_NIF_TERM compact_new(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlNifBinary         markdown_binary;
+  cmark_node          *doc;
+  cmark_compact       *tree;
+  compact_resource    *compact;
+  references_resource *references = NULL;
+  int                  options = 0;
+  int                  threads = 1;
+  ERL_NIF_TERM         term;
+
+  if (argc != 4) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_inspect_binary(env, argv[0], &markdown_binary)){
+    return enif_make_badarg(env);
+  }
+
+  enif_get_int(env, argv[1], &options);
+
+  if((!enif_is_identical(argv[2], enif_make_atom(env, "nil")) &&
+      !enif_get_resource(env, argv[2], REFERENCES_RESOURCE_TYPE,
+                         (void **)&references)) ||
+     !enif_get_int(env, argv[3], &threads) || threads < 1){
+    return enif_make_badarg(env);
+  }
+
+  doc = parse(&markdown_binary, options, references, threads);
+  tree = cmark_compact_new(doc);
+  cmark_node_free(doc);
+  if (tree == NULL) {
+    return enif_make_badarg(env);
+  }
+
+  compact = enif_alloc_resource(COMPACT_RESOURCE_TYPE,
+                                sizeof(compact_resource));
+  compact->tree = tree;
+  compact->options = options;
+
+  term = enif_make_resource(env, compact);
+  enif_release_resource(compact);
+
+  return term;
+};
+
+/*
+ * Render a compact tree as HTML
+ *
+ * Requires 1 argument:
+ *
+ * 1. compact tree (resource)
+ *
+ */
+static ERL_NIF_TERM compact_render(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  compact_resource *compact;
+  ErlNifBinary      output_binary;
+  char             *output;
+  size_t            output_len;
+
+  if (argc != 1) {
+    return enif_make_badarg(env);
+  }
+
+  if(!enif_get_resource(env, argv[0], COMPACT_RESOURCE_TYPE,
+                        (void **)&compact)){
+    return enif_make_badarg(env);
+  }
+
+  output = cmark_compact_render_html(compact->tree, compact->options);
+  output_len = strlen(output);
+
+  enif_alloc_binary(output_len, &output_binary);
+  memcpy(output_binary.data, output, output_len);
+  free(output);
+
+  return enif_make_binary(env, &output_binary);
+};
+
+static void compact_dtor(ErlNifEnv* _env, void* obj) {
+  compact_resource *compact = (compact_resource *)obj;
+  cmark_compact_free(compact->tree);
+};
+
+static ErlNifResourceTypeInit stream_init = {
+  stream_dtor, NULL, stream_down
+};
+
+static int open_resource_types(ErlNifEnv* env) {
+  REFERENCES_RESOURCE_TYPE = enif_open_resource_type(
+    env, NULL, "cmark_references", references_dtor,
+    ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL
+  );
+  LIVE_DOCUMENT_RESOURCE_TYPE = enif_open_resource_type(
+    env, NULL, "cmark_live_document", live_document_dtor,
+    ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL
+  );
+  BLOCK_CACHE_RESOURCE_TYPE = enif_open_resource_type(
+    env, NULL, "cmark_block_cache", block_cache_dtor,
+    ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL
+  );
+  URL_MAP_RESOURCE_TYPE = enif_open_resource_type(
+    env, NULL, "cmark_url_map", url_map_dtor,
+    ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL
+  );
+  COMPACT_RESOURCE_TYPE = enif_open_resource_type(
+    env, NULL, "cmark_compact", compact_dtor,
+    ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL
+  );
+  STREAM_RESOURCE_TYPE = enif_open_resource_type_x(
+    env, "cmark_stream", &stream_init,
+    ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL
+  );
+
+  return REFERENCES_RESOURCE_TYPE == NULL ||
+         LIVE_DOCUMENT_RESOURCE_TYPE == NULL ||
+         BLOCK_CACHE_RESOURCE_TYPE == NULL ||
+         URL_MAP_RESOURCE_TYPE == NULL ||
+         STREAM_RESOURCE_TYPE == NULL ||
+         COMPACT_RESOURCE_TYPE == NULL ? -1 : 0;
+};
+
+// The stream list is shared by every instance of the library loaded.
+// Its lock outlives them, as streams still referenced are released later.
+static int LOADS = 0;
+
+static int init_streams(void) {
+  LOADS++;
+  if (STREAMS_LOCK == NULL) {
+    STREAMS_LOCK = enif_mutex_create("cmark_streams");
+  }
+  return STREAMS_LOCK == NULL ? -1 : 0;
+}
+
+int load(ErlNifEnv* env, void** _priv_data, ERL_NIF_TERM _load_info) {
+  return init_streams() || open_resource_types(env);
+};
+
+int reload(ErlNifEnv* _env, void** _priv_data, ERL_NIF_TERM _load_info) {
+  return 0;
+};
+
+int upgrade(ErlNifEnv* env, void** _priv_data, void** _old_priv_data, ERL_NIF_TERM _load_info) {
+  return init_streams() || open_resource_types(env);
+};
+
+// Stop the streams still rendering before their code goes away.
+void unload(ErlNifEnv* _env, void* _priv_data) {
+  if (--LOADS == 0) {
+    join_streams(1);
+  }
 };
 
 static ErlNifFunc nif_funcs[] = {
-  { "render", 3, render, ERL_NIF_DIRTY_JOB_CPU_BOUND }
+  { "render", 3, render, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "render", 4, render, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "render", 5, render, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  // These start a thread to render on and return.
+  { "render_stream", 9, render_stream, 0 },
+  { "render_pipeline", 7, render_pipeline, 0 },
+  { "stream_ack", 1, stream_ack, 0 },
+  { "stream_cancel", 1, stream_cancel, 0 },
+  { "render_blocks", 4, render_blocks, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "render_excerpt", 5, render_excerpt, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "render_text", 5, render_text, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "metadata", 4, metadata, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "render_toc", 4, render_toc, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "render_html", 6, render_html, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "cache_new", 1, cache_new, 0 },
+  { "cache_stats", 1, cache_stats, 0 },
+  { "parse_references", 2, parse_references, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "url_map_new", 2, url_map_new, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "live_new", 2, live_new, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "live_edit", 4, live_edit, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "live_render", 1, live_render, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "compact_new", 4, compact_new, ERL_NIF_DIRTY_JOB_CPU_BOUND },
+  { "compact_render", 1, compact_render, ERL_NIF_DIRTY_JOB_CPU_BOUND }
 };
 
-ERL_NIF_INIT(Elixir.Cmark.Nif, nif_funcs, NULL, reload, upgrade, NULL)
+ERL_NIF_INIT(Elixir.Cmark.Nif, nif_funcs, load, reload, upgrade, unload)
@@ -0,0 +1,95 @@
+// Times cmark_markdown_to_html on the first 100 B to 2 MB of a document,
+// best of many runs, to compare builds.  Run with `make c-bench`, once
+// per build mode:
+//
+//     make c-bench
+//     make c-bench CMARK_LARGE_BUFFERS=1
+//
+// The document is made up of varied Markdown unless a file is given as
+// the first argument.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cmark.h"
+
+#define MAX_SIZE 2000000
+
+static const char SAMPLE[] =
+    "# A heading with *emphasis*\n\n"
+    "Some text with a [link](/url \"title\"), `code`, **strong** words\n"
+    "and a second line with an ![image](/i.png) and <b>html</b>.\n\n"
+    "> A quote with _emphasis_ and a [reference][ref].\n\n"
+    "- one item\n- two items with `code`\n  - and a nested one\n\n"
+    "1. first\n2. second\n\n"
+    "```c\nint main(void) { return 0; }\n```\n\n"
+    "    indented code\n\n"
+    "Setext heading\n--------------\n\n"
+    "A paragraph &amp; entities &copy; and an autolink <http://a.b/c>.\n\n"
+    "***\n\n"
+    "[ref]: /reference \"Title\"\n\n";
+
+static double S_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+// Fill 'buffer' with up to 'size' bytes of 'path', or of the sample.
+static size_t S_document(const char *path, char *buffer, size_t size) {
+  size_t len = 0, chunk;
+  FILE *file;
+
+  if (path != NULL) {
+    file = fopen(path, "rb");
+    if (file == NULL) {
+      perror(path);
+      exit(1);
+    }
+    len = fread(buffer, 1, size, file);
+    fclose(file);
+    return len;
+  }
+  while (len < size) {
+    chunk = sizeof(SAMPLE) - 1;
+    if (chunk > size - len) {
+      chunk = size - len;
+    }
+    memcpy(buffer + len, SAMPLE, chunk);
+    len += chunk;
+  }
+  return len;
+}
+
+int main(int argc, char **argv) {
+  static const size_t sizes[] = {100, 2000, 20000, 200000, MAX_SIZE};
+  char *buffer = (char *)malloc(MAX_SIZE);
+  size_t len, size, i, runs;
+  double best, start, elapsed, total;
+  char *html;
+
+  len = S_document(argc > 1 ? argv[1] : NULL, buffer, MAX_SIZE);
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size = sizes[i] < len ? sizes[i] : len;
+    best = 1e9;
+    // at least 5 runs, and about half a second of them
+    for (runs = 0, total = 0; runs < 5 || total < 0.5; runs++) {
+      start = S_now();
+      html = cmark_markdown_to_html(buffer, size, CMARK_OPT_DEFAULT);
+      elapsed = S_now() - start;
+      free(html);
+      total += elapsed;
+      if (elapsed < best) {
+        best = elapsed;
+      }
+    }
+    printf("%8lu bytes: %10.1f us\n", (unsigned long)size, best * 1e6);
+  }
+
+  free(buffer);
+  return 0;
+}
@@ -0,0 +1,342 @@
+// Tests of the C library that can't be made through the NIF: how it
+// allocates, what it does to trees and which paths it takes.  Run with
+// `make c-test`.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmark.h"
+#include "node.h"
+#include "parser.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,    \
+              __func__, #cond);                                                \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_STR(actual, expected)                                            \
+  do {                                                                         \
+    const char *a_ = (actual), *e_ = (expected);                               \
+    if (strcmp(a_, e_) != 0) {                                                 \
+      fprintf(stderr, "%s:%d: %s: got\n%s\nexpected\n%s\n", __FILE__,          \
+              __LINE__, __func__, a_, e_);                                     \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+// An allocator counting the allocations made through it.
+static size_t allocations = 0;
+
+static void *counting_calloc(size_t nmem, size_t size) {
+  allocations++;
+  return calloc(nmem, size);
+}
+
+static void *counting_realloc(void *ptr, size_t size) {
+  allocations++;
+  return realloc(ptr, size);
+}
+
+static cmark_mem COUNTING_MEM = {counting_calloc, counting_realloc, free};
+
+#define MAX_NODES 64
+
+// The data and flags of the nodes of a tree, in document order.
+typedef struct {
+  cmark_node *nodes[MAX_NODES];
+  unsigned char *data[MAX_NODES];
+  uint16_t flags[MAX_NODES];
+  int count;
+  int borrowed;
+} tree_state;
+
+static void S_tree_state(cmark_node *root, tree_state *state) {
+  cmark_iter *iter = cmark_iter_new(root);
+  cmark_node *node;
+
+  state->count = 0;
+  state->borrowed = 0;
+  while (cmark_iter_next(iter) != CMARK_EVENT_DONE) {
+    if (cmark_iter_get_event_type(iter) != CMARK_EVENT_ENTER) {
+      continue;
+    }
+    node = cmark_iter_get_node(iter);
+    if (state->count < MAX_NODES) {
+      state->nodes[state->count] = node;
+      state->data[state->count] = node->data;
+      state->flags[state->count] = node->flags;
+      state->count++;
+    }
+    if (node->flags & CMARK_NODE__BORROWED_DATA) {
+      state->borrowed++;
+    }
+  }
+  cmark_iter_free(iter);
+}
+
+static int S_same_tree_state(const tree_state *a, const tree_state *b) {
+  return a->count == b->count &&
+         memcmp(a->nodes, b->nodes, a->count * sizeof(cmark_node *)) == 0 &&
+         memcmp(a->data, b->data, a->count * sizeof(unsigned char *)) == 0 &&
+         memcmp(a->flags, b->flags, a->count * sizeof(uint16_t)) == 0;
+}
+
+// Rendering a tree, or reading its literals, leaves the literals borrowed
+// from the document where they are.
+static void test_borrowed_literals(void) {
+  static const char markdown[] =
+      "Some *text* with `code`\nand <b>html</b>.\n\n    indented\n";
+  cmark_parser *parser = cmark_parser_new_with_mem(0, &COUNTING_MEM);
+  cmark_node *doc, *text;
+  tree_state before, after;
+  const char *literal;
+  size_t len, first, second;
+  char *output;
+
+  cmark_parser_feed(parser, markdown, sizeof(markdown) - 1);
+  doc = cmark_parser_finish(parser);
+  cmark_parser_free(parser);
+
+  S_tree_state(doc, &before);
+  CHECK(before.borrowed > 0);
+
+  allocations = 0;
+  output = cmark_render_commonmark(doc, 0, 0);
+  first = allocations;
+  free(output);
+  allocations = 0;
+  output = cmark_render_commonmark(doc, 0, 0);
+  second = allocations;
+  CHECK_STR(output,
+            "Some *text* with `code`\nand <b>html</b>.\n\n``` \nindented\n```\n");
+  free(output);
+  CHECK(first == second);
+
+  S_tree_state(doc, &after);
+  CHECK(S_same_tree_state(&before, &after));
+
+  text = cmark_node_first_child(cmark_node_first_child(doc));
+  CHECK(text->flags & CMARK_NODE__BORROWED_DATA);
+  allocations = 0;
+  literal = cmark_node_get_literal(text);
+  CHECK(allocations == 0);
+  CHECK(literal == (const char *)text->data);
+  CHECK(cmark_node_get_literal_chunk(text, &len) == literal);
+  CHECK(len == 5 && memcmp(literal, "Some ", 5) == 0);
+  CHECK(text->flags & CMARK_NODE__BORROWED_DATA);
+
+  // unlinked, it gets a NUL-terminated copy of its own
+  cmark_node_unlink(text);
+  CHECK(!(text->flags & CMARK_NODE__BORROWED_DATA));
+  CHECK_STR(cmark_node_get_literal(text), "Some ");
+  cmark_node_free(text);
+
+  cmark_node_free(doc);
+}
+
+// Render 'markdown' as HTML, parsed with 'options'.
+static char *S_to_html(const char *markdown, int options) {
+  cmark_node *doc = cmark_parse_document(markdown, strlen(markdown), options);
+  char *html = cmark_render_html(doc, options);
+
+  cmark_node_free(doc);
+  return html;
+}
+
+// Lazily parsed inlines render as eagerly parsed ones.
+static void test_lazy_inlines(void) {
+  static const char markdown[] =
+      "# A *heading* with [a link][ref]\n\n"
+      "> quoted `code` and <b>html</b>\n\n"
+      "- item with ![image](/i.png)\n- **strong**\n\n"
+      "[ref]: /url \"title\"\n";
+  char *eager = S_to_html(markdown, CMARK_OPT_DEFAULT);
+  char *lazy = S_to_html(markdown, CMARK_OPT_LAZY_INLINES);
+  cmark_node *doc, *paragraph;
+
+  CHECK_STR(lazy, eager);
+  free(eager);
+  free(lazy);
+
+  doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                             CMARK_OPT_LAZY_INLINES);
+  paragraph = cmark_node_first_child(doc);
+  CHECK(cmark_node_inlines_pending(paragraph));
+  CHECK(cmark_node_get_type(cmark_node_first_child(paragraph)) ==
+        CMARK_NODE_TEXT);
+  CHECK(!cmark_node_inlines_pending(paragraph));
+  cmark_node_free(doc);
+}
+
+// Children added to a block whose inlines are pending come after them.
+static void test_lazy_inlines_mutation(void) {
+  static const char markdown[] = "hello *world*\n\nsecond\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_LAZY_INLINES);
+  cmark_node *first = doc->first_child, *second = first->next;
+  cmark_node *appended = cmark_node_new(CMARK_NODE_TEXT);
+  cmark_node *prepended = cmark_node_new(CMARK_NODE_TEXT);
+  char *html;
+
+  CHECK(cmark_node_inlines_pending(first));
+  CHECK(cmark_node_inlines_pending(second));
+  cmark_node_set_literal(appended, " APPENDED");
+  cmark_node_set_literal(prepended, "PREPENDED ");
+  CHECK(cmark_node_append_child(first, appended));
+  CHECK(cmark_node_prepend_child(second, prepended));
+
+  html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  CHECK_STR(html, "<p>hello <em>world</em> APPENDED</p>\n"
+                  "<p>PREPENDED second</p>\n");
+  free(html);
+  cmark_node_free(doc);
+}
+
+// Lazily parsed blocks spend the allowance for expanding references in
+// the order they are reached, which is document order for whole renders.
+static void test_lazy_inlines_reference_limit(void) {
+  // The allowance of 100 KB lets the long destination be used once.
+  size_t url_len = 60000;
+  const char *uses = "\n\n[a]\n\n[a]\n";
+  char *markdown = (char *)malloc(url_len + 64);
+  char *eager, *lazy, *html;
+  cmark_node *doc;
+
+  memcpy(markdown, "[a]: /", 6);
+  memset(markdown + 6, 'x', url_len);
+  strcpy(markdown + 6 + url_len, uses);
+
+  eager = S_to_html(markdown, CMARK_OPT_DEFAULT);
+  lazy = S_to_html(markdown, CMARK_OPT_LAZY_INLINES);
+  CHECK_STR(lazy, eager);
+  CHECK(strstr(eager, "<p>[a]</p>\n") != NULL);
+  CHECK(strstr(eager, "<p><a href=") == eager);
+
+  // The last paragraph, reached first, gets the link.
+  doc = cmark_parse_document(markdown, strlen(markdown),
+                             CMARK_OPT_LAZY_INLINES);
+  cmark_node_first_child(doc->last_child);
+  html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  CHECK(strstr(html, "<p>[a]</p>\n<p><a href=") == html);
+
+  free(html);
+  cmark_node_free(doc);
+  free(eager);
+  free(lazy);
+  free(markdown);
+}
+
+// Parsing an excerpt stops once the limits are reached, unless a label
+// in the blocks taken may be defined further on.
+static void test_excerpt_stops_early(void) {
+  static const char section[] = "Some text.\n\n";
+  static const char linked[] = "A [link].\n\n";
+  static const char definition[] = "[link]: /url\n";
+  size_t count = 1000, len = sizeof(section) - 1, i;
+  char *markdown = (char *)malloc(count * len + 64);
+  cmark_parser *parser;
+  cmark_node *doc;
+  char *html;
+
+  for (i = 0; i < count; i++) {
+    memcpy(markdown + i * len, section, len);
+  }
+  strcpy(markdown + count * len, definition);
+
+  parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+  doc = cmark_parser_parse_excerpt(parser, markdown, strlen(markdown), 2, 0);
+  CHECK(parser->line_number < 10);
+  html = cmark_render_html_excerpt(doc, CMARK_OPT_DEFAULT, 2, 0);
+  CHECK_STR(html, "<p>Some text.</p>\n<p>Some text.</p>\n");
+  free(html);
+  cmark_node_free(doc);
+  cmark_parser_free(parser);
+
+  // the label in the first block is only defined at the end
+  memcpy(markdown, linked, sizeof(linked) - 1);
+  memcpy(markdown + sizeof(linked) - 1, "\n", 1);
+  parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+  doc = cmark_parser_parse_excerpt(parser, markdown, strlen(markdown), 2, 0);
+  CHECK(parser->line_number > 2 * (int)count);
+  html = cmark_render_html_excerpt(doc, CMARK_OPT_DEFAULT, 2, 0);
+  CHECK_STR(html, "<p>A <a href=\"/url\">link</a>.</p>\n<p>Some text.</p>\n");
+  free(html);
+  cmark_node_free(doc);
+  cmark_parser_free(parser);
+
+  free(markdown);
+}
+
+#ifdef HAVE_PTHREAD_H
+// A split that turns out to be inside a block only joins the segments on
+// either side of it; the others are still parsed side by side.
+static void test_parallel_blocks_bad_split(void) {
+  static const char filler[] = "Some text.\n\n";
+  static const char pre_line[] = "text\n\n";
+  size_t size = 2400000, len = 0;
+  char *markdown = (char *)malloc(size + 64);
+  cmark_parser *parser;
+  cmark_node *doc;
+  char *serial, *parallel;
+
+  // the first split, near a quarter of the input, falls in an HTML block
+  while (len < size / 5) {
+    memcpy(markdown + len, filler, sizeof(filler) - 1);
+    len += sizeof(filler) - 1;
+  }
+  memcpy(markdown + len, "<pre>\n\n", 7);
+  len += 7;
+  while (len < size * 3 / 10) {
+    memcpy(markdown + len, pre_line, sizeof(pre_line) - 1);
+    len += sizeof(pre_line) - 1;
+  }
+  memcpy(markdown + len, "</pre>\n\n", 8);
+  len += 8;
+  while (len < size) {
+    memcpy(markdown + len, filler, sizeof(filler) - 1);
+    len += sizeof(filler) - 1;
+  }
+
+  doc = cmark_parse_document(markdown, len, CMARK_OPT_DEFAULT);
+  serial = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  cmark_node_free(doc);
+
+  parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+  cmark_parser_set_threads(parser, 4);
+  doc = cmark_parser_parse_document(parser, markdown, len);
+  CHECK(parser->segments == 3);
+  parallel = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  CHECK(strcmp(parallel, serial) == 0);
+
+  free(parallel);
+  free(serial);
+  cmark_node_free(doc);
+  cmark_parser_free(parser);
+  free(markdown);
+}
+#endif
+
+int main(void) {
+  test_borrowed_literals();
+  test_lazy_inlines();
+  test_lazy_inlines_mutation();
+  test_lazy_inlines_reference_limit();
+  test_excerpt_stops_early();
+#ifdef HAVE_PTHREAD_H
+  test_parallel_blocks_bad_split();
+#endif
+
+  if (failures > 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
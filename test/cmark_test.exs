@@ -6,6 +6,7 @@ defmodule CmarkTest do
     assert Cmark.to_man("") == "\n"
     assert Cmark.to_commonmark("") == "\n"
     assert Cmark.to_latex("") == "\n"
+    assert Cmark.to_text("") == ""
 
     assert Cmark.to_xml("") ==
              "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!DOCTYPE document SYSTEM \"CommonMark.dtd\">\n<document xmlns=\"http://commonmark.org/xml/1.0\" />\n"
@@ -31,6 +32,344 @@ defmodule CmarkTest do
     assert Cmark.to_xml(<<255>>, [:validate_utf8]) =~ "<text xml:space=\"preserve\">�</text>"
   end
 
+  test "reference dictionary" do
+    refs = Cmark.references("[foo]: /glossary/foo \"Foo\"\n[bar]: /glossary/bar\n\ntext")
+
+    assert Cmark.to_html("[Foo] and [baz]", references: refs) ==
+             "<p><a href=\"/glossary/foo\" title=\"Foo\">Foo</a> and [baz]</p>\n"
+
+    assert Cmark.to_html("[bar]: /local\n\n[bar]", references: refs) ==
+             "<p><a href=\"/local\">bar</a></p>\n"
+
+    assert Cmark.to_commonmark("[foo]", [:smart, references: refs]) ==
+             "[foo](/glossary/foo \"Foo\")\n"
+  end
+
+  test "unknown options" do
+    assert_raise ArgumentError, fn -> Cmark.to_html("text", referencse: nil) end
+    assert_raise ArgumentError, fn -> Cmark.to_html("text", [:smart, {"threads", 2}]) end
+    assert_raise ArgumentError, fn -> Cmark.to_html("text", threads: 0) end
+    assert_raise ArgumentError, fn -> Cmark.to_xml("text", threads: :auto) end
+  end
+
+  test "large documents" do
+    # big enough to have its inlines parsed on several threads
+    paragraph = "A *paragraph* with [a link][ref] and `code`.\n\n"
+    html = "<p>A <em>paragraph</em> with <a href=\"/url\">a link</a> and <code>code</code>.</p>\n"
+    count = 30_000
+
+    assert Cmark.to_html("[ref]: /url\n\n" <> String.duplicate(paragraph, count), threads: 4) ==
+             String.duplicate(html, count)
+  end
+
+  test "HTML blocks" do
+    document = "# Title\n\n- one\n- two\n\nText\n\nText\n"
+    blocks = Cmark.to_html_blocks(document)
+
+    assert [{1..1, _, _}, {3..5, _, _}, {6..6, h1, html}, {8..8, h2, html}] = blocks
+    assert h1 == h2
+    assert Enum.map_join(blocks, &elem(&1, 2)) == Cmark.to_html(document)
+    assert Cmark.to_html_blocks("") == []
+
+    keys = fn document -> document |> Cmark.to_html_blocks() |> Enum.map(&elem(&1, 1)) end
+    document = "Plain\n\nA [link]\n\n[link]: /url\n"
+    [plain, link] = keys.(document)
+    assert [^plain, changed] = keys.(String.replace(document, "/url", "/other"))
+    assert changed != link
+    assert [^plain, ^link] = keys.(document <> "\n[other]: /other\n")
+  end
+
+  test "source positions" do
+    document = "Title\n=====\n\n<!-- x -->\n\n<!--\nmulti\n-->\ntext\n"
+    xml = Cmark.to_xml(document, [:sourcepos])
+
+    # blocks end on their last line, not the one after or before it
+    assert xml =~ ~s(<heading sourcepos="1:1-2:5" level="1">)
+    assert xml =~ ~s(<html_block sourcepos="4:1-4:10")
+    assert xml =~ ~s(<html_block sourcepos="6:1-8:3")
+    assert xml =~ ~s(<paragraph sourcepos="9:1-9:4">)
+    assert [{1..1, _, _}] = Cmark.to_html_blocks("<!-- x -->\n")
+  end
+
+  test "HTML excerpts" do
+    sections = for i <- 1..50, do: "## Section #{i}\n\nText with [a *link*][ref].\n"
+    document = Enum.join(sections, "\n") <> "\n[ref]: /url\n"
+
+    assert Cmark.to_html_excerpt(document, []) == Cmark.to_html(document)
+
+    assert Cmark.to_html_excerpt(document, blocks: 2) ==
+             "<h2>Section 1</h2>\n<p>Text with <a href=\"/url\">a <em>link</em></a>.</p>\n"
+
+    assert Cmark.to_html_excerpt(document, chars: 24) ==
+             "<h2>Section 1</h2>\n<p>Text with <a href=\"/url\">a…</a></p>\n"
+
+    assert Cmark.to_html_excerpt("x <span>raw text</span>", [chars: 5], [:unsafe]) ==
+             "<p>x…</p>\n"
+
+    assert Cmark.to_html_excerpt("x <span>raw text</span>", chars: 5) ==
+             "<p>x <!-- raw HTML omitted -->raw…</p>\n"
+  end
+
+  test "plain text" do
+    document = "# Title\n\n<div>\nraw\n</div>\n\n- [one](/one)\n- `two`\n\n```\ncode\n```\n"
+
+    assert Cmark.to_text(document) == "Title\n\none\n\ntwo\n\ncode\n"
+    assert Cmark.to_text(document, [:unsafe]) == Cmark.to_text(document)
+    assert Cmark.to_text(document, separator: " ") == "Title one two code\n"
+
+    assert_raise ArgumentError, fn -> Cmark.to_text(document, separator: ?\s) end
+  end
+
+  test "streaming" do
+    document = "# Title\n\nSome *text* over\ntwo lines\n\n- [one](/one)\n- two\n\n```\ncode\n```\n"
+
+    for {format, render} <- [
+          html: &Cmark.to_html/2,
+          xml: &Cmark.to_xml/2,
+          man: &Cmark.to_man/2,
+          commonmark: &Cmark.to_commonmark/2,
+          latex: &Cmark.to_latex/2,
+          text: &Cmark.to_text/2
+        ] do
+      assert document |> Cmark.stream(format, chunk_size: 8) |> Enum.join() ==
+               render.(document, [])
+    end
+
+    assert [_] = document |> Cmark.stream(:html, chunk_size: 1) |> Enum.take(1)
+    refute_received _
+
+    assert_raise ArgumentError, fn -> Cmark.stream(document, :pdf) end
+    assert_raise ArgumentError, fn -> Cmark.stream(document, :html, chunk_size: 0) end
+    assert_raise ArgumentError, fn -> Cmark.stream(document, :html, chunk_size: "8") end
+  end
+
+  test "lazy inlines" do
+    document = "# *Title*\n\n[one] and `two`\n\n- **three**\n\n[one]: /one\n"
+
+    for options <- [[], [:sourcepos], [:heading_ids, :smart]] do
+      lazy = [:lazy_inlines | options]
+
+      assert Cmark.to_html(document, lazy) == Cmark.to_html(document, options)
+      assert Cmark.to_xml(document, lazy) == Cmark.to_xml(document, options)
+      assert Cmark.metadata(document, lazy) == Cmark.metadata(document, options)
+
+      assert document |> Cmark.stream(:html, [{:chunk_size, 4} | lazy]) |> Enum.join() ==
+               Cmark.to_html(document, options)
+    end
+  end
+
+  test "streaming waits for the consumer" do
+    ref = make_ref()
+    stream = Cmark.Nif.render_stream("# Title\n\ntext\n", 0, 1, nil, 1, nil, ref, 1, 2)
+
+    assert_receive {^ref, "<h1"}
+    assert_receive {^ref, ">Titl"}
+    refute_receive {^ref, _}, 100
+
+    :ok = Cmark.Nif.stream_ack(stream)
+    assert_receive {^ref, "e</h1>"}
+    refute_receive {^ref, _}, 100
+
+    :ok = Cmark.Nif.stream_cancel(stream)
+    assert_receive {^ref, :done}
+    refute_received _
+  end
+
+  test "pipelined streaming" do
+    document = "[one]: /one\n\n# Title\n\n- [one]\n- [two]\n\n# Title\n\n[two]: /two\n"
+    options = [:heading_ids, pipeline: true, chunk_size: 4]
+
+    assert document |> Cmark.stream(:html, options) |> Enum.join() ==
+             Cmark.to_html(String.replace(document, "[two]: /two\n", ""), [:heading_ids])
+
+    assert_raise ArgumentError, fn -> Cmark.stream(document, :xml, pipeline: true) end
+  end
+
+  test "metadata" do
+    document = "Setext *he`ad`*\n===\n\n## [Linked](/a) title\n\n    code\n\nun*believ*able words\n"
+
+    assert %{
+             headings: [
+               %{level: 1, text: "Setext head", lines: 1..2},
+               %{level: 2, text: "Linked title", lines: 4..4}
+             ],
+             links: [%{url: "/a", title: ""}],
+             images: [],
+             code_blocks: [""],
+             words: 6
+           } = Cmark.metadata(document)
+  end
+
+  test "heading ids" do
+    document = "Setext\n===\n\n# Setext-1\n\n# Setext"
+
+    assert Cmark.to_html(document, [:heading_ids]) ==
+             "<h1 id=\"setext\">Setext</h1>\n<h1 id=\"setext-1\">Setext-1</h1>\n<h1 id=\"setext-2\">Setext</h1>\n"
+
+    assert {html, [_, _, %{level: 1, id: "setext-2", text: "Setext"}]} =
+             Cmark.to_html_toc(document)
+
+    assert html == Cmark.to_html(document, [:heading_ids])
+  end
+
+  test "url rewrites" do
+    urls =
+      Cmark.url_map(
+        exact: [{"/img/a.png", "javascript:alert(1)"}],
+        prefixes: %{"/img/" => "https://cdn.example.com/img/", "/img/big/" => "/big/"}
+      )
+
+    document = "![a](/img/a.png) ![b](/img/b.png) ![c](/img/big/c.png) [d](/docs)"
+    cache = Cmark.cache(10_000_000)
+
+    html =
+      "<p><img src=\"\" alt=\"a\" /> <img src=\"https://cdn.example.com/img/b.png\" alt=\"b\" /> " <>
+        "<img src=\"/big/c.png\" alt=\"c\" /> <a href=\"/docs\">d</a></p>\n"
+
+    assert Cmark.to_html(document, urls: urls) == html
+    assert Cmark.to_html(document, urls: urls, cache: cache) == html
+    assert Cmark.to_html(document, cache: cache) == Cmark.to_html(document)
+  end
+
+  test "block cache" do
+    cache = Cmark.cache(10_000_000)
+    sections = for i <- 1..50, do: "## Section #{i}\n\nText with [a link][ref] and *emphasis*.\n"
+    document = Enum.join(sections, "\n") <> "\n[ref]: /url\n"
+    edited = String.replace(document, "Section 25\n", "Section 25, edited\n")
+
+    for options <- [[], [:sourcepos], [:smart, :unsafe]], source <- [document, edited] do
+      assert Cmark.to_html(source, [{:cache, cache} | options]) == Cmark.to_html(source, options)
+    end
+
+    # a changed definition changes the links of every block
+    redefined = String.replace(document, "/url", "/other")
+    assert Cmark.to_html(redefined, cache: cache) == Cmark.to_html(redefined)
+
+    assert %{hits: hits, misses: misses, entries: entries} = Cmark.cache_stats(cache)
+    assert hits > misses and entries > 0
+
+    # lazy inlines render the same blocks
+    assert Cmark.to_html(document, [:lazy_inlines, cache: cache]) == Cmark.to_html(document)
+    assert %{misses: ^misses, entries: ^entries} = Cmark.cache_stats(cache)
+  end
+
+  @specs "test/cmark_specs.json" |> File.read!() |> Jason.decode!(keys: :atoms)
+
+  # large enough to be split into segments whose blocks are parsed apart
+  defp grow(document), do: String.duplicate(document, div(4_000_000, byte_size(document)) + 1)
+
+  defp assert_same_as_serial(document) do
+    for options <- [[:unsafe], [:sourcepos, :smart]] do
+      assert Cmark.to_html(document, [{:threads, 4} | options]) ==
+               Cmark.to_html(document, [{:threads, 1} | options])
+
+      assert Cmark.to_xml(document, [{:threads, 4} | options]) ==
+               Cmark.to_xml(document, [{:threads, 1} | options])
+    end
+  end
+
+  test "parsing on several threads matches serial parsing of the spec examples" do
+    # an unclosed fence or HTML block would swallow everything after it,
+    # leaving nothing to split
+    @specs
+    |> Enum.map(& &1.markdown)
+    |> Enum.reject(&String.contains?(&1, ["```", "~~~", "<"]))
+    |> Enum.join("\n")
+    |> grow()
+    |> assert_same_as_serial()
+  end
+
+  test "parsing on several threads matches serial parsing of a large corpus" do
+    section = """
+    ## Section [title][ref]
+
+    Some *emphasis*, a [link](/url "title"), `code`
+    and a line break.\\
+    Lazy > continuation.
+
+    - item one
+
+      continued
+    - item two
+      1. nested
+
+    Paragraph right after a list.
+
+    ```elixir
+    def f do
+
+    :ok
+    end
+    ```
+
+    Text after the fence.
+
+        indented code
+
+    After indented code.
+
+    > quote
+    >
+    > with a blank line
+
+    <div>
+    raw html
+    </div>
+
+    Closing paragraph\r
+    with CRLF\r
+
+    [ref]: /reference "Reference"
+
+    """
+
+    section |> grow() |> assert_same_as_serial()
+  end
+
+  test "edits to live documents match parsing the edited source" do
+    source = @specs |> Enum.map(& &1.markdown) |> Enum.join("\n")
+    edits = ["", "x", "\n", "\n\n", "# ", "- ", "> ", "```", "    ", "[foo]: /url\n", "*"]
+
+    for options <- [[:unsafe], [:unsafe, :sourcepos]] do
+      live = Cmark.live("", options)
+      {0, 0, blocks} = Cmark.edit(live, {0, 0}, source)
+      assert Enum.join(blocks) == Cmark.to_html(source, options)
+
+      edits
+      |> Stream.cycle()
+      |> Stream.take(200)
+      |> Enum.with_index()
+      |> Enum.reduce({source, blocks}, fn {text, i}, {source, blocks} ->
+        offset = rem(i * 7919, byte_size(source) + 1)
+        length = min(rem(i, 4), byte_size(source) - offset)
+        {index, removed, fragments} = Cmark.edit(live, {offset, length}, text)
+        <<prefix::binary-size(offset), _::binary-size(length), suffix::binary>> = source
+        source = prefix <> text <> suffix
+        blocks = Enum.take(blocks, index) ++ fragments ++ Enum.drop(blocks, index + removed)
+
+        html = Cmark.to_html(source, options)
+        assert Cmark.live_html(live) == html
+        assert Enum.join(blocks) == html
+        {source, blocks}
+      end)
+    end
+
+    assert_raise ArgumentError, fn -> Cmark.live("# Title", [:heading_ids]) end
+  end
+
+  test "compact trees render as parsed documents" do
+    options_lists = [[], [:unsafe], [:sourcepos, :hardbreaks], [:nobreaks, :smart], [:heading_ids]]
+
+    for options <- options_lists, %{markdown: markdown} <- @specs do
+      assert markdown |> Cmark.compact(options) |> Cmark.compact_html() ==
+               Cmark.to_html(markdown, options)
+    end
+
+    refs = Cmark.references("[home]: /home")
+    assert "[home]" |> Cmark.compact(references: refs) |> Cmark.compact_html() ==
+             "<p><a href=\"/home\">home</a></p>\n"
+  end
+
   @invalid_when_safe [
     "<script>alert(document.cookie);</script>",
     "</span>",